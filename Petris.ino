@@ -1,12 +1,22 @@
 #include <Arduboy2.h>
+#include <EEPROM.h>
 
-// Only one of these is allowed to be defined at a time
+// Only one of these is allowed to be defined at a time. Host builds pick theirs on the command line instead.
 //#define CONFIGURATION_TEST
 //#define CONFIGURATION_DEBUG
+//#define CONFIGURATION_BENCHMARK
+//#define CONFIGURATION_PROFILE
+//#define CONFIGURATION_SOAK
+#ifndef HOST_BUILD
 #define CONFIGURATION_RELEASE
+#endif // #ifndef HOST_BUILD
 
 #include "Shared.h"
 #include "Petris_Debugging.h"
+#include "Petris_Buttons.h"
+#include "Petris_Display.h"
+#include "Petris_Text.h"
+#include "Petris_Profiler.h"
 
 // Type-safe enum for tracking Tetrimino indices
 // Note: There are 7 options, so even with an extra entry for "None", this could be stored in 3-bits
@@ -54,6 +64,15 @@ constexpr uint8 k_softDropButton = DOWN_BUTTON;
 // Note: An unassigned button using the Input class should be 0x00, but using Arduboy2's input functions, it should be 0xFF
 constexpr uint8 k_hardDropButton = 0x00;  // There's not a good button for hard drop. I'd prefer to have "hold" than hard drop
 constexpr uint8 k_holdButton = UP_BUTTON;
+// Hold during replay playback to fast-forward
+constexpr uint8 k_replayTurboButton = B_BUTTON;
+// Press together to pause the game. The game is saved while it's paused, so it can be turned off.
+constexpr uint8 k_pauseButtons = A_BUTTON | B_BUTTON;
+// Press to carry on with a paused game. Only one button does, so a press meant for something else can't also resume.
+constexpr uint8 k_resumeButton = A_BUTTON;
+#ifdef PROFILING_ENABLED
+constexpr uint8 k_profilerOverlayButtons = LEFT_BUTTON | RIGHT_BUTTON;
+#endif // #ifdef PROFILING_ENABLED
 
 constexpr uint8 k_frameRate = 60;
 constexpr uint8 k_screenWidth = 128;
@@ -66,6 +85,8 @@ constexpr uint8 k_screenHeight = 64;
 constexpr GameTicks k_gameTicksPerSecond = 240;
 constexpr GameTicks k_gameTicksPerFrame = k_gameTicksPerSecond / k_frameRate;
 static_assert(k_gameTicksPerSecond == k_gameTicksPerFrame * k_frameRate, "Game Ticks should be an integer multiple of the frame rate");
+// Ticks until something happens, for things that only happen when a button changes
+constexpr GameTicks k_ticksUntilInput = 0xFF;
 // Helper function to convert floating point seconds to GameTicks
 constexpr GameTicks SecondsToGameTicks(const float s)
 {
@@ -77,6 +98,9 @@ constexpr uint8 k_gridWidth = 10;
 constexpr uint8 k_gridHeight = 24;
 constexpr uint8 k_defaultPieceSpawnX = 3;
 constexpr uint8 k_defaultPieceSpawnY = 21;  // Top 4 rows are hidden
+constexpr uint8 k_visibleGridHeight = k_gridHeight - 4;
+// Pieces fit in a 4x4 box, so their shapes can be described by four rows of four bits
+constexpr uint8 k_pieceMaskSize = 4;
 constexpr uint8 k_softDropSpeedScalar = 20;  // TODO: Reevaluate how soft drop speed is calculated to ensure it scales with speed correctly
 // How long player has to manipulate piece once it has touched the groud
 constexpr GameTicks k_defaultLockDownDelay = SecondsToGameTicks(0.5f);
@@ -85,9 +109,12 @@ constexpr uint8 k_defaultLockDownMoveCount = 15;
 
 // Guideline: ~0.3s before auto-repeat kicks in. 72 ticks = 0.3s. This likely wants to be an integer multiple of k_gameTicksPerFrame.
 constexpr GameTicks k_autoRepeatFirstDelayTicks = 36; // 36 ticks = 9 frames @ 60fps = 0.15s
+static_assert(k_autoRepeatFirstDelayTicks >= k_gameTicksPerFrame, "Timing from the press can't use up the whole delay");
 // Guideline: ~0.5s to move Tetrimino from one side to the other.
 constexpr GameTicks k_autoRepeatContinueDelayTicks = 12; // 12 ticks = 3 frames @ 60fps = 0.05s
 constexpr GameTicks k_ticksBetweenLockDownAndNextPiece = SecondsToGameTicks(0.1f);  // 0.1s == 24 ticks == 6 frames
+// How long full lines take to be erased before the stack above them collapses. The collapse takes one more frame per line.
+constexpr GameTicks k_lineClearAnimationTicks = SecondsToGameTicks(0.4f);  // 0.4s == 96 ticks == 24 frames
 
 //     Top of screen (0)-- *                              *
 //                         *                              *
@@ -112,15 +139,53 @@ constexpr uint8 k_gridBottomPos = k_borderBottomPos - k_blockHeight;
 constexpr uint8 k_gridLeftPos = (k_screenWidth / 2) - (k_playspaceWidth / 2);
 
 constexpr uint8 k_numNextPiecesToShow = 5;
-static_assert(k_numNextPiecesToShow <= 5, "Current implementation of 7-bag piece randomization doesn't support looking ahead more than 5 pieces");
+// Number of upcoming pieces Next can report, which can be more than are shown
+constexpr uint8 k_nextLookahead = 7;
+static_assert(k_numNextPiecesToShow <= k_nextLookahead, "Can't show more Next pieces than are looked ahead");
 
 // These positions aren't cleanly defined procedurally. The "magic numbers" don't accurately describe why they're needed.
 // Maybe these coordinates should just be straight screen-space coordinates?
 constexpr uint8 k_nextDisplayLeftPos = k_gridLeftPos + k_playspaceWidth + (2 * k_blockWidth);
 constexpr uint8 k_nextDisplayBottomPos = ((2 + k_numNextPiecesToShow) * 3) * k_blockHeight;
+static_assert(k_nextDisplayBottomPos < k_screenHeight, "Next pieces don't fit on the screen");
 constexpr uint8 k_holdDisplayLeft = k_gridLeftPos - (6 * k_blockWidth);
 constexpr uint8 k_holdDisplayBottom = 3 * k_blockHeight;
 
+// Replays are saved to EEPROM, after the space Arduboy2 reserves for system settings
+constexpr uint16 k_replayEepromStart = EEPROM_STORAGE_SPACE_START;
+constexpr uint16 k_replayEepromSize = 512;
+// First byte of a saved replay; change it whenever the replay format or game logic changes
+constexpr uint8 k_replayHeaderTag = 0xA2;
+// Arduboy2 doesn't use the bottom two bits of button masks, so a run in a replay keeps the press ticks of its first frame there
+constexpr uint8 k_replayPressTicksMask = 0x03;
+static_assert(((UP_BUTTON | DOWN_BUTTON | LEFT_BUTTON | RIGHT_BUTTON | A_BUTTON | B_BUTTON) & k_replayPressTicksMask) == 0, "Press ticks can't share bits with buttons in a replay");
+static_assert(k_gameTicksPerFrame - 1 <= k_replayPressTicksMask, "Replays need to hold press ticks up to a whole frame");
+// Mask of the run that ends a replay, if the replay stopped before the game ended (ie. it ran out of space)
+constexpr uint8 k_replayTruncatedMask = 0x01;
+// Number of bytes that can be waiting to be written to EEPROM
+constexpr uint8 k_replayQueueSize = 16;
+// Number of frames run per displayed frame when fast-forwarding a replay
+constexpr uint8 k_replayTurboFrames = 8;
+
+// A snapshot of the game is saved to EEPROM while it's paused, right after the replay
+constexpr uint16 k_snapshotEepromStart = k_replayEepromStart + k_replayEepromSize;
+constexpr uint16 k_snapshotEepromSize = 256;
+// First byte of a saved snapshot; change it whenever the snapshot format changes
+constexpr uint8 k_snapshotHeaderTag = 0x5A;
+static_assert(k_snapshotEepromStart + k_snapshotEepromSize <= E2END + 1, "Snapshot doesn't fit in EEPROM");
+
+// Microseconds per frame the bot can spend searching for where to put a piece. At least one placement is scored every frame.
+constexpr uint16 k_botSearchMicrosPerFrame = 4000;
+// If the bot hasn't reached its target after this many frames (ie. something is in the way), it drops the piece where it is
+constexpr uint8 k_botMaxMoveFrames = 60;
+
+// Every versus message starts with this byte, so the receiver can find the next message after losing bytes
+constexpr uint8 k_versusSyncByte = 0xA5;
+// Versus messages waiting to be sent over serial. Must fit a message with every row of the grid in it.
+constexpr uint8 k_versusSendQueueSize = 64;
+// Lines of garbage sent to the other player for clearing 1, 2, 3, and 4 lines at once
+const uint8 k_versusGarbageForLines[] PROGMEM = { 0, 1, 2, 4 };
+
 constexpr uint8 k_minStartingLevel = 1;
 constexpr uint8 k_maxStartingLevel = 19;
 constexpr uint8 k_maxLevel = 19;
@@ -129,6 +194,7 @@ enum class GameState : uint8
 {
   MainMenu,
   Playing,
+  Paused,
   GameOver,
 };
 
@@ -139,6 +205,14 @@ enum class PlayingState : uint8
   NextPieceDelay,
 };
 
+enum class PlayMode : uint8
+{
+  Human,
+  Bot,
+  Versus,
+  Count
+};
+
 enum class GameOverReason : uint8
 {
   None,     // The game isn't over
@@ -169,99 +243,469 @@ enum class GameplayStats : uint8
   Count
 };
 
+// Small, fast, seedable random number generator (xorshift32)
+// The same seed always produces the same sequence, so anything built on it can be reproduced and tested
 class Random
 {
 public:
-  void SetSeed(uint32 seed) { m_seed = seed; }
+  // xorshift gets stuck at 0, so a 0 seed is swapped for a non-zero one
+  void SetSeed(uint32 seed) { m_state = (seed != 0) ? seed : k_zeroSeedReplacement; }
+  // Stirs extra entropy into the state (ie. the timing of button presses)
+  void Mix(uint32 entropy) { SetSeed(m_state ^ entropy); Next32(); }
+  // Passing the state to SetSeed() carries on with the same sequence
+  uint32 GetState() const { return m_state; }
+  // Returns 32 random bits
+  uint32 Next32()
+  {
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return m_state;
+  }
+  // Returns a random number in [0, range) without bias. Range must be at least 1.
+  // Values outside the range are rejected instead of using modulo, which is biased and slow on AVR.
+  uint8 NextInRange(uint8 range);
+
 private:
-  uint32 m_seed;
+  static constexpr uint32 k_zeroSeedReplacement = 0x9E3779B9;
+  uint32 m_state;
 };
 
-class Grid
+// Packs values into bytes a few bits at a time, lowest bits first.
+// Bytes go to a buffer in RAM, or straight to EEPROM.
+class BitWriter
 {
 public:
-  Grid() {}
+  BitWriter(uint8* buffer, uint16 maxBytes) : m_buffer(buffer), m_eepromAddress(0), m_maxBytes(maxBytes) {}
+  BitWriter(uint16 eepromAddress, uint16 maxBytes) : m_buffer(nullptr), m_eepromAddress(eepromAddress), m_maxBytes(maxBytes) {}
 
-  constexpr uint8 GetIndex(uint8 x, uint8 y) { return x + (y * k_gridWidth); }
-  constexpr uint8 GetWidth() { return k_gridWidth; }
-  constexpr uint8 GetHeight() { return k_gridHeight; }
+  // Writes the low 'numBits' bits of 'value'
+  void Write(uint32 value, uint8 numBits);
+  // Writes out the last partly filled byte. Must be called after everything has been written.
+  void Finish();
+  // Number of bytes written, including ones that didn't fit
+  uint16 GetNumBytes() const { return m_numBytes; }
+  bool HasOverflowed() const { return m_numBytes > m_maxBytes; }
 
-  void Clear() { memset(m_grid, 0x00, sizeof(m_grid)); }
+private:
+  void WriteByte(uint8 value);
+
+  uint8* m_buffer;
+  uint16 m_eepromAddress;
+  uint16 m_maxBytes;
+  uint16 m_numBytes = 0;
+  // Bits that don't fill a byte yet
+  uint8 m_pendingBits = 0;
+  uint8 m_numPendingBits = 0;
+};
 
-  // Note: It's not necessary to check for >= 0 because the passed in values are unsigned
-  bool IsValidPosition(uint8 x, uint8 y) const { return (x < k_gridWidth) && (y < k_gridHeight); }
-  BlockIndex Get(uint8 x, uint8 y) const { return m_grid[GetIndex(x, y)]; }
-  void Set(uint8 x, uint8 y, BlockIndex value) { m_grid[GetIndex(x, y)] = value; }
-  bool IsEmpty(uint8 x, uint8 y) const { return Get(x, y) == BlockIndex::Empty; }
+// Reads back what a BitWriter wrote
+class BitReader
+{
+public:
+  BitReader(const uint8* buffer, uint16 maxBytes) : m_buffer(buffer), m_eepromAddress(0), m_maxBytes(maxBytes) {}
+  BitReader(uint16 eepromAddress, uint16 maxBytes) : m_buffer(nullptr), m_eepromAddress(eepromAddress), m_maxBytes(maxBytes) {}
 
-#ifdef DEBUGGING_ENABLED
-  void DebugPrint(const char* msg) const;
-#endif // #ifdef DEBUGGING_ENABLED
-  void Draw() const;
-  void ProcessFullLines();
+  uint32 Read(uint8 numBits);
+  // Reading past the end returns zeros and sets this
+  bool HasOverflowed() const { return m_numBytes > m_maxBytes; }
 
 private:
-  BlockIndex m_grid[k_gridWidth * k_gridHeight];
-  static_assert(k_gridWidth * k_gridHeight <= 256, "If grid is larger than 256, grid indices will no longer fit in uint8");
+  uint8 ReadByte();
+
+  const uint8* m_buffer;
+  uint16 m_eepromAddress;
+  uint16 m_maxBytes;
+  uint16 m_numBytes = 0;
+  // Bits of the last byte read that haven't been returned yet
+  uint8 m_pendingBits = 0;
+  uint8 m_numPendingBits = 0;
 };
 
-// Packs an (x, y) rotation offset into one byte
-// Bottom 4-bits are signed x offset. Top 4-bits are signed y offset.
-// Supported range of this encoding is [-8..7] for each axis
-class RotationOffset
+// Where the grid is drawn on screen.
+// Normally the grid is drawn with 3x3 blocks, which fits every visible row on screen. With 4x4 blocks only 16 rows
+// fit, so the view scrolls a row at a time to follow the piece. Scrolling only changes what's drawn, not gameplay.
+class Viewport
 {
 public:
-  RotationOffset(int8 deltaX, int8 deltaY) :
-    m_packedOffsets((deltaY << 4) | (deltaX & 0x0f))
+  void SetLargeBlocks(bool largeBlocks)
   {
-#ifdef DEBUGGING_ENABLED
-    int8 testX;
-    int8 testY;
-    UnpackOffset(testX, testY);
-    Assert((testX == deltaX) && (testY == deltaY));
-#endif // #ifdef DEBUGGING_ENABLED
+    m_blockSize = largeBlocks ? k_largeBlockSize : k_blockHeight;
+    m_cameraRow = 0;
   }
+  bool HasLargeBlocks() const { return m_blockSize == k_largeBlockSize; }
+  uint8 GetBlockSize() const { return m_blockSize; }
+  // 'numColumns' is the width of the grid being drawn
+  uint8 GetLeft(uint8 numColumns = k_gridWidth) const { return (k_screenWidth / 2) - (GetWidth(numColumns) / 2); }
+  uint8 GetWidth(uint8 numColumns = k_gridWidth) const { return numColumns * m_blockSize; }
+  // Screen position of the top of the lowest row in view. Small blocks leave room for the floor under the grid.
+  uint8 GetBottom() const { return k_screenHeight - m_blockSize - (HasLargeBlocks() ? 0 : 1); }
+  // Lowest row of the grid in view
+  uint8 GetCameraRow() const { return m_cameraRow; }
+  // Moves the camera a row towards the lowest position that still shows 'topRow'
+  void ScrollTowards(uint8 topRow);
 
-  void UnpackOffset(int8& outDeltaX, int8& outDeltaY) const
-  {
-    // Intermediate cast to int8 ensures sign-extension
-    outDeltaX = int8(m_packedOffsets << 4) >> 4;
-    outDeltaY = m_packedOffsets >> 4;
-  }
 private:
-  // signed value so unpacking will be sign-extended
-  int8 m_packedOffsets;
+  uint8 m_blockSize = k_blockHeight;
+  uint8 m_cameraRow = 0;
 };
 
-class RotationOffsets
+// The playing field, 't_width' columns by 't_height' rows. Row 0 is the bottom.
+// The types used for cell indices and row masks are the smallest that fit the dimensions, so the standard grid
+// uses bytes for indices and 16 bits for rows, and bigger grids get wider types without any other changes.
+template <uint8 t_width, uint8 t_height>
+class GridT
 {
 public:
-  constexpr uint8 GetNumRotationOffsets() { return k_numAlternateRotationOffsets + 1; }
+  // When testing a piece against a row, this many solid "wall" columns are added to either side of the row.
+  // This lets pieces that hang off the edge of the grid be tested with the same AND as everything else.
+  static constexpr uint8 k_wallWidth = 3;
+  // Index of a cell in the grid
+  using Index = UintForBits<BitsFor(uint32(t_width) * t_height)>;
+  // Occupancy of one row of the grid. Bit 'x' is set if the cell in column 'x' is filled.
+  // Wide enough for the walls too.
+  using RowMask = UintForBits<t_width + (2 * k_wallWidth)>;
+  static constexpr RowMask k_fullRowMask = (RowMask(1) << t_width) - 1;
+  static constexpr RowMask k_wallMask = RowMask(~(k_fullRowMask << k_wallWidth));
+  static constexpr uint8 k_maxPieceShift = (sizeof(RowMask) * 8) - k_pieceMaskSize;
+
+  GridT() {}
+
+  constexpr Index GetIndex(uint8 x, uint8 y) { return x + (y * Index(t_width)); }
+  constexpr uint8 GetWidth() { return t_width; }
+  constexpr uint8 GetHeight() { return t_height; }
+
+  void Clear()
+  {
+    memset(m_grid, 0x00, sizeof(m_grid));
+    memset(m_rowMasks, 0x00, sizeof(m_rowMasks));
+    memset(m_columnHeights, 0x00, sizeof(m_columnHeights));
+    m_clearingRows = 0;
+    m_clearedColumns = 0;
+    MarkAllDirty();
+    m_revision++;
+  }
+
+  // Note: It's not necessary to check for >= 0 because the passed in values are unsigned
+  bool IsValidPosition(uint8 x, uint8 y) const { return (x < t_width) && (y < t_height); }
+  BlockIndex Get(uint8 x, uint8 y) const { return m_grid[GetIndex(x, y)]; }
+  void Set(uint8 x, uint8 y, BlockIndex value)
+  {
+    m_grid[GetIndex(x, y)] = value;
+    m_dirtyCells[y] |= (RowMask(1) << x);
+    m_revision++;
+    if (value == BlockIndex::Empty)
+    {
+      m_rowMasks[y] &= ~(RowMask(1) << x);
+      if (y + 1 == m_columnHeights[x])
+      {
+        // The top of the column was removed; find the next filled cell below it
+        LowerColumnHeight(x, y);
+      }
+    }
+    else
+    {
+      m_rowMasks[y] |= (RowMask(1) << x);
+      m_columnHeights[x] = Max<uint8>(m_columnHeights[x], y + 1);
+    }
+  }
+  bool IsEmpty(uint8 x, uint8 y) const { return (m_rowMasks[y] & (RowMask(1) << x)) == 0; }
+  RowMask GetRowMask(uint8 y) const { return m_rowMasks[y]; }
+  // Changes whenever any cell of the grid changes, so results computed from the grid can be cached
+  uint16 GetRevision() const { return m_revision; }
+
+  // Skyline - Height of column 'x' is one more than the 'y' of its highest filled cell, or 0 if the column is empty
+  uint8 GetColumnHeight(uint8 x) const { return m_columnHeights[x]; }
+  uint8 GetMaxColumnHeight() const;
+  // Number of empty cells that have a filled cell somewhere above them
+  Index CountHoles() const;
+  // Sum of the height differences between neighboring columns
+  Index GetBumpiness() const;
+
+  // pieceX, pieceY : (x, y) grid position of the piece's origin
+  // pieceRows : Occupancy of the piece's rows, starting at pieceY. Bit 0 is the piece's left-most column.
+  // Returns 'true' if none of the piece's blocks overlap a filled cell or fall outside the grid
+  bool DoesPieceMaskFit(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize]) const;
+  // Returns the lowest 'y' a piece that fits at (pieceX, pieceY) can fall straight down to
+  uint8 GetPieceMaskLandingY(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize]) const;
+
+  // Dirty cells are redrawn by the next call to Draw(). Everything else is assumed to already be on screen.
+  void MarkAllDirty() { memset(m_dirtyCells, 0xFF, sizeof(m_dirtyCells)); }
+  // Scrolls what's on screen to where the viewport's camera is now, and marks the rows that scrolled into view dirty.
+  // Must be called before anything checks which cells are dirty for the frame.
+  void PrepareDraw();
+  // Marks the cells covered by a piece as dirty (ie. to erase a piece that was drawn over the grid)
+  void MarkPieceMaskDirty(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize]);
+  // Returns 'true' if any of the cells covered by a piece will be redrawn by the next call to Draw()
+  bool IsPieceMaskDirty(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize]) const;
+
+#ifdef DEBUGGING_ENABLED
+  void DebugPrint(const char* msg) const;
+#endif // #ifdef DEBUGGING_ENABLED
+  // Redraws dirty cells only
+  void Draw();
+
+  // Clearing lines is split into steps so the work can be spread across frames.
+  // BeginClearingFullLines() finds the full lines, SetClearedColumns() animates them being erased,
+  // and CollapseClearedLine() removes them one at a time.
+  // Returns the number of full lines found
+  uint8 BeginClearingFullLines();
+  // Cells of the lines being cleared that are in 'columns' are drawn as empty
+  void SetClearedColumns(RowMask columns);
+  // Removes the highest line being cleared and moves everything above it down.
+  // If 'shiftScreen' is set, what's already on screen is moved down to match instead of being redrawn. That's
+  // only valid if the screen is up to date apart from dirty cells and nothing else is drawn over the grid.
+  // Returns 'true' if there are more lines to remove
+  bool CollapseClearedLine(bool shiftScreen);
+  // Clears all full lines at once
+  void ProcessFullLines();
+  // Moves everything up by 'count' rows, and fills the rows left at the bottom with 'block', apart from one
+  // empty cell in column 'holeX'. Returns 'false' if any filled cells were pushed off the top of the grid.
+  bool AddGarbageRows(uint8 count, uint8 holeX, BlockIndex block);
 
-  RotationOffset GetRotationOffset(PieceOrientation startingOrientation, RotationDirection direction, uint8 rotationIndex) const
+  // Packs the grid into a snapshot. Load() replaces the grid, and returns 'false' if the data isn't a valid grid.
+  // Only grids with up to 32 rows and columns can be saved, since rows and columns are written a mask at a time.
+  void Save(BitWriter& writer) const;
+  bool Load(BitReader& reader);
+
+private:
+  static constexpr uint8 k_blockIndexBits = BitsFor(uint8(BlockIndex::Count));
+  static constexpr uint8 k_paletteSizeBits = BitsFor(uint8(BlockIndex::Count) + 1);
+
+  BlockIndex m_grid[t_width * t_height];
+  // Rows are sometimes handled as int8, ie. while walking a piece down past the floor
+  static_assert(t_height <= 127, "Grid is too tall for its rows to be handled as int8");
+  // Occupancy plane; kept in sync with m_grid by Set() and ProcessFullLines()
+  RowMask m_rowMasks[t_height];
+  // Cells that have changed since they were last drawn. Same layout as m_rowMasks.
+  RowMask m_dirtyCells[t_height];
+  // Skyline; kept in sync by Set(), Clear(), and ProcessFullLines()
+  uint8 m_columnHeights[t_width];
+  // Sets the height of column 'x' to the top filled cell at or below 'maxHeight'
+  void LowerColumnHeight(uint8 x, uint8 maxHeight)
   {
-    if (rotationIndex == 0) { return RotationOffset(0, 0); }
-    // Because rotationIndex of 0 isn't saved in m_rotationData, the array index is one off of rotationIndex
-    return m_rotationData[uint8(direction)][uint8(startingOrientation)][rotationIndex - 1];
+    while ((maxHeight > 0) && IsEmpty(x, maxHeight - 1))
+    {
+      maxHeight--;
+    }
+    m_columnHeights[x] = maxHeight;
   }
+  // Screen position the grid was last drawn at; used to detect the lock down "shake"
+  uint8 m_drawnBottomPos;
+  // Viewport the screen was last drawn with
+  uint8 m_drawnBlockSize;
+  uint8 m_drawnCameraRow;
+  // Incremented by everything that modifies the grid, so cached results can tell when they're stale
+  uint16 m_revision;
+  // Bit 'y' is set for each line that's waiting to be removed by CollapseClearedLine()
+  using LineMask = UintForBits<t_height>;
+  static_assert(t_height <= sizeof(LineMask) * 8, "Every row of the grid needs a bit in a LineMask");
+  LineMask m_clearingRows;
+  // Columns of the lines being cleared that have been erased so far
+  RowMask m_clearedColumns;
+  static_assert(t_width + (2 * k_wallWidth) <= sizeof(RowMask) * 8, "Grid row and walls need to fit in a RowMask");
+};
 
-// Public member so it can use bracket initialization
-public:
-  static constexpr uint8 k_numAlternateRotationOffsets = 4;
-  RotationOffset m_rotationData[uint8(RotationDirection::Count)][uint8(PieceOrientation::Count)][k_numAlternateRotationOffsets];
+// The grid the game is played on
+using Grid = GridT<k_gridWidth, k_gridHeight>;
+// Bigger types would make every grid operation slower
+static_assert((sizeof(Grid::Index) == 1) && (sizeof(Grid::RowMask) == 2), "The standard grid should use the smallest types");
+
+// Wall and floor kicks from the Super Rotation System (see "Super Rotation System.md")
+// When a rotation is blocked, up to k_numSrsKicks alternate (x, y) offsets are tried in order.
+// Every offset is in [-2..2] on both axes, so a kick packs into 5 bits as (x + 2) + ((y + 2) * 5).
+struct SrsKick
+{
+  int8 x;
+  int8 y;
+};
+constexpr uint8 k_numSrsKicks = 4;
+constexpr uint8 k_srsKickBits = 5;
+constexpr uint8 k_srsKickRange = 5;
+// Kicks per table, indexed by [direction][startingOrientation][kick]
+constexpr uint8 k_numSrsKicksPerTable = uint8(RotationDirection::Count) * uint8(PieceOrientation::Count) * k_numSrsKicks;
+// The packed kicks are read 16 bits at a time, so there's an extra byte of padding at the end
+constexpr uint8 k_packedSrsKicksSize = (((k_numSrsKicksPerTable * k_srsKickBits) + 7) / 8) + 1;
+// The "n/a" entries in the documented tables. They're skipped rather than tested.
+constexpr SrsKick k_srsKickNone = {-128, -128};
+constexpr uint8 k_packedSrsKickNone = 0x1F;
+
+using SrsKickTable = SrsKick[uint8(RotationDirection::Count)][uint8(PieceOrientation::Count)][k_numSrsKicks];
+using PackedSrsKicks = uint8[k_packedSrsKicksSize];
+
+constexpr bool IsSrsKickNone(SrsKick kick)
+{
+  return (kick.x == k_srsKickNone.x) && (kick.y == k_srsKickNone.y);
+}
+
+constexpr uint8 PackSrsKick(SrsKick kick)
+{
+  return IsSrsKickNone(kick) ? k_packedSrsKickNone : uint8((kick.x + 2) + ((kick.y + 2) * k_srsKickRange));
+}
+
+constexpr int8 UnpackSrsKickX(uint8 packedKick) { return int8(packedKick % k_srsKickRange) - 2; }
+constexpr int8 UnpackSrsKickY(uint8 packedKick) { return int8(packedKick / k_srsKickRange) - 2; }
+
+constexpr uint8 GetSrsKickIndex(RotationDirection direction, PieceOrientation startingOrientation, uint8 kick)
+{
+  return (((uint8(direction) * uint8(PieceOrientation::Count)) + uint8(startingOrientation)) * k_numSrsKicks) + kick;
+}
+
+constexpr SrsKick GetSrsKick(const SrsKickTable& kicks, uint8 kickIndex)
+{
+  return kicks[kickIndex / (uint8(PieceOrientation::Count) * k_numSrsKicks)][(kickIndex / k_numSrsKicks) % uint8(PieceOrientation::Count)][kickIndex % k_numSrsKicks];
+}
+
+// Returns one bit of the packed table. Kick 'n' is stored in bits [n * 5, n * 5 + 5).
+constexpr uint8 GetPackedSrsKickBit(const SrsKickTable& kicks, uint16 bitIndex)
+{
+  return ((bitIndex / k_srsKickBits) < k_numSrsKicksPerTable)
+    ? ((PackSrsKick(GetSrsKick(kicks, bitIndex / k_srsKickBits)) >> (bitIndex % k_srsKickBits)) & 0x01)
+    : 0;
+}
+
+constexpr uint8 GetPackedSrsKickByte(const SrsKickTable& kicks, uint8 byteIndex)
+{
+  return GetPackedSrsKickBit(kicks, (byteIndex * 8) + 0)
+    | (GetPackedSrsKickBit(kicks, (byteIndex * 8) + 1) << 1)
+    | (GetPackedSrsKickBit(kicks, (byteIndex * 8) + 2) << 2)
+    | (GetPackedSrsKickBit(kicks, (byteIndex * 8) + 3) << 3)
+    | (GetPackedSrsKickBit(kicks, (byteIndex * 8) + 4) << 4)
+    | (GetPackedSrsKickBit(kicks, (byteIndex * 8) + 5) << 5)
+    | (GetPackedSrsKickBit(kicks, (byteIndex * 8) + 6) << 6)
+    | (GetPackedSrsKickBit(kicks, (byteIndex * 8) + 7) << 7);
+}
+
+// Compile-time version of reading a kick back out of a packed table, for verifying the tables
+constexpr uint8 ReadPackedSrsKick(const PackedSrsKicks& packedKicks, uint8 kickIndex)
+{
+  return ((packedKicks[(kickIndex * k_srsKickBits) / 8] | (packedKicks[((kickIndex * k_srsKickBits) / 8) + 1] << 8))
+    >> ((kickIndex * k_srsKickBits) % 8)) & k_packedSrsKickNone;
+}
+
+// Returns 'true' if every kick from 'kickIndex' on unpacks to the same offset as the table it was packed from
+constexpr bool DoPackedSrsKicksMatch(const PackedSrsKicks& packedKicks, const SrsKickTable& kicks, uint8 kickIndex)
+{
+  return (kickIndex >= k_numSrsKicksPerTable) ||
+    ((IsSrsKickNone(GetSrsKick(kicks, kickIndex))
+      ? (ReadPackedSrsKick(packedKicks, kickIndex) == k_packedSrsKickNone)
+      : ((GetSrsKick(kicks, kickIndex).x >= -2) && (GetSrsKick(kicks, kickIndex).x <= 2) &&
+         (GetSrsKick(kicks, kickIndex).y >= -2) && (GetSrsKick(kicks, kickIndex).y <= 2) &&
+         (UnpackSrsKickX(ReadPackedSrsKick(packedKicks, kickIndex)) == GetSrsKick(kicks, kickIndex).x) &&
+         (UnpackSrsKickY(ReadPackedSrsKick(packedKicks, kickIndex)) == GetSrsKick(kicks, kickIndex).y)))
+     && DoPackedSrsKicksMatch(packedKicks, kicks, kickIndex + 1));
+}
+
+// Packs a whole table of kicks into PackedSrsKicks
+#define MakePackedSrsKicks(kicks) \
+  { \
+    GetPackedSrsKickByte(kicks, 0), GetPackedSrsKickByte(kicks, 1), GetPackedSrsKickByte(kicks, 2), GetPackedSrsKickByte(kicks, 3), \
+    GetPackedSrsKickByte(kicks, 4), GetPackedSrsKickByte(kicks, 5), GetPackedSrsKickByte(kicks, 6), GetPackedSrsKickByte(kicks, 7), \
+    GetPackedSrsKickByte(kicks, 8), GetPackedSrsKickByte(kicks, 9), GetPackedSrsKickByte(kicks, 10), GetPackedSrsKickByte(kicks, 11), \
+    GetPackedSrsKickByte(kicks, 12), GetPackedSrsKickByte(kicks, 13), GetPackedSrsKickByte(kicks, 14), GetPackedSrsKickByte(kicks, 15), \
+    GetPackedSrsKickByte(kicks, 16), GetPackedSrsKickByte(kicks, 17), GetPackedSrsKickByte(kicks, 18), GetPackedSrsKickByte(kicks, 19), \
+    GetPackedSrsKickByte(kicks, 20), \
+  }
+static_assert(k_packedSrsKicksSize == 21, "MakePackedSrsKicks needs to be updated to match the size of the packed tables");
+
+// Precomputed shape of a piece in one orientation
+// Generated at compile time from a piece's default block positions and rotation formula (see MakePieceShape)
+struct PieceShape
+{
+  // Occupancy of the piece's rows, starting at the piece's origin. Bit 0 is the left-most column.
+  uint8 m_rowMasks[k_pieceMaskSize];
+  // (x, y) offset of each block, in block index order. Bottom 4-bits are x. Top 4-bits are y.
+  uint8 m_blockOffsets[4];
 };
 
+// Returns the index of the n-th (0-based) set bit in 'bits'. Bad data fails to compile rather than hanging.
+constexpr uint8 GetNthSetBit(uint8 bits, uint8 n, uint8 bitIndex = 0)
+{
+  return ((bits >> bitIndex) & 0x01)
+    ? ((n == 0) ? bitIndex : GetNthSetBit(bits, n - 1, bitIndex + 1))
+    : GetNthSetBit(bits, n, bitIndex + 1);
+}
+
+// Compile-time versions of the rotation formulas in "Implementation Details.md"
+// Formula A is used for Rotation2x4 pieces. Formula B (Rotation2x3) is the same with a -1 fixup.
+constexpr uint8 GetShapeOffsetX(uint8 bitIndex, RotationFormula formula, PieceOrientation orientation)
+{
+  return (orientation == PieceOrientation::North) ? (bitIndex % 4) :
+         (orientation == PieceOrientation::East) ? ((bitIndex / 4) + 1) :
+         (orientation == PieceOrientation::South) ? ((3 - (bitIndex % 4)) - ((formula == RotationFormula::Rotation2x4) ? 0 : 1)) :
+         ((2 - (bitIndex / 4)) - ((formula == RotationFormula::Rotation2x4) ? 0 : 1));
+}
+
+constexpr uint8 GetShapeOffsetY(uint8 bitIndex, RotationFormula formula, PieceOrientation orientation)
+{
+  return (orientation == PieceOrientation::North) ? ((bitIndex / 4) + 1) :
+         (orientation == PieceOrientation::East) ? ((3 - (bitIndex % 4)) - ((formula == RotationFormula::Rotation2x4) ? 0 : 1)) :
+         (orientation == PieceOrientation::South) ? ((2 - (bitIndex / 4)) - ((formula == RotationFormula::Rotation2x4) ? 0 : 1)) :
+         (bitIndex % 4);
+}
+
+constexpr uint8 GetShapeBlockOffset(uint8 bits, RotationFormula formula, PieceOrientation orientation, uint8 blockIndex)
+{
+  return GetShapeOffsetX(GetNthSetBit(bits, blockIndex), formula, orientation)
+    | (GetShapeOffsetY(GetNthSetBit(bits, blockIndex), formula, orientation) << 4);
+}
+
+// Returns the bit this block contributes to 'row' of the shape, or 0 if the block is in a different row
+constexpr uint8 GetShapeRowBit(uint8 bits, RotationFormula formula, PieceOrientation orientation, uint8 blockIndex, uint8 row)
+{
+  return (GetShapeOffsetY(GetNthSetBit(bits, blockIndex), formula, orientation) == row)
+    ? (1 << GetShapeOffsetX(GetNthSetBit(bits, blockIndex), formula, orientation))
+    : 0;
+}
+
+constexpr uint8 GetShapeRowMask(uint8 bits, RotationFormula formula, PieceOrientation orientation, uint8 row)
+{
+  return GetShapeRowBit(bits, formula, orientation, 0, row)
+    | GetShapeRowBit(bits, formula, orientation, 1, row)
+    | GetShapeRowBit(bits, formula, orientation, 2, row)
+    | GetShapeRowBit(bits, formula, orientation, 3, row);
+}
+
+constexpr PieceShape MakePieceShape(uint8 bits, RotationFormula formula, PieceOrientation orientation)
+{
+  return PieceShape{
+    {
+      GetShapeRowMask(bits, formula, orientation, 0),
+      GetShapeRowMask(bits, formula, orientation, 1),
+      GetShapeRowMask(bits, formula, orientation, 2),
+      GetShapeRowMask(bits, formula, orientation, 3),
+    },
+    {
+      GetShapeBlockOffset(bits, formula, orientation, 0),
+      GetShapeBlockOffset(bits, formula, orientation, 1),
+      GetShapeBlockOffset(bits, formula, orientation, 2),
+      GetShapeBlockOffset(bits, formula, orientation, 3),
+    }
+  };
+}
+
+// All four orientations of a piece, in PieceOrientation order
+#define MakePieceShapes(bits, formula) \
+  { \
+    MakePieceShape(bits, formula, PieceOrientation::North), \
+    MakePieceShape(bits, formula, PieceOrientation::East), \
+    MakePieceShape(bits, formula, PieceOrientation::South), \
+    MakePieceShape(bits, formula, PieceOrientation::West), \
+  }
+
 // Data to describe how a certain piece should work, including its shape,
 // rotation behavior, and visuals
 class PieceData
 {
 public:
-  PieceData(int defaultBlockPositions, RotationFormula rotationFormula, const RotationOffsets* rotationOffsets) :
+  // PieceData is stored in program memory, so members are only ever read with pgm_read_*
+  // TODO: Assert that exactly four bits are set in defaultBlockPositions
+  constexpr PieceData(uint8 defaultBlockPositions, RotationFormula rotationFormula, const uint8* packedKicks, const PieceShape* shapes) :
+    m_packedKicks(packedKicks),
     m_defaultBlockPositions(defaultBlockPositions),
     m_rotationFormula(rotationFormula),
-    m_rotationOffsets(rotationOffsets)
+    m_shapes(shapes)
   {
-    // TODO: Assert that exactly four bits are set
   }
 
   // The number of blocks per piece is hard-coded, but the API shouldn't care
@@ -272,18 +716,50 @@ public:
   // Returns 'true' if all blocks of this piece at this location and orientation are empty in the grid
   // Returns 'false' if something in the grid would block the piece from being here
   bool DoesPieceFitInGrid(PieceOrientation orientation, uint8 pieceX, uint8 pieceY) const;
+  // Same as above, for any size of grid instead of the one the game is played on
+  template <uint8 t_width, uint8 t_height>
+  bool DoesPieceFitInGrid(const GridT<t_width, t_height>& grid, PieceOrientation orientation, uint8 pieceX, uint8 pieceY) const
+  {
+    uint8 pieceRows[k_pieceMaskSize];
+    GetRowMasks(orientation, pieceRows);
+    return grid.DoesPieceMaskFit(pieceX, pieceY, pieceRows);
+  }
 
   // blockIndex : Value in range [0 .. GetNumBlocksInPiece), identifying the block
   // outOffsetX :
   // outOffsetY : Output parameters of (x, y) offset of block with given index
   // Positive-X is right and positive-Y is up in the grid
+  void GetBlockOffset(uint8 blockIndex, PieceOrientation orientation, uint8& outOffsetX, uint8& outOffsetY) const
+  {
+    const uint8 packedOffset = pgm_read_byte(&GetShapes()[uint8(orientation)].m_blockOffsets[blockIndex]);
+    outOffsetX = packedOffset & 0x0F;
+    outOffsetY = packedOffset >> 4;
+  }
+
+  // Copies the precomputed row masks of the piece in the given orientation
+  void GetRowMasks(PieceOrientation orientation, uint8 (&outPieceRows)[k_pieceMaskSize]) const
+  {
+    memcpy_P(outPieceRows, GetShapes()[uint8(orientation)].m_rowMasks, sizeof(outPieceRows));
+  }
+
+#ifdef TEST_BUILD
+  // Reference implementation of the rotation formulas that GetBlockOffset's precomputed table is built from
   // (0, 0) is the bottom-left bit
   // 4567
   // 0123
   void GetBlockOffsetForIndexAndRotation(int8 blockIndex, PieceOrientation orientation, uint8& outOffsetX, uint8& outOffsetY) const;
+#endif // #ifdef TEST_BUILD
 
-  // Returns the RotationOffsets data associated with this PieceData. It will be null if there aren't alternate rotations for the piece.
-  const RotationOffsets* GetRotationOffsets() const { return m_rotationOffsets; }
+  // Precomputed shapes for each orientation, in program memory
+  const PieceShape* GetShapes() const { return reinterpret_cast<const PieceShape*>(pgm_read_ptr(&m_shapes)); }
+  // Returns the packed SRS kicks for this piece, in program memory. It will be null if there aren't alternate rotations for the piece.
+  const uint8* GetPackedKicks() const { return reinterpret_cast<const uint8*>(pgm_read_ptr(&m_packedKicks)); }
+  // Reads one kick from GetPackedKicks(). Returns k_packedSrsKickNone if there isn't a kick to try.
+  static uint8 GetPackedKick(const uint8* packedKicks, RotationDirection direction, PieceOrientation startingOrientation, uint8 kick)
+  {
+    const uint8 bitIndex = GetSrsKickIndex(direction, startingOrientation, kick) * k_srsKickBits;
+    return (pgm_read_word(packedKicks + (bitIndex / 8)) >> (bitIndex % 8)) & k_packedSrsKickNone;
+  }
 
   void Draw(
     uint8 x,
@@ -292,20 +768,23 @@ public:
     VisualStyle visualStyle,
     PieceIndex pieceIndex,
     uint8 leftAnchorScreenPos,
-    uint8 bottomAnchorScreenPos
+    uint8 bottomAnchorScreenPos,
+    uint8 blockSize
   ) const;
 
 private:
   BlockIndex GetBlockForPieceFromVisualStyle(VisualStyle visualStyle, PieceIndex pieceIndex, PieceOrientation orientation, uint8 index) const;
 
 private:
-  // Data that describes alternative rotation offsets for the piece.
+  // Packed SRS kicks that describe alternative rotation offsets for the piece.
   // Used to support wall kick, floor kick, and other non-default rotations
-  const RotationOffsets* m_rotationOffsets;
+  const uint8* m_packedKicks;
   // Bit mask describing piece's blocks in its default orientation.
   uint8 m_defaultBlockPositions;
   // Note: There are only two options, so this could be reduced to just one bit
   RotationFormula m_rotationFormula;
+  // Precomputed shapes for each orientation, in program memory
+  const PieceShape* m_shapes;
 };
 
 class CurrentPiece
@@ -320,6 +799,7 @@ public:
     m_pieceIndex = PieceIndex::Invalid;
     m_holdPiece = PieceIndex::Invalid;
     m_holdActionAvailable = true;
+    m_drawnPieceIndex = PieceIndex::Invalid;
   }
 
   // Spawns a new piece at the top of the grid.
@@ -327,10 +807,31 @@ public:
   // Returns 'false' if there were any problems (ie. game over condition)
   bool SpawnNewPiece(PieceIndex knownNextPiece = PieceIndex::Invalid);
   bool IsValidPiece() { return m_pieceIndex != PieceIndex::Invalid; }
+  PieceIndex GetPieceIndex() const { return m_pieceIndex; }
+  uint8 GetX() const { return m_x; }
+  uint8 GetY() const { return m_y; }
+  PieceOrientation GetOrientation() const { return m_orientation; }
+  PieceIndex GetHoldPiece() const { return m_holdPiece; }
+  bool IsHoldAvailable() const { return m_holdActionAvailable; }
+  // Must be called once per frame before the grid is drawn.
+  // If the piece or its shadow moved, the cells they were drawn over are marked dirty in the grid so they get erased.
+  void PrepareDraw();
+  // Draw() and DrawShadow() only draw if something changed since the last PrepareDraw()
   void Draw() const;
   void DrawShadow() const;
+  // Returns 'true' if the piece or its shadow is on screen as of the last PrepareDraw()
+  bool IsDrawn() const { return m_drawnPieceIndex != PieceIndex::Invalid; }
+  // Draws the piece in the hold slot, if there is one
+  void DrawHold() const;
   void MoveDown(bool trySoftDrop);
+  // Ticks until the piece falls a row or locks down
+  GameTicks GetTicksUntilNextEvent(bool trySoftDrop);
+  // Counts down the fall or lock down timer the way MoveDown() would, when it's not time for either yet
+  void SkipFrame(bool trySoftDrop);
   void DoHardDrop();
+  // Returns the lowest 'y' the piece can drop to from where it is now
+  // Cached until the piece moves sideways, rotates, or respawns, or the grid changes
+  uint8 GetLandingY();
   bool TryMove(int8 deltaX, int8 deltaY);
   // rotationDirection: clockwise or counter-clockwise
   bool TryRotate(RotationDirection rotationDirection);
@@ -340,6 +841,9 @@ public:
   // Should be called whenever the current piece successfully moves or rotates
   // so the movement lock down counter is kept up to date
   void DecrementMoveLockDownCounter(uint8 moveAndRotationCount);
+  // Packs the piece and hold slot into a snapshot. Load() returns 'false' if the data isn't valid.
+  void Save(BitWriter& writer) const;
+  bool Load(BitReader& reader);
 
 protected:
   // Writes the current piece to the grid and invalidates the current piece
@@ -347,8 +851,17 @@ protected:
   // Sets the position of the piece (m_x, m_y)
   // All changes to position should go through here to ensure lowest position is tracked correctly
   void SetPiecePosition(uint8 newX, uint8 newY);
+  // Forces GetLandingY() to recompute the landing position next time it's called
+  void InvalidateLandingY() { m_landingYValid = false; }
 
 private:
+  // Sizes of the values in a snapshot. Pieces include PieceIndex::Invalid.
+  static constexpr uint8 k_pieceIndexBits = BitsFor(uint8(PieceIndex::Count) + 1);
+  static constexpr uint8 k_pieceXBits = BitsFor(k_gridWidth + k_pieceMaskSize);
+  static constexpr uint8 k_pieceYBits = BitsFor(k_gridHeight + k_pieceMaskSize);
+  static constexpr uint8 k_orientationBits = BitsFor(uint8(PieceOrientation::Count));
+  static constexpr uint8 k_lockDownMoveCounterBits = BitsFor(k_defaultLockDownMoveCount + 1);
+
   PieceIndex m_pieceIndex;
   PieceIndex m_holdPiece;
   uint8 m_x;
@@ -363,6 +876,19 @@ private:
   // Tracks the lowest 'y' coordinate the piece has been, to know when the lock down timer and counter should be reset
   uint8 m_lockDownLowestY;
   bool m_holdActionAvailable;
+
+  // Cached result of GetLandingY(), and the grid revision it was computed against
+  uint8 m_landingY;
+  uint16 m_landingYGridRevision;
+  bool m_landingYValid;
+
+  // State of the piece and shadow as they were last drawn, so they only need to be redrawn when they change
+  PieceIndex m_drawnPieceIndex;
+  uint8 m_drawnX;
+  uint8 m_drawnY;
+  uint8 m_drawnShadowY;
+  PieceOrientation m_drawnOrientation;
+  bool m_needsRedraw;
 };
 
 // Manages the next piece and whatever randomization method is used to pick them
@@ -375,15 +901,32 @@ public:
   void DebugPrint() const;
 #endif // #ifdef TEST_BUILD
 
-  void Reset();
+  // Pieces are chosen by a random number generator seeded with 'seed'
+  void Reset(uint32 seed);
   PieceIndex GetNextPiece();
+  // Returns an upcoming piece without removing it; 0 is the piece GetNextPiece will return
+  PieceIndex PeekPiece(uint8 offset) const;
   void Draw(bool setFalseToClear = true) const;
+  // Packs the bags and random state into a snapshot. Load() returns 'false' if the data isn't valid.
+  void Save(BitWriter& writer) const;
+  bool Load(BitReader& reader);
 
 private:
-  void ShuffleBag(uint8 startingIndex);
+  // Each bag is stored as the index of its permutation, which is 7! = 5040 values and fits in 13 bits
+  static constexpr uint8 k_bagSize = uint8(PieceIndex::Count);
+  static constexpr uint16 k_numBagPermutations = 5040;
+  // Enough bags to look ahead from the last piece of the oldest bag
+  static constexpr uint8 k_numBags = (k_bagSize - 1 + k_nextLookahead + k_bagSize - 1) / k_bagSize;
+
+  static uint16 ShuffleBag(Random& random);
+  static PieceIndex DecodeBag(uint16 permutation, uint8 index);
 private:
-  PieceIndex m_next[14];
+  // Ring buffer of bags, oldest at m_bagHead
+  uint16 m_bags[k_numBags];
+  uint8 m_bagHead;
+  // Index of the next piece in the oldest bag
   uint8 m_index;
+  Random m_random;
 };
 
 class Controller
@@ -392,10 +935,18 @@ public:
   void Reset() { m_isSoftDrop = 0; }
   void ProcessInput();
   bool IsSoftDrop() const { return m_isSoftDrop; }
+  // Ticks until a held button auto-repeats, or 0 if ProcessInput() has buttons to react to this frame
+  GameTicks GetTicksUntilNextEvent() const;
+  // Counts down the auto-repeat timers the way ProcessInput() would, on a frame with nothing else to do
+  void SkipFrame();
+  // Packs the auto-repeat timers into a snapshot
+  void Save(BitWriter& writer) const;
+  void Load(BitReader& reader);
 
 private:
   // Helper function for handling horizontal auto-repeat timing
   static uint8 ProcessMoveHorizontal(uint8 button, uint8& out_ticksUntilAutoRepeat);
+  static GameTicks GetTicksUntilAutoRepeat(uint8 button, GameTicks ticksUntilAutoRepeat);
 
 private:
   GameTicks m_ticksUntilAutoRepeatLeft;
@@ -468,41 +1019,80 @@ public:
     m_score += perLevelScoreScalar * m_level;
   }
 
-  // Draws #Lines and Score on screen
-  void DrawStats() const;
+  uint32 GetScore() const { return m_score; }
+  uint16 GetTotalLines() const { return m_totalLines; }
+  uint8 GetLevel() const { return m_level; }
+
+  // Draws #Lines and Score on screen, if they've changed since they were last drawn
+  void DrawStats();
+  // Makes the next DrawStats() draw everything, ie. after the screen was cleared
+  void MarkStatsDirty();
+  // Packs the score, lines, and level into a snapshot. Load() returns 'false' if the data isn't valid.
+  void Save(BitWriter& writer) const;
+  bool Load(BitReader& reader);
   
 private:
+  static constexpr uint8 k_levelBits = BitsFor(k_maxLevel + 1);
+
   uint32 m_score;
   uint16 m_totalLines;
   // Number of singles, doubles, triples, and quad lines completed
   uint16 m_stats[uint8(GameplayStats::Count)];
   // Minimum level is 1. A value of 0 here is invalid.
   uint8 m_level;
+
+  // What's been drawn, so things are only drawn again when they change
+  RetainedText m_drawnLabels[3];
+  RetainedNumber m_drawnScore;
+  RetainedNumber m_drawnLevel;
+  RetainedNumber m_drawnLines;
 };
 
 class Menus
 {
 public:
+  // One line per menu item
+  static constexpr uint8 k_numLines = 8;
+
   void Reset()
   {
     m_selectedIndex = 0;
     m_startingLevel = k_minStartingLevel;
+    MarkAllDirty();
   }
 
   void Loop();
   void ProcessInput();
+  // Makes the next Loop() draw every line, ie. after the screen was cleared
+  void MarkAllDirty() { memset(m_drawnLineStates, k_lineStateDirty, sizeof(m_drawnLineStates)); }
 
 private:
+  // Line states are the value of the line's setting, with this bit set if the line is selected
+  static constexpr uint8 k_lineStateSelected = 0x80;
+  static constexpr uint8 k_lineStateDirty = 0xFF;
+
+  uint8 GetLineState(uint8 line) const;
+  void DrawLine(uint8 line) const;
+
+  // What each line showed when it was last drawn, so only lines that change get drawn again
+  uint8 m_drawnLineStates[k_numLines];
   uint8 m_selectedIndex;
   uint8 m_startingLevel;
   VisualStyle m_visualStyle = VisualStyle::Donut;
   VisualStyle m_shadowStyle = VisualStyle::CenterDot;
+  PlayMode m_playMode = PlayMode::Human;
+  // Off by default, so the EEPROM is only written for games the player wants to keep
+  bool m_recordReplay = false;
 };
 
 class Input
 {
 public:
-  void Update();
+  // Reads the buttons that are down, or were pressed since the last time this was called, from the ButtonSampler.
+  // outPressTicks is how many GameTicks before now the newest left or right press happened, or 0 if there wasn't one.
+  static uint8 ReadButtons(ButtonSampler& sampler, GameTicks& outPressTicks);
+  // Advances a frame with the given button state (ie. from ReadButtons, or scripted input)
+  void Update(uint8 buttonDownFlags, GameTicks pressTicks);
   // Returns true if the current state of the button is down, ignoring any history
   bool IsButtonDown(uint8 button) const { return (button & m_currentButtonDownFlags); }
   // Returns true if the button is down now, but wasn't last frame
@@ -511,26 +1101,418 @@ public:
   bool WasButtonHeld(uint8 button) const { return (button & m_currentButtonDownFlags & m_previousButtonDownFlags); }
   // Returns true if the button is up this frame, but was down last frame
   bool WasButtonReleased(uint8 button) const { return (button & ~m_currentButtonDownFlags & m_previousButtonDownFlags); }
-
-private:
-  static bool SampleRawInput(uint8 buttons);
+  // Returns true if all the buttons are down now, but weren't all down last frame (ie. for button combos)
+  bool WereButtonsPressed(uint8 buttons) const { return ((buttons & m_currentButtonDownFlags) == buttons) && ((buttons & m_previousButtonDownFlags) != buttons); }
+  uint8 GetButtonDownFlags() const { return m_currentButtonDownFlags; }
+  // Returns how many GameTicks before the start of this frame the newest left or right press happened
+  GameTicks GetPressTicks() const { return m_pressTicks; }
 
 private:
   uint8 m_currentButtonDownFlags = 0;
   uint8 m_previousButtonDownFlags = 0;
+  GameTicks m_pressTicks = 0;
+};
+
+// Everything needed to start a game. Saved at the start of a replay so the game can be reproduced exactly.
+struct GameSettings
+{
+  uint32 randomSeed;
+  uint8 startingLevel;
+  VisualStyle pieceStyle;
+  VisualStyle shadowStyle;
+  // Buttons that were down on the frame the game started, so presses on the first frame are detected the same way
+  uint8 initialButtonDownFlags;
+};
+
+// Records the buttons pressed every frame of a game to EEPROM, and plays them back.
+// A replay is k_replayHeaderTag, the GameSettings, then a stream of runs ending with a run of 0 frames.
+// Each run is a button mask followed by the number of frames (1-255) it was held for. The press ticks of the run's
+// first frame are in the mask's k_replayPressTicksMask bits; a frame with press ticks always starts a new run.
+// The mask of the run that ends the stream is k_replayTruncatedMask if the game carried on after it, or 0 if not.
+// Writes are queued and trickled out one byte per frame so recording never waits on the EEPROM.
+// Only games the player chose to record are written, and the header tag is written last, so a replay is only
+// valid once its game is over. See "Implementation Details.md" for how much of a game fits.
+class Replay
+{
+public:
+  // Invalidates the saved replay, which gets overwritten by this one
+  void StartRecording(const GameSettings& settings);
+  // Must be called once per frame while recording
+  void RecordFrame(uint8 buttonDownFlags, GameTicks pressTicks);
+  // Ends the recording and saves it as the replay once everything is written.
+  // gameOver: 'false' if the game can carry on without being recorded (ie. it was paused), which truncates the replay
+  void StopRecording(bool gameOver);
+  bool IsRecording() const { return m_state == State::Recording; }
+  // Writes the next queued byte if the EEPROM is ready. Must be called once per frame.
+  void Flush();
+
+  // Returns 'false' if there isn't a saved replay, or if one is still being saved
+  bool StartPlayback(GameSettings& outSettings);
+  // Returns 'false' and stops playback when the end of the replay is reached
+  bool GetNextFrame(uint8& outButtonDownFlags, GameTicks& outPressTicks);
+  bool IsPlaying() const { return m_state == State::Playing; }
+  // Returns 'true' if the replay ended before its game did. Only valid after GetNextFrame() returns 'false'.
+  bool WasTruncated() const { return m_truncated; }
+
+private:
+  enum class State : uint8
+  {
+    Idle,
+    Recording,
+    Saving,   // Writing out what's left of the queue, and then the header tag
+    Playing,
+  };
+
+  bool CanQueue(uint8 numBytes) const;
+  void QueueByte(uint8 value);
+  // Queues the current run, or truncates the replay if there isn't room for it
+  void QueueRun();
+
+private:
+  // EEPROM address of the next byte to be written or read
+  uint16 m_address;
+  // Run currently being recorded or played back. Press ticks only apply to the first frame of the run.
+  uint8 m_runButtonDownFlags;
+  GameTicks m_runPressTicks;
+  uint8 m_runFrames;
+  // Bytes waiting to be written to EEPROM
+  uint8 m_queue[k_replayQueueSize];
+  uint8 m_queueStart;
+  uint8 m_queueCount;
+  // Set when a run didn't fit, after which nothing more is recorded
+  bool m_truncated;
+  State m_state;
+};
+
+// Plays the game by choosing where each piece should go, then pressing the buttons to put it there.
+// The search for a placement is spread across frames so it never takes more than k_botSearchMicrosPerFrame of a frame.
+class Bot
+{
+public:
+#ifdef TEST_BUILD
+  static void UnitTest();
+#endif // #ifdef TEST_BUILD
+
+  // Stops the bot and forgets about the last game it played
+  void Reset()
+  {
+    m_state = State::Idle;
+    m_piecesPlaced = 0;
+    m_elapsedMillis = 0;
+  }
+  void Start();
+  void Stop() { m_state = State::Idle; }
+  bool IsPlaying() const { return m_state != State::Idle; }
+  // Returns 'true' if the bot played the current or last game
+  bool HasPlayed() const { return m_elapsedMillis > 0; }
+  uint16 GetPiecesPlaced() const { return m_piecesPlaced; }
+  // Must be called once per frame while playing. Returns the buttons the bot is pressing this frame.
+  uint8 Update();
+  // Pieces placed per second by the last game the bot played, times 100
+  uint16 GetPiecesPerSecondX100() const;
+
+private:
+  enum class State : uint8
+  {
+    Idle,
+    WaitingForPiece,
+    Searching,
+    Moving,
+  };
+
+  // Placements are numbered by whether they use the hold piece, then orientation, then column
+  // Columns start k_wallWidth left of the grid, since pieces can have empty columns on their left
+  static constexpr uint8 k_numPlacementColumns = k_gridWidth + Grid::k_wallWidth;
+  static constexpr uint8 k_numPlacements = 2 * uint8(PieceOrientation::Count) * k_numPlacementColumns;
+  // Highest row every orientation of every piece fits in; the spawn row is too high for upright pieces
+  static constexpr uint8 k_searchStartY = k_gridHeight - k_pieceMaskSize;
+
+  // Scores one placement, and keeps it if it's the best so far
+  void SearchPlacement(uint8 placement);
+  // Higher is better. Based on the lines the placement clears and the shape of the stack it leaves.
+  static int16 ScoreBoard(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize]);
+  // Returns the buttons that move the current piece towards the best placement
+  uint8 GetMoveButtons();
+
+private:
+  // Next placement to be scored
+  uint8 m_placement;
+  // Best placement found so far
+  uint8 m_bestPlacement;
+  int16 m_bestScore;
+  uint8 m_moveFrames;
+  // Buttons pressed last frame, so presses can be released before being pressed again
+  uint8 m_lastButtons;
+  uint16 m_piecesPlaced;
+  uint32 m_startMillis;
+  uint32 m_elapsedMillis;
+  State m_state;
+};
+
+// Everything needed to carry on with a game part way through, packed into as few bits as possible.
+// It's saved to EEPROM while the game is paused, so the game can be turned off and resumed later.
+// The same format can be saved to RAM, ie. to go back to an earlier state of a game while debugging.
+class Snapshot
+{
+public:
+  static void Save(BitWriter& writer);
+  // Replaces the current game with the one that was saved, and starts playing it.
+  // Returns 'false' if the data isn't valid, which leaves the game in an unknown state.
+  static bool Load(BitReader& reader);
+
+  // Returns the number of bytes saved, or 0 if the snapshot didn't fit
+  static uint16 SaveToEeprom();
+  // Returns 'false' if there isn't a valid snapshot in EEPROM, in which case the game is reset
+  static bool LoadFromEeprom();
+  // Forgets the snapshot in EEPROM so it doesn't get resumed again
+  static void EraseFromEeprom();
+
+private:
+  static constexpr uint8 k_visualStyleBits = BitsFor(uint8(VisualStyle::Count));
+  static constexpr uint8 k_playingStateBits = BitsFor(uint8(PlayingState::NextPieceDelay) + 1);
+};
+
+// Plays against another Arduboy connected over USB serial. Each side sends the other the garbage it earns by
+// clearing lines, and enough of its grid to draw a small preview of it next to the other player's game.
+// A message is k_versusSyncByte, the length of the payload, the payload, and a checksum. The payload is bit-packed
+// flags, a sequence number, the total garbage sent so far, and then the visible rows that changed since the last
+// message, each as its 'y' and its row mask. Most messages only have a row or two in them.
+// A receiver that misses a message can't trust its copy of the grid any more, so it asks for the whole grid.
+// Garbage is sent as a running total, so a missed message only delays garbage instead of losing it.
+// Nothing here waits on the serial port. Messages are queued, and bytes are moved whenever the port has room.
+class Versus
+{
+public:
+  static constexpr uint8 k_flagToppedOut = 0x01;
+  static constexpr uint8 k_flagFullGrid = 0x02;     // Every row is sent, and rows that aren't are empty
+  static constexpr uint8 k_flagNeedFullGrid = 0x04; // The sender missed a message and wants a full grid back
+  static constexpr uint8 k_flagBits = 3;
+  static constexpr uint8 k_rowBits = BitsFor(k_visibleGridHeight);
+  static constexpr uint8 k_numRowsBits = BitsFor(k_visibleGridHeight + 1);
+  static constexpr uint8 k_maxPayloadBytes = (k_flagBits + 8 + 8 + k_numRowsBits + (k_visibleGridHeight * (k_rowBits + k_gridWidth)) + 7) / 8;
+  // Sync byte, length, and checksum
+  static constexpr uint8 k_framingBytes = 3;
+  // Size of the biggest message, which is one with every visible row in it
+  static constexpr uint8 k_maxMessageBytes = k_framingBytes + k_maxPayloadBytes;
+  static_assert(k_maxMessageBytes <= k_versusSendQueueSize, "The send queue needs to fit the biggest message");
+  static_assert(k_maxPayloadBytes < k_versusSyncByte, "A length can't be mistaken for a sync byte");
+
+  void Start(uint32 randomSeed);
+  void Stop() { m_state = State::Idle; }
+  bool IsPlaying() const { return m_state != State::Idle; }
+  // Returns 'true' once the other player has topped out
+  bool HasWon() const { return m_state == State::Won; }
+
+  // Cleared lines first cancel out garbage waiting to be added to the grid, and the rest is sent to the other player
+  void AddLinesCleared(uint8 numLines);
+  // Adds the garbage that's waiting to the bottom of the grid, then sends the grid. Must be called between pieces.
+  // Returns 'false' if the garbage pushed blocks off the top of the grid.
+  bool OnStackSettled();
+  // Lets the other player know they've won
+  void OnGameOver();
+  // Must be called once per frame, to retry a message that didn't fit in the send queue
+  void Update();
+
+  // Takes bytes from the serial port, in any amounts
+  void ReceiveByte(uint8 value);
+  bool HasBytesToSend() const { return m_sendCount > 0; }
+  uint8 PopByteToSend();
+
+  // Lines of garbage that will be added to the grid before the next piece
+  uint8 GetPendingGarbage() const { return m_pendingGarbage; }
+  // Running totals of garbage sent and received, which wrap around. Once every message has arrived, each player's
+  // sent total is the same as the other player's received total.
+  uint8 GetSentGarbageTotal() const { return m_sentGarbageTotal; }
+  uint8 GetReceivedGarbageTotal() const { return m_receivedGarbageTotal; }
+  Grid::RowMask GetOpponentRowMask(uint8 y) const { return m_opponentRows[y]; }
+  // Draws the other player's grid at the right of the screen, with each cell as 2x2 pixels
+  void DrawOpponentGrid();
+
+private:
+  enum class State : uint8
+  {
+    Idle,
+    Playing,
+    Won,
+    Lost,
+  };
+  enum class ReceiveState : uint8
+  {
+    Sync,
+    Length,
+    Payload,
+    Checksum,
+  };
+
+  static constexpr uint8 k_previewLeft = k_screenWidth - (2 * k_gridWidth);
+  static constexpr uint8 k_previewNumPages = (2 * k_visibleGridHeight) / 8;
+  static constexpr uint8 k_previewFirstPage = k_displayNumPages - k_previewNumPages;
+  static_assert((2 * k_visibleGridHeight) % 8 == 0, "Preview rows need to fill whole pages");
+
+  // Queues a message with whatever rows changed since the last one
+  void QueueMessage();
+  void QueueByte(uint8 value);
+  void ProcessMessage();
+
+private:
+  // Rows of the grid as of the last message that was queued
+  Grid::RowMask m_sentRows[k_visibleGridHeight];
+  Grid::RowMask m_opponentRows[k_visibleGridHeight];
+  uint8 m_sendQueue[k_versusSendQueueSize];
+  uint8 m_sendStart;
+  uint8 m_sendCount;
+  uint8 m_sendSequence;
+  uint8 m_sentGarbageTotal;
+  uint8 m_receiveBuffer[k_maxPayloadBytes];
+  uint8 m_receiveLength;
+  uint8 m_receiveCount;
+  uint8 m_receiveChecksum;
+  uint8 m_receivedSequence;
+  uint8 m_receivedGarbageTotal;
+  uint8 m_pendingGarbage;
+  // Picks the column of the hole in each batch of garbage
+  Random m_random;
+  bool m_hasReceived;
+  bool m_sendFullGrid;
+  bool m_needFullGrid;
+  // A message didn't fit in the send queue and has to be tried again
+  bool m_needsSend;
+  bool m_opponentGridChanged;
+  ReceiveState m_receiveState;
+  State m_state;
+};
+
+// Gameplay always advances by k_gameTicksPerFrame per call to Global::Loop, so it's only the right speed if
+// Global::Loop is called k_frameRate times a second. This works out how many calls are due since the last frame.
+// When drawing takes too long, the frames that were missed are run without drawing so gameplay catches up.
+// Every frame still steps the same number of ticks, so replays play back the same no matter how often they're drawn.
+class FramePacer
+{
+public:
+#ifdef TEST_BUILD
+  static void UnitTest();
+#endif // #ifdef TEST_BUILD
+
+  // How often the loop wakes up from arduboy.idle() to check the pacer. Timer 0 interrupts every 1.024ms.
+  // arduboy.nextFrame() can't be used instead. At 60fps it ticks every 16ms, so a frame that was due just after
+  // a tick had to wait for the next one. At 1ms, it never sleeps, since it only sleeps with a whole tick to spare.
+  static constexpr uint16 k_wakeMicros = 1024;
+
+  void Reset(uint32 nowMicros) { m_nextFrameMicros = nowMicros; }
+  // Call every time the loop wakes up. Returns the number of frames to run, which is 0 until the next one is due.
+  uint8 GetNumFramesDue(uint32 nowMicros);
+
+private:
+  static constexpr uint32 k_microsPerFrame = 1000000 / k_frameRate;
+  // Beyond this, time is dropped instead of running more frames, so a slow frame can't make the next one slower
+  static constexpr uint8 k_maxFramesPerDraw = 4;
+
+  uint32 m_nextFrameMicros;
 };
 
 // The global object that contains and manages all other objects
 // At the time of writing, not everything is contained within Global, but things are moving that way
+// Host builds make one per thread (see PER_THREAD), so each thread can play its own games.
 class Global
 {
 public:
+  // The game's objects. These were globals, and everything still uses them directly.
+  GameState m_gameState;
+  class Viewport m_viewport;
+  Grid m_grid;
+  class CurrentPiece m_currentPiece;
+  class Next m_next;
+  class Controller m_controller;
+  class GameMode m_gameMode;
+  class Menus m_menus;
+  class Versus m_versus;
+  // Messages drawn over the middle of the grid
+  class RetainedText m_gameOverText;
+  class RetainedText m_pausedText;
+  PlayingState m_playingState;
+  // Timer used by the current playing state. Its use depends on the state.
+  // Could be merged with "m_ticksToFall" if things were refactored
+  GameTicks m_playingStateTimer;
+  // These values can change based on the skin and/or user preference, so they need to be in dynamic memory
+  VisualStyle m_pieceStyle[uint8(PieceIndex::Count)] =
+  {
+    VisualStyle::X,        // O - Piece
+    VisualStyle::Donut,    // I - Piece
+    VisualStyle::X,        // T - Piece
+    VisualStyle::Plus,     // L - Piece
+    VisualStyle::O,        // J - Piece
+    VisualStyle::Plus,     // S - Piece
+    VisualStyle::O         // Z - Piece
+  };
+  VisualStyle m_shadowStyle = VisualStyle::CenterDot;
+
   static bool SampleRawInput(uint8 buttons);
 
-  void Loop();
+  // Runs one frame of the game. The buttons normally come from Input::ReadButtons(), but can be scripted.
+  // pressTicks times the newest left or right press from before the frame, as returned by Input::ReadButtons().
+  void Loop(uint8 buttonDownFlags, GameTicks pressTicks = 0);
   const Input& GetInput() const { return m_input; }
+
+  // Returns a new seed every time, made unpredictable by hardware noise and the timing of the player's input
+  uint32 GenerateRandomSeed();
+
+  // Starts a new game. If recordReplay is set, it's recorded, and saved as the replay when it's over.
+  void StartGame(const GameSettings& settings, bool recordReplay);
+  // Starts playing back the saved replay. Returns 'false' if there isn't one.
+  bool StartReplay();
+  bool IsPlayingReplay() const { return m_replay.IsPlaying(); }
+  // Returns 'true' if the game being shown was a replay that ended before the game did
+  bool WasReplayTruncated() const { return m_replayTruncated; }
+  // Lets the bot play the game that was just started. The bot's input is recorded like a player's.
+  void StartBot() { m_bot.Start(); }
+  const Bot& GetBot() const { return m_bot; }
+  // Starts a new game against another Arduboy connected over serial. It isn't recorded, since a replay can't
+  // reproduce the garbage the other player sends.
+  void StartVersusGame(const GameSettings& settings);
+
+  // Only the player can pause. The bot and replays can press the pause buttons as part of playing.
+  // Versus games can't be paused either, since the other player's game doesn't stop.
+  bool CanPause() const;
+  // Pauses the game being played and saves it to EEPROM, so it can be resumed even after being turned off
+  void Pause();
+  void Unpause();
+  // Resumes the game saved by Pause(), paused. Returns 'false' if there isn't one.
+  bool ResumeSavedGame();
+
+  // When drawing is disabled, frames are run without drawing the game (ie. to fast-forward a replay)
+  void SetDrawingEnabled(bool enabled) { m_drawingEnabled = enabled; }
+#ifdef SOAK_BUILD
+  // Nothing is ever drawn in soak builds, so the drawing code can be optimized away
+  constexpr bool IsDrawingEnabled() const { return false; }
+#else // #ifdef SOAK_BUILD
+  bool IsDrawingEnabled() const { return m_drawingEnabled; }
+#endif // #else // #ifdef SOAK_BUILD
+
+  // An idle frame is one where nothing can change but timers, so it only counts them down and doesn't draw.
+  // The rest of the frame is spent asleep. Off by default, since tests change the game between frames.
+  void SetIdleFramesEnabled(bool enabled) { m_idleFramesEnabled = enabled; }
+  bool WasLastFrameIdle() const { return m_lastFrameIdle; }
+  // Makes the next frame run in full, ie. after something outside of Loop() changed the game or the screen
+  void ForceFullFrame() { m_screenUpToDate = false; }
+
+private:
+  void BeginGame(const GameSettings& settings);
+  bool IsIdleFrame(bool inputChanged);
+  // Ticks until something changes without any input, like the piece falling a row
+  GameTicks GetTicksUntilNextEvent();
+
 private:
   Input m_input;
+  Replay m_replay;
+  Bot m_bot;
+  // Only used to generate seeds. Gameplay uses separately seeded generators, so it can be replayed.
+  Random m_entropy;
+  bool m_drawingEnabled = true;
+  bool m_idleFramesEnabled = false;
+  bool m_lastFrameIdle = false;
+  // Set when the last frame that ran in full drew everything, and left nothing that still needs drawing
+  bool m_screenUpToDate = false;
+  bool m_replayTruncated = false;
 };
 
 const char k_menuItem1[] PROGMEM = "Play";
@@ -538,6 +1520,21 @@ const char k_menuItem2[] PROGMEM = "Mode";
 const char k_menuItem3[] PROGMEM = "Level";
 const char k_menuItem4[] PROGMEM = "Skin";
 const char k_menuItem5[] PROGMEM = "Shadow";
+const char k_menuItem6[] PROGMEM = "Blocks";
+const char k_menuItem7[] PROGMEM = "Record";
+const char k_menuItem8[] PROGMEM = "Replay";
+
+const char k_playModeHuman[] PROGMEM = "Human";
+const char k_playModeBot[] PROGMEM = "Bot";
+const char k_playModeVersus[] PROGMEM = "Versus";
+
+PGM_P const k_playModeNames[] PROGMEM =
+{
+  k_playModeHuman,
+  k_playModeBot,
+  k_playModeVersus,
+};
+static_assert(countof(k_playModeNames) == uint8(PlayMode::Count), "Every PlayMode needs a name");
 
 PGM_P const k_menuItems[] PROGMEM =
 {
@@ -546,30 +1543,32 @@ PGM_P const k_menuItems[] PROGMEM =
   k_menuItem3,
   k_menuItem4,
   k_menuItem5,
+  k_menuItem6,
+  k_menuItem7,
+  k_menuItem8,
 };
+static_assert(countof(k_menuItems) == Menus::k_numLines, "Every menu item needs a line");
 
 
 //==========================================================================
 // Global variables
 //--------------------------------------------------------------------------
-class Arduboy2 arduboy;
-Global g;
-
-GameState g_gameState;
-class Grid g_grid;
-class CurrentPiece g_currentPiece;
-class Next g_next;
-class Controller g_controller;
-class GameMode g_gameMode;
-class Menus g_menus;
-// TODO: Move these into some container class
-PlayingState g_playingState;
-// Timer used by the current playing state. Its use depends on the state.
-// Could be merged with "m_ticksToFall" if things were refactored
-GameTicks g_playingStateTimer;
-
-// "I" Piece Rotations
-const RotationOffsets k_rotationOffsetsI = {{
+PER_THREAD class Arduboy2 arduboy;
+PER_THREAD Global g;
+
+#ifdef DEBUGGING_ENABLED
+bool IsDebugSerialAvailable()
+{
+  return !g.m_versus.IsPlaying();
+}
+#endif // #ifdef DEBUGGING_ENABLED
+
+// SRS kick tables, copied from "Super Rotation System.md". The first test of every rotation, (0, 0), isn't included.
+// These are only used at compile time to build the packed tables below.
+
+// "I" Piece Kicks
+constexpr SrsKickTable k_srsKicksI =
+{
   {
     // Clockwise Rotations
     {{-2, 0}, { 1, 0}, {-2, -1}, { 1,  2}},  // North -> East
@@ -584,81 +1583,98 @@ const RotationOffsets k_rotationOffsetsI = {{
     {{ 1, 0}, {-2, 0}, { 1, -2}, {-2,  1}},  // South -> East
     {{-2, 0}, { 1, 0}, {-2, -1}, { 1,  2}}   // West -> South
   }
-}};
+};
 
-// "T" Piece Rotations
-const RotationOffsets k_rotationOffsetsT = {{
+// "T" Piece Kicks
+constexpr SrsKickTable k_srsKicksT =
+{
   {
     // Clockwise Rotations
-    {{ -1, 0}, { -1,  1}, { 0,  0}, { -1, -2}}, // North -> East
-    {{ 1, 0}, { 1,  1}, { 0,  2}, { 1,  2}},  // East -> South
-    {{ 1, 0}, { 0,  0}, { 0,  2}, { 1,  2}},  // South -> West
-    {{ -1, 0}, { -1, -1}, { 0,  2}, { -1,  2}} // West -> North
+    {{-1, 0}, {-1,  1}, k_srsKickNone, {-1, -2}},  // North -> East
+    {{ 1, 0}, { 1,  1}, { 0,  2},      { 1,  2}},  // East -> South
+    {{ 1, 0}, k_srsKickNone, { 0,  2}, { 1,  2}},  // South -> West
+    {{-1, 0}, {-1, -1}, { 0,  2},      {-1,  2}}   // West -> North
   },
   {
     // Counter-Clockwise Rotations
-    {{ 1, 0}, { 1,  1}, { 0,  0}, { 1, -2}},  // North -> West
-    {{ 1, 0}, { 1, -1}, { 0,  2}, { 1,  2}},  // East -> North
-    {{ -1, 0}, { 0,  0}, { 0,  2}, { -1,  2}}, // South -> East
-    {{ -1, 0}, { -1, -1}, { 0,  2}, { -1,  2}} // West -> South
+    {{ 1, 0}, { 1,  1}, k_srsKickNone, { 1, -2}},  // North -> West
+    {{ 1, 0}, { 1, -1}, { 0,  2},      { 1,  2}},  // East -> North
+    {{-1, 0}, k_srsKickNone, { 0,  2}, {-1,  2}},  // South -> East
+    {{-1, 0}, {-1, -1}, { 0,  2},      {-1,  2}}   // West -> South
   }
-}};
+};
 
-// "L" and "J" Piece Rotations
-const RotationOffsets k_rotationOffsetsLJSAndZ = {{
+// "L", "J", "S", and "Z" Piece Kicks
+constexpr SrsKickTable k_srsKicksLJSAndZ =
+{
   {
     // Clockwise Rotations
-    {{ -1, 0}, { -1,  1}, { 0, -2}, { -1, -2}}, // North -> East
+    {{-1, 0}, {-1,  1}, { 0, -2}, {-1, -2}},  // North -> East
     {{ 1, 0}, { 1, -1}, { 0,  2}, { 1,  2}},  // East -> South
     {{ 1, 0}, { 1,  1}, { 0, -2}, { 1, -2}},  // South -> West
-    {{ -1, 0}, { -1, -1}, { 0,  2}, { -1,  2}} // West -> North
+    {{-1, 0}, {-1, -1}, { 0,  2}, {-1,  2}}   // West -> North
   },
   {
     // Counter-Clockwise Rotations
     {{ 1, 0}, { 1,  1}, { 0, -2}, { 1, -2}},  // North -> West
     {{ 1, 0}, { 1, -1}, { 0,  2}, { 1,  2}},  // East -> North
-    {{ -1, 0}, { -1,  1}, { 0, -2}, { -1, -2}}, // South -> East
-    {{ -1, 0}, { -1, -1}, { 0,  2}, { -1,  2}} // West -> South
+    {{-1, 0}, {-1,  1}, { 0, -2}, {-1, -2}},  // South -> East
+    {{-1, 0}, {-1, -1}, { 0,  2}, {-1,  2}}   // West -> South
   }
-}};
+};
+
+// 5-bit packed versions of the tables above; 21 bytes per table instead of 32 bytes of RAM
+constexpr PackedSrsKicks k_packedSrsKicksI PROGMEM = MakePackedSrsKicks(k_srsKicksI);
+constexpr PackedSrsKicks k_packedSrsKicksT PROGMEM = MakePackedSrsKicks(k_srsKicksT);
+constexpr PackedSrsKicks k_packedSrsKicksLJSAndZ PROGMEM = MakePackedSrsKicks(k_srsKicksLJSAndZ);
+static_assert(DoPackedSrsKicksMatch(k_packedSrsKicksI, k_srsKicksI, 0), "I kicks didn't pack correctly");
+static_assert(DoPackedSrsKicksMatch(k_packedSrsKicksT, k_srsKicksT, 0), "T kicks didn't pack correctly");
+static_assert(DoPackedSrsKicksMatch(k_packedSrsKicksLJSAndZ, k_srsKicksLJSAndZ, 0), "L, J, S, and Z kicks didn't pack correctly");
+// Spot-check the first and last kick of each table against the documentation
+static_assert(ReadPackedSrsKick(k_packedSrsKicksI, GetSrsKickIndex(RotationDirection::Clockwise, PieceOrientation::North, 0)) == PackSrsKick({-2, 0}), "I: North -> East kick 2 should be (-2, 0)");
+static_assert(ReadPackedSrsKick(k_packedSrsKicksI, GetSrsKickIndex(RotationDirection::CounterClockwise, PieceOrientation::West, 3)) == PackSrsKick({1, 2}), "I: West -> South kick 5 should be (1, 2)");
+static_assert(ReadPackedSrsKick(k_packedSrsKicksT, GetSrsKickIndex(RotationDirection::Clockwise, PieceOrientation::North, 2)) == k_packedSrsKickNone, "T: North -> East kick 4 should be n/a");
+static_assert(ReadPackedSrsKick(k_packedSrsKicksT, GetSrsKickIndex(RotationDirection::CounterClockwise, PieceOrientation::West, 3)) == PackSrsKick({-1, 2}), "T: West -> South kick 5 should be (-1, 2)");
+static_assert(ReadPackedSrsKick(k_packedSrsKicksLJSAndZ, GetSrsKickIndex(RotationDirection::Clockwise, PieceOrientation::North, 0)) == PackSrsKick({-1, 0}), "LJSZ: North -> East kick 2 should be (-1, 0)");
+static_assert(ReadPackedSrsKick(k_packedSrsKicksLJSAndZ, GetSrsKickIndex(RotationDirection::CounterClockwise, PieceOrientation::West, 3)) == PackSrsKick({-1, 2}), "LJSZ: West -> South kick 5 should be (-1, 2)");
+
+// Per-orientation piece shapes, generated at compile time from the same data as g_pieceData
+constexpr PieceShape k_pieceShapes[uint8(PieceIndex::Count)][uint8(PieceOrientation::Count)] PROGMEM =
+{
+  MakePieceShapes(0x66, RotationFormula::Rotation2x4),  // O
+  MakePieceShapes(0xF0, RotationFormula::Rotation2x4),  // I
+  MakePieceShapes(0x27, RotationFormula::Rotation2x3),  // T
+  MakePieceShapes(0x47, RotationFormula::Rotation2x3),  // L
+  MakePieceShapes(0x17, RotationFormula::Rotation2x3),  // J
+  MakePieceShapes(0x63, RotationFormula::Rotation2x3),  // S
+  MakePieceShapes(0x36, RotationFormula::Rotation2x3),  // Z
+};
+// Spot-check the generated data against the diagrams in "Implementation Details.md"
+static_assert(k_pieceShapes[uint8(PieceIndex::I)][uint8(PieceOrientation::North)].m_rowMasks[2] == 0x0F, "I-North should be a row of four");
+static_assert(k_pieceShapes[uint8(PieceIndex::T)][uint8(PieceOrientation::East)].m_rowMasks[1] == 0x06, "T-East should point right");
 
-class PieceData g_pieceData[] = {
+constexpr PieceData g_pieceData[] PROGMEM = {
   // O = 0110 0110 = 0x66
-  {0x66, RotationFormula::Rotation2x4, nullptr},
+  {0x66, RotationFormula::Rotation2x4, nullptr, k_pieceShapes[uint8(PieceIndex::O)]},
   // I = 1111 = 0xF0
-  {0xF0, RotationFormula::Rotation2x4, &k_rotationOffsetsI},
+  {0xF0, RotationFormula::Rotation2x4, k_packedSrsKicksI, k_pieceShapes[uint8(PieceIndex::I)]},
   // T = 0010 0111 = 0x27
-  {0x27, RotationFormula::Rotation2x3, &k_rotationOffsetsT},
+  {0x27, RotationFormula::Rotation2x3, k_packedSrsKicksT, k_pieceShapes[uint8(PieceIndex::T)]},
   // L = 0100 0111 = 0x47
-  {0x47, RotationFormula::Rotation2x3, &k_rotationOffsetsLJSAndZ},
+  {0x47, RotationFormula::Rotation2x3, k_packedSrsKicksLJSAndZ, k_pieceShapes[uint8(PieceIndex::L)]},
   // J = 0001 0111 = 0x17
-  {0x17, RotationFormula::Rotation2x3, &k_rotationOffsetsLJSAndZ},
+  {0x17, RotationFormula::Rotation2x3, k_packedSrsKicksLJSAndZ, k_pieceShapes[uint8(PieceIndex::J)]},
   // S = 0110 0011 = 0x63
-  {0x63, RotationFormula::Rotation2x3, &k_rotationOffsetsLJSAndZ},
+  {0x63, RotationFormula::Rotation2x3, k_packedSrsKicksLJSAndZ, k_pieceShapes[uint8(PieceIndex::S)]},
   // Z = 0011 0110 = 0x36
-  {0x36, RotationFormula::Rotation2x3, &k_rotationOffsetsLJSAndZ},
+  {0x36, RotationFormula::Rotation2x3, k_packedSrsKicksLJSAndZ, k_pieceShapes[uint8(PieceIndex::Z)]},
 };
 static_assert(countof(g_pieceData) == uint8(PieceIndex::Count));
 
-// These values can change based on the skin and/or user preference, so they need to be in dynamic memory
-VisualStyle g_pieceStyle[] =
-{
-  VisualStyle::X,        // O - Piece
-  VisualStyle::Donut,    // I - Piece
-  VisualStyle::X,        // T - Piece
-  VisualStyle::Plus,     // L - Piece
-  VisualStyle::O,        // J - Piece
-  VisualStyle::Plus,     // S - Piece
-  VisualStyle::O         // Z - Piece
-};
-static_assert(countof(g_pieceStyle) == uint8(PieceIndex::Count));
-
-VisualStyle g_shadowStyle = VisualStyle::CenterDot;
-
 VisualStyle GetVisualStyleFromPiece(const PieceIndex piece)
 {
   Assert(piece < PieceIndex::Count);
-  return g_pieceStyle[uint8(piece)];
+  return g.m_pieceStyle[uint8(piece)];
 }
 
 //--------------------------------------------------------------------------
@@ -670,6 +1686,8 @@ VisualStyle GetVisualStyleFromPiece(const PieceIndex piece)
 //--------------------------------------------------------------------------
 #ifdef GAME_BUILD
 
+FramePacer g_framePacer;
+
 void setup()
 {
 #ifdef DEBUGGING_ENABLED
@@ -677,28 +1695,92 @@ void setup()
   while (!Serial); // wait for serial port to connect. Needed for native USB
 #endif // #ifdef DEBUGGING_ENABLED
   arduboy.begin();
+  // Frames are timed by g_framePacer instead of arduboy.nextFrame(), but the library still gets the real frame rate
   arduboy.setFrameRate(k_frameRate);
+  g_buttonSampler.Begin();
+  g.SetIdleFramesEnabled(true);
   ResetGame();
+  // A game that was paused when the Arduboy was turned off carries on where it was
+  g.ResumeSavedGame();
+  g_framePacer.Reset(micros());
 }
 
 void loop()
 {
-  // pause render until it's time for the next frame
-  if (!(arduboy.nextFrame()))
+  uint8 numFrames = g_framePacer.GetNumFramesDue(micros());
+  if (numFrames == 0)
   {
+    // Sleeps until the next interrupt, which is at most FramePacer::k_wakeMicros away
+#ifdef PROFILING_ENABLED
+    const uint32 sleepStartMicros = micros();
+    arduboy.idle();
+    g_profiler.AddSleepTime(micros() - sleepStartMicros);
+#else // #ifdef PROFILING_ENABLED
+    arduboy.idle();
+#endif // #else // #ifdef PROFILING_ENABLED
     return;
   }
 
-  g.Loop();
+#ifdef PROFILING_ENABLED
+  // Checks last frame's input so the screen can be restored before the game draws this frame
+  if (g.GetInput().WereButtonsPressed(k_profilerOverlayButtons))
+  {
+    // The last page was drawn over things that only get redrawn when they change
+    g_profiler.NextOverlayPage();
+    RedrawScreen();
+  }
+#endif // #ifdef PROFILING_ENABLED
 
-/* //Uncomment to display cpu load % on screen
-  arduboy.setCursor(0, 0);
-  int load = arduboy.cpuLoad();
-  if (load < 10) { load = 10; }
-  if (load > 99) { load = 99; }
-  arduboy.print(load);
-*/
-  arduboy.display();
+  GameTicks pressTicks;
+  const uint8 buttonDownFlags = Input::ReadButtons(g_buttonSampler, pressTicks);
+  if (g.IsPlayingReplay() && (buttonDownFlags & k_replayTurboButton))
+  {
+    // Fast-forward by running extra frames
+    numFrames += k_replayTurboFrames - 1;
+  }
+  // Only the last frame is drawn. The grid and pieces track what changed, so skipped frames get caught up then.
+  if (numFrames > 1)
+  {
+    g.SetDrawingEnabled(false);
+    // The press happened before the first of the frames, and the ones after it see the button as held
+    g.Loop(buttonDownFlags, pressTicks);
+    pressTicks = 0;
+    for (uint8 i = 2; i < numFrames; i++)
+    {
+      g.Loop(buttonDownFlags);
+    }
+    g.SetDrawingEnabled(true);
+  }
+  g.Loop(buttonDownFlags, pressTicks);
+
+  if (g.m_versus.IsPlaying())
+  {
+    // Only reads what has already arrived, and only writes what fits in the port's buffer, so it never waits
+    while (Serial.available() > 0)
+    {
+      g.m_versus.ReceiveByte(Serial.read());
+    }
+    for (int space = Serial.availableForWrite(); (space > 0) && g.m_versus.HasBytesToSend(); space--)
+    {
+      Serial.write(g.m_versus.PopByteToSend());
+    }
+  }
+
+#ifdef PROFILING_ENABLED
+  // Counted before the overlay is drawn, so it's only what the game itself sends
+  g_profiler.SetDisplayBytes(g_display.GetNumBytesToSend());
+  g_profiler.SetFrameIdle(g.WasLastFrameIdle());
+  g_profiler.DrawOverlay(arduboy);
+#endif // #ifdef PROFILING_ENABLED
+
+  {
+    ProfileSection(Display);
+    // Only sends what changed this frame
+    g_display.Flush();
+  }
+#ifdef PROFILING_ENABLED
+  g_profiler.EndFrame();
+#endif // #ifdef PROFILING_ENABLED
 }
 
 #endif // #ifdef GAME_BUILD
@@ -747,6 +1829,20 @@ void loop()
     case 2: RunTest(TestFailure); break;
     case 3: RunTest(TestSprite); break;
     case 4: RunTest(TestVisualStyles); break;
+    case 5: RunTest(TestPieceShapes); break;
+    case 6: RunTest(TestBlockStrip); break;
+    case 7: RunTest(TestSkyline); break;
+    case 8: RunTest(TestRandom); break;
+    case 9: RunTest(Bot::UnitTest); break;
+    case 10: RunTest(TestLineClear); break;
+    case 11: RunTest(TestViewportScroll); break;
+    case 12: RunTest(TestSnapshot); break;
+    case 13: RunTest(TestRetainedText); break;
+    case 14: RunTest(TestButtonSampler); break;
+    case 15: RunTest(TestVersusLoopback); break;
+    case 16: RunTest(TestIdleFrames); break;
+    case 17: RunTest(TestLargeGrid); break;
+    case 18: RunTest(FramePacer::UnitTest); break;
     default:
       {
         static uint8 s_x = k_screenWidth / 2;
@@ -786,113 +1882,2802 @@ void TestVisualStyles()
 
   for (int i = 0; i < countof(styles); i++)
   {
-    VisualStyleHelper styleHelper(styles[i]);
-  
     for (uint8 piece = 0; piece < uint8(PieceIndex::Count); piece++)
     {
+      VisualStyleHelper styleHelper(styles[i], PieceIndex(piece));
       for (uint8 orientation = 0; orientation < uint8(PieceOrientation::Count); orientation++)
       {
         for (int8 index = 0; index < PieceData::GetNumBlocksInPiece(); index++)
         {
-          BlockIndex blockIndex = styleHelper.GetBlockForPiece(PieceIndex(piece), PieceOrientation(orientation), index);
+          BlockIndex blockIndex = styleHelper.GetBlock(PieceOrientation(orientation), index);
           TestVerify(blockIndex == targetBlocks[i]);
         }
       }
     }
   }
-}
 
-void TestFailure()
+  // Resolved styles need to give the same blocks as decoding the style data
+  for (uint8 style = 0; style < uint8(VisualStyle::Count); style++)
+  {
+    const VisualStyle visualStyle = VisualStyle(style);
+    for (uint8 piece = 0; piece < uint8(PieceIndex::Count); piece++)
+    {
+      g_resolvedVisualStyles[0].Resolve(visualStyle, PieceIndex(piece));
+      VisualStyleHelper styleHelper(visualStyle, PieceIndex(piece));
+      for (uint8 orientation = 0; orientation < uint8(PieceOrientation::Count); orientation++)
+      {
+        for (int8 index = 0; index < PieceData::GetNumBlocksInPiece(); index++)
+        {
+          const BlockIndex expected = VisualStyleHelper::GetUnresolvedBlockForPiece(visualStyle, PieceIndex(piece), PieceOrientation(orientation), index);
+          TestVerify(styleHelper.GetBlock(PieceOrientation(orientation), index) == expected);
+        }
+      }
+    }
+  }
+}
+
+// Verifies the precomputed k_pieceShapes table matches the rotation formulas for all 28 piece/orientation pairs
+void TestPieceShapes()
 {
-  TestVerify(1 + 1 == 2);
-  TestVerify(uint8(uint8(255) + uint8(1)) == 0);
-  TestVerify(1 + 7 == 93);  // Fail
-  TestVerify(2 * 2 == 4);
+  for (uint8 piece = 0; piece < uint8(PieceIndex::Count); piece++)
+  {
+    const PieceData& pieceData = g_pieceData[piece];
+    for (uint8 orientation = 0; orientation < uint8(PieceOrientation::Count); orientation++)
+    {
+      uint8 expectedRows[k_pieceMaskSize] = {0};
+      for (uint8 index = 0; index < PieceData::GetNumBlocksInPiece(); index++)
+      {
+        uint8 expectedX;
+        uint8 expectedY;
+        pieceData.GetBlockOffsetForIndexAndRotation(index, PieceOrientation(orientation), expectedX, expectedY);
+        uint8 tableX;
+        uint8 tableY;
+        pieceData.GetBlockOffset(index, PieceOrientation(orientation), tableX, tableY);
+        TestVerify((tableX == expectedX) && (tableY == expectedY));
+        expectedRows[expectedY] |= (uint8(1) << expectedX);
+      }
+
+      const PieceShape* shape = &pieceData.GetShapes()[orientation];
+      for (uint8 row = 0; row < k_pieceMaskSize; row++)
+      {
+        TestVerify(pgm_read_byte(&shape->m_rowMasks[row]) == expectedRows[row]);
+      }
+    }
+  }
 }
 
-void __RunTestHelper(const __FlashStringHelper* testName, void(*testFunction)())
+// Verifies DrawBlockStrip matches the original sprite-based block drawing pixel for pixel,
+// for every block at every vertical offset within a page
+void TestBlockStrip()
 {
-  g_testPassCount = 0;
-  g_testFailCount = 0;
-  (*testFunction)();
-  if (g_testFailCount == 0)
+  constexpr uint8 k_testLeft = k_screenWidth - (2 * k_blockWidth);
+  constexpr uint8 k_tops[] = {40, 41, 42, 43, 44, 45, 46, 47, 61};
+  uint8 saved[2][k_blockWidth];
+  uint8 expected[2][k_blockWidth];
+  for (uint8 t = 0; t < countof(k_tops); t++)
   {
-    arduboy.setTextColor(WHITE);
+    const uint8 top = k_tops[t];
+    const uint8 page = Min<uint8>(top / 8, (k_screenHeight / 8) - 2);
+    uint8* pixels[2] = {&arduboy.sBuffer[(page * k_screenWidth) + k_testLeft], &arduboy.sBuffer[((page + 1) * k_screenWidth) + k_testLeft]};
+    for (uint8 i = 0; i < 2; i++)
+    {
+      memcpy(saved[i], pixels[i], k_blockWidth);
+    }
+
+    for (uint8 block = 0; block < uint8(BlockIndex::Count); block++)
+    {
+      // Draw over a checkerboard so both set and cleared background pixels are tested
+      for (uint8 i = 0; i < 2; i++)
+      {
+        memset(pixels[i], 0xA5, k_blockWidth);
+      }
+      arduboy.fillRect(k_testLeft, top, k_blockWidth, k_blockHeight, BLACK);
+      Sprites::drawExternalMask(k_testLeft, top, BlockSprites, BlockSprites, block, uint8(BlockIndex::SolidWhite));
+      for (uint8 i = 0; i < 2; i++)
+      {
+        memcpy(expected[i], pixels[i], k_blockWidth);
+        memset(pixels[i], 0xA5, k_blockWidth);
+      }
+
+      const BlockIndex blockIndex = BlockIndex(block);
+      DrawBlockStrip(&blockIndex, 1, 0x01, k_testLeft, top, k_blockHeight);
+      TestVerify((memcmp(expected[0], pixels[0], k_blockWidth) == 0) && (memcmp(expected[1], pixels[1], k_blockWidth) == 0));
+    }
+
+    for (uint8 i = 0; i < 2; i++)
+    {
+      memcpy(pixels[i], saved[i], k_blockWidth);
+    }
+  }
+}
+
+// Compares the incrementally maintained skyline and metrics against scanning every cell
+void VerifySkyline(const Grid& grid)
+{
+  uint8 holes = 0;
+  uint8 bumpiness = 0;
+  uint8 previousHeight = 0;
+  for (uint8 x = 0; x < k_gridWidth; x++)
+  {
+    uint8 height = k_gridHeight;
+    while ((height > 0) && grid.IsEmpty(x, height - 1))
+    {
+      height--;
+    }
+    TestVerify(grid.GetColumnHeight(x) == height);
+    for (uint8 y = 0; y < height; y++)
+    {
+      holes += grid.IsEmpty(x, y);
+    }
+    if (x > 0)
+    {
+      bumpiness += (height > previousHeight) ? (height - previousHeight) : (previousHeight - height);
+    }
+    previousHeight = height;
+  }
+  TestVerify(grid.CountHoles() == holes);
+  TestVerify(grid.GetBumpiness() == bumpiness);
+}
+
+void TestSkyline()
+{
+  static Grid s_grid;
+  s_grid.Clear();
+  VerifySkyline(s_grid);
+  // Clearing lines adds to the score, which expects a valid level
+  g.m_gameMode.SetLevel(k_minStartingLevel);
+
+  Random testRandom;
+  testRandom.SetSeed(1);
+  for (uint16 i = 0; i < 400; i++)
+  {
+    // Mostly fill the bottom of the grid so lines get cleared too
+    const uint8 x = testRandom.NextInRange(k_gridWidth);
+    const uint8 y = testRandom.NextInRange(8);
+    s_grid.Set(x, y, (testRandom.NextInRange(4) == 0) ? BlockIndex::Empty : BlockIndex::X);
+    if ((i % 16) == 0)
+    {
+      s_grid.ProcessFullLines();
+    }
+    VerifySkyline(s_grid);
+
+    // Landing positions have to match walking the piece down one row at a time
+    uint8 pieceRows[k_pieceMaskSize];
+    g_pieceData[i % uint8(PieceIndex::Count)].GetRowMasks(PieceOrientation(i % uint8(PieceOrientation::Count)), pieceRows);
+    const uint8 pieceX = testRandom.NextInRange(k_gridWidth) - 1;
+    const uint8 pieceY = testRandom.NextInRange(k_gridHeight - k_pieceMaskSize);
+    if (s_grid.DoesPieceMaskFit(pieceX, pieceY, pieceRows))
+    {
+      uint8 landingY = pieceY;
+      while (s_grid.DoesPieceMaskFit(pieceX, landingY - 1, pieceRows))
+      {
+        landingY--;
+      }
+      TestVerify(s_grid.GetPieceMaskLandingY(pieceX, pieceY, pieceRows) == landingY);
+    }
+  }
+}
+
+void TestLargeGrid()
+{
+  // Too many cells to index with a byte, too wide for a 16-bit row, and too tall for a 32-bit line mask
+  constexpr uint8 k_width = 20;
+  constexpr uint8 k_height = 40;
+  using LargeGrid = GridT<k_width, k_height>;
+  static_assert(sizeof(LargeGrid::Index) == 2, "Cell indices should be 16-bit");
+  static_assert(sizeof(LargeGrid::RowMask) == 4, "Row masks should be 32-bit");
+  static LargeGrid s_grid;
+  s_grid.Clear();
+  // Clearing lines adds to the score, which expects a valid level
+  g.m_gameMode.SetLevel(k_minStartingLevel);
+
+  constexpr uint8 k_right = k_width - 1;
+  constexpr uint8 k_top = k_height - 1;
+  s_grid.Set(k_right, k_top, BlockIndex::X);
+  TestVerify(s_grid.Get(k_right, k_top) == BlockIndex::X);
+  TestVerify(s_grid.IsEmpty(k_right - 1, k_top));
+  TestVerify(s_grid.IsEmpty(k_right, k_top - 1));
+  TestVerify(s_grid.GetColumnHeight(k_right) == k_height);
+  TestVerify(s_grid.CountHoles() == k_top);
+  TestVerify(s_grid.GetBumpiness() == k_height);
+
+  // Lines past the 32nd row are cleared too
+  for (uint8 x = 0; x < k_width; x++)
+  {
+    s_grid.Set(x, 0, BlockIndex::X);
+    s_grid.Set(x, 35, BlockIndex::X);
+  }
+  s_grid.Set(0, 1, BlockIndex::Donut);
+  TestVerify(s_grid.GetRowMask(35) == LargeGrid::k_fullRowMask);
+  s_grid.ProcessFullLines();
+  TestVerify(s_grid.Get(0, 0) == BlockIndex::Donut);
+  TestVerify(s_grid.Get(k_right, k_top - 2) == BlockIndex::X);
+  TestVerify(s_grid.IsEmpty(k_right, k_top));
+  TestVerify(s_grid.GetMaxColumnHeight() == k_height - 2);
+
+  // The walls are where the grid ends, and blocks past the 16th column get in the way of pieces
+  const PieceData& iPiece = g_pieceData[uint8(PieceIndex::I)];
+  TestVerify(iPiece.DoesPieceFitInGrid(s_grid, PieceOrientation::North, k_width - 4, 10));
+  TestVerify(!iPiece.DoesPieceFitInGrid(s_grid, PieceOrientation::North, k_width - 3, 10));
+  uint8 pieceRows[k_pieceMaskSize];
+  iPiece.GetRowMasks(PieceOrientation::North, pieceRows);
+  uint8 pieceRow = 0;
+  while (pieceRows[pieceRow] == 0)
+  {
+    pieceRow++;
+  }
+  TestVerify(!s_grid.DoesPieceMaskFit(k_width - 4, k_top - 2 - pieceRow, pieceRows));
+  TestVerify(s_grid.DoesPieceMaskFit(k_width - 4, k_top - 3 - pieceRow, pieceRows));
+
+  // Rows wider than a single strip of blocks are still drawn all the way across
+  ResetGame();
+  s_grid.Set(k_right, 0, BlockIndex::X);
+  s_grid.Draw();
+  const uint8 left = g.m_viewport.GetLeft(k_width);
+  const uint8 cellLeft = left + (k_right * k_blockWidth);
+  uint8 numPixelsSet = 0;
+  for (uint8 y = 0; y < k_blockHeight; y++)
+  {
+    for (uint8 x = 0; x < k_blockWidth; x++)
+    {
+      numPixelsSet += arduboy.getPixel(cellLeft + x, g.m_viewport.GetBottom() + y);
+    }
+  }
+  TestVerify(numPixelsSet > 0);
+  TestVerify(arduboy.getPixel(left + g.m_viewport.GetWidth(k_width), 0) == WHITE);
+
+  ResetGame();
+}
+
+// Checksum of the part of the screen the grid is drawn in
+uint16 GetGridScreenChecksum()
+{
+  uint16 checksum = 0;
+  const uint8 left = g.m_viewport.GetLeft();
+  for (uint8 page = 0; page < k_screenHeight / 8; page++)
+  {
+    for (uint8 x = left; x < left + g.m_viewport.GetWidth(); x++)
+    {
+      checksum = ((checksum << 1) | (checksum >> 15)) ^ arduboy.sBuffer[(page * k_screenWidth) + x];
+    }
+  }
+  return checksum;
+}
+
+void TestLineClear()
+{
+  ResetGame();
+  g.m_gameMode.SetLevel(k_minStartingLevel);
+  // A ragged stack with full lines that aren't all next to each other.
+  // Blocks depend on the position so rows that end up in the wrong place change the picture.
+  constexpr uint8 k_numFullLines = 3;
+  for (uint8 y = 0; y < 8; y++)
+  {
+    for (uint8 x = 0; x < k_gridWidth; x++)
+    {
+      if ((y == 1) || (y == 2) || (y == 5) || (((x * 7) + (y * 3)) % 5 != 0))
+      {
+        g.m_grid.Set(x, y, ((x + y) & 0x01) ? BlockIndex::Donut : BlockIndex::X);
+      }
+    }
+  }
+  arduboy.fillRect(k_gridLeftPos, 0, k_playspaceWidth, k_screenHeight, BLACK);
+  g.m_grid.Draw();
+
+  g.m_gameState = GameState::Playing;
+  TestVerify(g.m_grid.BeginClearingFullLines() == k_numFullLines);
+  g.m_playingState = PlayingState::ClearingLines;
+  g.m_playingStateTimer = k_lineClearAnimationTicks;
+  uint8 numCollapseFrames = 0;
+  for (uint8 frame = 0; (frame < 100) && (g.m_playingState == PlayingState::ClearingLines); frame++)
+  {
+    numCollapseFrames += (g.m_playingStateTimer <= k_gameTicksPerFrame);
+    PlayingLoopClearingLines();
+    g.m_grid.Draw();
+  }
+  // One line is removed per frame
+  TestVerify(numCollapseFrames == k_numFullLines);
+  TestVerify(g.m_grid.GetMaxColumnHeight() <= 8 - k_numFullLines);
+  for (uint8 y = 0; y < k_gridHeight; y++)
+  {
+    TestVerify(g.m_grid.GetRowMask(y) != Grid::k_fullRowMask);
+  }
+  VerifySkyline(g.m_grid);
+
+  // Shifting the screen has to leave the same picture as redrawing the whole grid
+  const uint16 shiftedChecksum = GetGridScreenChecksum();
+  g.m_grid.MarkAllDirty();
+  g.m_grid.Draw();
+  TestVerify(GetGridScreenChecksum() == shiftedChecksum);
+
+  ResetGame();
+}
+
+void TestViewportScroll()
+{
+  ResetGame();
+  g.m_viewport.SetLargeBlocks(true);
+  // A stack too tall to fit on screen with large blocks
+  for (uint8 y = 0; y < k_visibleGridHeight - 2; y++)
+  {
+    for (uint8 x = 0; x < k_gridWidth; x++)
+    {
+      if (((x * 7) + (y * 3)) % 5 != 0)
+      {
+        g.m_grid.Set(x, y, ((x + y) & 0x01) ? BlockIndex::Donut : BlockIndex::X);
+      }
+    }
+  }
+  arduboy.fillRect(0, 0, k_screenWidth, k_screenHeight, BLACK);
+  g.m_grid.Draw();
+
+  // Scroll all the way up and back down again, checking every shift against redrawing the whole grid
+  uint8 maxCameraRow = 0;
+  for (uint8 frame = 0; frame < 2 * k_visibleGridHeight; frame++)
+  {
+    g.m_viewport.ScrollTowards((frame < k_visibleGridHeight) ? (k_visibleGridHeight - 1) : 0);
+    maxCameraRow = Max(maxCameraRow, g.m_viewport.GetCameraRow());
+    g.m_grid.PrepareDraw();
+    g.m_grid.Draw();
+    const uint16 shiftedChecksum = GetGridScreenChecksum();
+    g.m_grid.MarkAllDirty();
+    g.m_grid.Draw();
+    TestVerify(GetGridScreenChecksum() == shiftedChecksum);
+  }
+  TestVerify(maxCameraRow > 0);
+  TestVerify(g.m_viewport.GetCameraRow() == 0);
+
+  g.m_viewport.SetLargeBlocks(false);
+  ResetGame();
+}
+
+// Buttons for a made up game that moves, rotates, holds, and drops pieces
+uint8 GetTestScriptButtons(uint16 frame)
+{
+  constexpr uint8 k_buttons[] =
+  {
+    k_leftButton, 0, k_rotateCwButton, 0, k_softDropButton, k_softDropButton, k_softDropButton,
+    k_rightButton, k_rightButton | k_softDropButton, 0, k_rotateCcwButton, k_softDropButton, k_softDropButton,
+  };
+  // Holding too often would keep swapping pieces before they land
+  if ((frame % 400) >= 396)
+  {
+    return k_holdButton;
+  }
+  return k_buttons[(frame / 4) % countof(k_buttons)];
+}
+
+uint16 AddToChecksum(uint16 checksum, uint16 value)
+{
+  return ((checksum << 1) | (checksum >> 15)) ^ value;
+}
+
+// Checksum of the parts of the game a snapshot restores that can be seen from outside
+uint16 GetGameStateChecksum()
+{
+  uint16 checksum = 0;
+  for (uint8 y = 0; y < k_gridHeight; y++)
+  {
+    checksum = AddToChecksum(checksum, g.m_grid.GetRowMask(y));
+    for (uint8 x = 0; x < k_gridWidth; x++)
+    {
+      checksum = AddToChecksum(checksum, uint8(g.m_grid.Get(x, y)));
+    }
+  }
+  checksum = AddToChecksum(checksum, uint8(g.m_currentPiece.GetPieceIndex()));
+  // Left over from the last piece, or the last game, when there isn't a piece
+  if (g.m_currentPiece.IsValidPiece())
+  {
+    checksum = AddToChecksum(checksum, g.m_currentPiece.GetX());
+    checksum = AddToChecksum(checksum, g.m_currentPiece.GetY());
+    checksum = AddToChecksum(checksum, uint8(g.m_currentPiece.GetOrientation()));
+  }
+  checksum = AddToChecksum(checksum, uint8(g.m_currentPiece.GetHoldPiece()));
+  checksum = AddToChecksum(checksum, g.m_currentPiece.IsHoldAvailable());
+  for (uint8 i = 0; i < k_nextLookahead; i++)
+  {
+    checksum = AddToChecksum(checksum, uint8(g.m_next.PeekPiece(i)));
+  }
+  checksum = AddToChecksum(checksum, uint16(g.m_gameMode.GetScore()));
+  checksum = AddToChecksum(checksum, uint16(g.m_gameMode.GetScore() >> 16));
+  checksum = AddToChecksum(checksum, g.m_gameMode.GetTotalLines());
+  checksum = AddToChecksum(checksum, g.m_gameMode.GetLevel());
+  checksum = AddToChecksum(checksum, uint8(g.m_playingState));
+  checksum = AddToChecksum(checksum, g.m_playingStateTimer);
+  return checksum;
+}
+
+void TestSnapshot()
+{
+  GameSettings settings;
+  settings.randomSeed = 1234;
+  settings.startingLevel = 5;
+  // Uses lots of different blocks, so the grid needs a big palette
+  settings.pieceStyle = VisualStyle::TronSquare;
+  settings.shadowStyle = VisualStyle::CenterDot;
+  settings.initialButtonDownFlags = 0;
+  g.StartGame(settings, false);
+  constexpr uint16 k_numFramesBeforeSnapshot = 2400;
+  for (uint16 frame = 0; frame < k_numFramesBeforeSnapshot; frame++)
+  {
+    g.Loop(GetTestScriptButtons(frame));
+  }
+  TestVerify(g.m_gameState == GameState::Playing);
+  TestVerify(g.m_grid.GetMaxColumnHeight() > 4);
+  TestVerify(g.m_currentPiece.GetHoldPiece() != PieceIndex::Invalid);
+
+  static uint8 s_snapshot[k_snapshotEepromSize];
+  BitWriter writer(s_snapshot, sizeof(s_snapshot));
+  Snapshot::Save(writer);
+  writer.Finish();
+  TestVerify(!writer.HasOverflowed());
+  const uint16 snapshotSize = writer.GetNumBytes();
+  const uint16 savedChecksum = GetGameStateChecksum();
+
+  // The first frame doesn't have any buttons, so the buttons before it don't matter
+  constexpr uint16 k_numFramesAfterSnapshot = 300;
+  g.Loop(0);
+  for (uint16 frame = 0; frame < k_numFramesAfterSnapshot; frame++)
+  {
+    g.Loop(GetTestScriptButtons(frame));
+  }
+  const uint16 continuedChecksum = GetGameStateChecksum();
+  TestVerify(continuedChecksum != savedChecksum);
+
+  // Loading puts the game back the way it was, and saving it again gives the same data
+  BitReader reader(s_snapshot, snapshotSize);
+  TestVerify(Snapshot::Load(reader));
+  TestVerify(GetGameStateChecksum() == savedChecksum);
+  static uint8 s_resaved[k_snapshotEepromSize];
+  BitWriter rewriter(s_resaved, sizeof(s_resaved));
+  Snapshot::Save(rewriter);
+  rewriter.Finish();
+  TestVerify(rewriter.GetNumBytes() == snapshotSize);
+  TestVerify(memcmp(s_snapshot, s_resaved, snapshotSize) == 0);
+
+  // Timers and random state were restored too, so the game plays out the same way
+  g.Loop(0);
+  for (uint16 frame = 0; frame < k_numFramesAfterSnapshot; frame++)
+  {
+    g.Loop(GetTestScriptButtons(frame));
+  }
+  TestVerify(GetGameStateChecksum() == continuedChecksum);
+
+  // Through EEPROM, and it's gone once it's erased
+  BitReader eepromTestReader(s_snapshot, snapshotSize);
+  TestVerify(Snapshot::Load(eepromTestReader));
+  TestVerify(Snapshot::SaveToEeprom() == snapshotSize + 1);
+  ResetGame();
+  TestVerify(Snapshot::LoadFromEeprom());
+  TestVerify(GetGameStateChecksum() == savedChecksum);
+  Snapshot::EraseFromEeprom();
+  TestVerify(!Snapshot::LoadFromEeprom());
+
+  // Data that isn't a snapshot is rejected, as is one that's cut short
+  memset(s_resaved, 0xFF, sizeof(s_resaved));
+  BitReader badReader(s_resaved, sizeof(s_resaved));
+  TestVerify(!Snapshot::Load(badReader));
+  BitReader shortReader(s_snapshot, snapshotSize - 1);
+  TestVerify(!Snapshot::Load(shortReader));
+
+  // Only the resume button carries on with a paused game
+  g.StartGame(settings, false);
+  g.Loop(0);
+  g.Loop(k_pauseButtons);
+  TestVerify(g.m_gameState == GameState::Paused);
+  g.Loop(0);
+  g.Loop(B_BUTTON);
+  TestVerify(g.m_gameState == GameState::Paused);
+  g.Loop(0);
+  g.Loop(k_resumeButton);
+  TestVerify(g.m_gameState == GameState::Playing);
+
+  ResetGame();
+}
+
+void TestRandom()
+{
+  // Same seed, same sequence
+  Random a;
+  Random b;
+  a.SetSeed(12345);
+  b.SetSeed(12345);
+  for (uint8 i = 0; i < 16; i++)
+  {
+    TestVerify(a.Next32() == b.Next32());
+  }
+
+  // A zero seed still produces numbers
+  a.SetSeed(0);
+  TestVerify(a.Next32() != 0);
+
+  // Every value in a range is produced about as often as the others, and nothing outside the range is
+  constexpr uint8 k_ranges[] = {1, 2, 7, 10, 128};
+  for (uint8 r = 0; r < countof(k_ranges); r++)
+  {
+    const uint8 range = k_ranges[r];
+    constexpr uint16 k_samplesPerValue = 32;
+    static uint8 s_counts[129];
+    memset(s_counts, 0, sizeof(s_counts));
+    a.SetSeed(r + 1);
+    for (uint16 i = 0; i < range * k_samplesPerValue; i++)
+    {
+      s_counts[a.NextInRange(range)]++;
+    }
+    uint8 minCount = 0xFF;
+    uint8 maxCount = 0;
+    for (uint8 value = 0; value < range; value++)
+    {
+      minCount = Min(minCount, s_counts[value]);
+      maxCount = Max(maxCount, s_counts[value]);
+    }
+    TestVerify(s_counts[range] == 0);
+    TestVerify((minCount > k_samplesPerValue / 4) && (maxCount < k_samplesPerValue * 3));
+  }
+}
+
+void Bot::UnitTest()
+{
+  ResetGame();
+  // Clearing lines adds to the score, which expects a valid level
+  g.m_gameMode.SetLevel(k_minStartingLevel);
+
+  // A flat O piece in the corner of an empty grid leaves two columns of height 2
+  uint8 pieceRows[k_pieceMaskSize];
+  g_pieceData[uint8(PieceIndex::O)].GetRowMasks(PieceOrientation::North, pieceRows);
+  const uint8 landingY = g.m_grid.GetPieceMaskLandingY(uint8(-1), k_defaultPieceSpawnY, pieceRows);
+  TestVerify(ScoreBoard(uint8(-1), landingY, pieceRows) == (-51 * 4) + (-18 * 2));
+
+  // Leave a well in the right-most column that only an upright I piece can fill
+  for (uint8 y = 0; y < 4; y++)
+  {
+    for (uint8 x = 0; x < k_gridWidth - 1; x++)
+    {
+      g.m_grid.Set(x, y, BlockIndex::X);
+    }
+  }
+  g.m_gameState = GameState::Playing;
+  g.m_playingState = PlayingState::MovingPiece;
+  TestVerify(g.m_currentPiece.SpawnNewPiece(PieceIndex::I));
+
+  g.StartBot();
+  const Bot& bot = g.GetBot();
+  // The search is spread across frames, but always finishes
+  for (uint8 frame = 0; (frame < k_numPlacements) && (bot.m_state != State::Moving); frame++)
+  {
+    g.Loop(0);
+  }
+  TestVerify(bot.m_state == State::Moving);
+  TestVerify(bot.m_bestPlacement < (k_numPlacements / 2));
+  const PieceOrientation orientation = PieceOrientation((bot.m_bestPlacement / k_numPlacementColumns) % uint8(PieceOrientation::Count));
+  const uint8 pieceX = (bot.m_bestPlacement % k_numPlacementColumns) - Grid::k_wallWidth;
+  g_pieceData[uint8(PieceIndex::I)].GetRowMasks(orientation, pieceRows);
+  for (uint8 i = 0; i < k_pieceMaskSize; i++)
+  {
+    const Grid::RowMask pieceColumns = (Grid::RowMask(pieceRows[i]) << uint8(pieceX + Grid::k_wallWidth)) >> Grid::k_wallWidth;
+    TestVerify(pieceColumns == Grid::RowMask(1 << (k_gridWidth - 1)));
+  }
+
+  // The bot's buttons put the piece in the well, which clears all four lines
+  for (uint16 frame = 0; (frame < 1000) && (g.m_playingState == PlayingState::MovingPiece); frame++)
+  {
+    g.Loop(0);
+  }
+  TestVerify(bot.m_piecesPlaced == 1);
+  TestVerify(g.m_playingState == PlayingState::ClearingLines);
+  for (uint16 frame = 0; (frame < 1000) && (g.m_playingState == PlayingState::ClearingLines); frame++)
+  {
+    g.Loop(0);
+  }
+  TestVerify(g.m_grid.GetMaxColumnHeight() == 0);
+
+  ResetGame();
+}
+
+void FramePacer::UnitTest()
+{
+  constexpr uint32 k_testMicros = 1000000;
+  FramePacer pacer;
+
+  // Waking up every time timer 0 interrupts, each frame runs on the first wake after it's due, so none is more than
+  // one wake late
+  pacer.Reset(0);
+  uint16 numFrames = 0;
+  uint32 lastFrameMicros = 0;
+  uint32 maxGapMicros = 0;
+  uint8 maxFramesPerTick = 0;
+  for (uint32 now = 0; now < k_testMicros; now += k_wakeMicros)
+  {
+    const uint8 framesDue = pacer.GetNumFramesDue(now);
+    if (framesDue > 0)
+    {
+      maxGapMicros = Max(maxGapMicros, now - lastFrameMicros);
+      lastFrameMicros = now;
+    }
+    maxFramesPerTick = Max(maxFramesPerTick, framesDue);
+    numFrames += framesDue;
+  }
+  TestVerify(numFrames == k_frameRate);
+  TestVerify(maxFramesPerTick == 1);
+  TestVerify(maxGapMicros <= k_microsPerFrame + k_wakeMicros);
+
+  // Ticking every 16ms like nextFrame() does at 60fps, one tick in 25 is too early for a frame, but two in a row
+  // would leave the screen without a new frame for 48ms
+  pacer.Reset(0);
+  numFrames = 0;
+  uint8 numEmptyTicksInARow = 0;
+  uint8 maxEmptyTicksInARow = 0;
+  for (uint32 now = 0; now < k_testMicros; now += 16000)
+  {
+    const uint8 framesDue = pacer.GetNumFramesDue(now);
+    numEmptyTicksInARow = (framesDue == 0) ? (numEmptyTicksInARow + 1) : 0;
+    maxEmptyTicksInARow = Max(maxEmptyTicksInARow, numEmptyTicksInARow);
+    numFrames += framesDue;
+  }
+  TestVerify(maxEmptyTicksInARow < 2);
+  TestVerify(numFrames == k_frameRate);
+
+  // After a long stall, only a few frames are run to catch up, and the rest of the time is dropped
+  pacer.Reset(0);
+  TestVerify(pacer.GetNumFramesDue(0) == 1);
+  TestVerify(pacer.GetNumFramesDue(k_testMicros) == k_maxFramesPerDraw);
+  TestVerify(pacer.GetNumFramesDue(k_testMicros + 1000) == 0);
+  TestVerify(pacer.GetNumFramesDue(k_testMicros + k_microsPerFrame) == 1);
+}
+
+// Checksum of everything on screen
+uint16 GetScreenChecksum()
+{
+  uint16 checksum = 0;
+  for (uint16 i = 0; i < sizeof(arduboy.sBuffer); i++)
+  {
+    checksum = AddToChecksum(checksum, arduboy.sBuffer[i]);
+  }
+  return checksum;
+}
+
+void TestRetainedText()
+{
+  // Numbers are copied straight into the frame buffer instead of being printed, but should look the same
+  const uint32 values[] = { 0, 7, 1234567890, 4294967295 };
+  for (uint8 i = 0; i < countof(values); i++)
+  {
+    arduboy.clear();
     arduboy.setTextBackground(BLACK);
+    arduboy.setTextColor(WHITE);
+    arduboy.setCursor(0, 0);
+    arduboy.print(values[i]);
+    const uint8 printedWidth = arduboy.getCursorX();
+    const uint16 printedChecksum = GetScreenChecksum();
+    arduboy.clear();
+    TestVerify(DrawNumber(0, 0, values[i]) == printedWidth);
+    TestVerify(GetScreenChecksum() == printedChecksum);
   }
-  else
+
+  // Stats are only drawn when they change
+  ResetGame();
+  g.m_gameMode.SetLevel(12);
+  g.m_gameMode.TrackStat(GameplayStats::Quad);
+  g.m_gameMode.DrawStats();
+  g_display.MarkClean();
+  g.m_gameMode.DrawStats();
+  TestVerify(g_display.GetNumBytesToSend() == 0);
+  // A shorter number has to erase the end of the longer one that was there
+  g.m_gameMode.SetLevel(3);
+  g.m_gameMode.DrawStats();
+  TestVerify(g_display.GetNumBytesToSend() > 0);
+  const uint16 statsChecksum = GetScreenChecksum();
+  arduboy.clear();
+  g.m_gameMode.MarkStatsDirty();
+  g.m_gameMode.DrawStats();
+  TestVerify(GetScreenChecksum() == statsChecksum);
+
+  // The menu only draws lines that change
+  ResetGame();
+  g.Loop(0);
+  g_display.MarkClean();
+  g.Loop(0);
+  TestVerify(g_display.GetNumBytesToSend() == 0);
+  // Moving the selection changes the first two lines
+  g.Loop(DOWN_BUTTON);
+  TestVerify(g_display.IsDirty(0, WIDTH, 0, 1));
+  TestVerify(!g_display.IsDirty(0, WIDTH, 2, k_displayNumPages - 1));
+  const uint16 menuChecksum = GetScreenChecksum();
+  RedrawScreen();
+  // Still held, so the selection doesn't move again
+  g.Loop(DOWN_BUTTON);
+  TestVerify(GetScreenChecksum() == menuChecksum);
+
+  // A rect that reaches past the bottom of the screen only marks the pages that are on it
+  g_display.MarkClean();
+  g_display.MarkRectDirty(0, k_screenHeight - 4, 8, 16);
+  TestVerify(g_display.IsDirty(0, 8, k_displayNumPages - 1, 0xFF));
+  TestVerify(!g_display.IsDirty(0, WIDTH, 0, k_displayNumPages - 2));
+  g_display.MarkAllDirty();
+
+  ResetGame();
+}
+
+void TestButtonSampler()
+{
+  // Uses its own sampler, since the timer interrupt could be adding samples to g_buttonSampler at the same time
+  ButtonSampler sampler;
+  ButtonEvent event = {};
+  // Bouncing contacts never read the same for long enough to count as a press
+  for (uint8 i = 0; i <= 3 * k_buttonDebounceSamples; i++)
   {
-    arduboy.setTextColor(BLACK);
-    arduboy.setTextBackground(WHITE);
+    sampler.Sample(((i % k_buttonDebounceSamples) != 0) ? A_BUTTON : 0);
   }
-  arduboy.print(testName);
-  arduboy.print(F(": "));
-  arduboy.print(g_testPassCount);
-  arduboy.print(F("/"));
-  arduboy.println(g_testPassCount + g_testFailCount);
+  TestVerify(sampler.GetButtonDownFlags() == 0);
+  TestVerify(!sampler.PopEvent(event));
+
+  // The press is timed from the first sample it was down for
+  const uint8 pressSampleTime = sampler.GetSampleTime() + 1;
+  for (uint8 i = 0; i < k_buttonDebounceSamples; i++)
+  {
+    sampler.Sample(A_BUTTON);
+  }
+  TestVerify(sampler.GetButtonDownFlags() == A_BUTTON);
+  TestVerify(sampler.PopEvent(event));
+  TestVerify(event.buttonDownFlags == A_BUTTON);
+  TestVerify(event.changedFlags == A_BUTTON);
+  TestVerify(event.sampleTime == pressSampleTime);
+  TestVerify(!sampler.PopEvent(event));
+
+  // Changes that don't fit in the queue are dropped, but the state is still right
+  for (uint8 i = 0; i < k_buttonEventQueueSize + 1; i++)
+  {
+    for (uint8 j = 0; j < k_buttonDebounceSamples; j++)
+    {
+      sampler.Sample((i & 0x01) ? A_BUTTON : 0);
+    }
+  }
+  TestVerify(sampler.GetButtonDownFlags() == 0);
+  uint8 numEvents = 0;
+  while (sampler.PopEvent(event))
+  {
+    numEvents++;
+  }
+  TestVerify(numEvents == k_buttonEventQueueSize - 1);
+
+  // A tap that was over before the frame still counts as a press for that frame
+  for (uint8 i = 0; i < 2 * k_buttonDebounceSamples; i++)
+  {
+    sampler.Sample((i < k_buttonDebounceSamples) ? B_BUTTON : 0);
+  }
+  GameTicks pressTicks;
+  TestVerify(Input::ReadButtons(sampler, pressTicks) == B_BUTTON);
+  TestVerify(pressTicks == 0);
+  TestVerify(Input::ReadButtons(sampler, pressTicks) == 0);
+
+  // Left and right presses report how long before the frame they happened
+  constexpr uint8 k_samplesPerTick = (1000000 / k_gameTicksPerSecond) / k_buttonSampleMicros;
+  for (uint8 i = 0; i < k_buttonDebounceSamples + (2 * k_samplesPerTick); i++)
+  {
+    sampler.Sample(k_leftButton);
+  }
+  TestVerify(Input::ReadButtons(sampler, pressTicks) == k_leftButton);
+  TestVerify(pressTicks == 2);
+  // Only the frame the press happened before gets its timing
+  TestVerify(Input::ReadButtons(sampler, pressTicks) == k_leftButton);
+  TestVerify(pressTicks == 0);
+  // Presses from long ago are treated as if they happened during the last frame
+  for (uint8 i = 0; i < 100; i++)
+  {
+    sampler.Sample(k_rightButton);
+  }
+  TestVerify(Input::ReadButtons(sampler, pressTicks) == k_rightButton);
+  TestVerify(pressTicks == k_gameTicksPerFrame - 1);
+  for (uint8 i = 0; i < k_buttonDebounceSamples; i++)
+  {
+    sampler.Sample(0);
+  }
+  TestVerify(Input::ReadButtons(sampler, pressTicks) == 0);
 }
 
-#endif // #ifdef TEST_BUILD
-//--------------------------------------------------------------------------
-// Entry points for TEST_BUILD
-//==========================================================================
+// Moves everything 'from' has queued to 'to', the way the serial port would. Returns the number of bytes moved.
+uint8 TransferVersusBytes(Versus& from, Versus& to)
+{
+  uint8 numBytes = 0;
+  while (from.HasBytesToSend())
+  {
+    to.ReceiveByte(from.PopByteToSend());
+    numBytes++;
+  }
+  return numBytes;
+}
+
+bool DoesOpponentGridMatch(const Versus& versus)
+{
+  for (uint8 y = 0; y < k_visibleGridHeight; y++)
+  {
+    if (versus.GetOpponentRowMask(y) != g.m_grid.GetRowMask(y))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Plays the test script until the game queues a message
+void PlayVersusUntilMessage(uint16& frame)
+{
+  while (!g.m_versus.HasBytesToSend() && (g.m_gameState == GameState::Playing))
+  {
+    g.Loop(GetTestScriptButtons(frame++));
+  }
+}
+
+void TestVersusLoopback()
+{
+  // Stands in for the other Arduboy. It's given the same grid as the game, since it's only there to send garbage.
+  static Versus s_peer;
+  GameSettings settings;
+  settings.randomSeed = 1234;
+  settings.startingLevel = 1;
+  settings.pieceStyle = VisualStyle::Donut;
+  settings.shadowStyle = VisualStyle::CenterDot;
+  settings.initialButtonDownFlags = 0;
+  g.StartVersusGame(settings);
+  TestVerify(!g.CanPause());
+  // Logging would corrupt the messages, since they share the serial port
+  TestVerify(!IsDebugSerialAvailable());
+  s_peer.Start(1);
+  // The first message only sets where the other player's garbage total starts from
+  s_peer.OnStackSettled();
+  TransferVersusBytes(s_peer, g.m_versus);
+  TestVerify(g.m_versus.GetPendingGarbage() == 0);
+
+  // The whole grid is sent first, then only the rows that change
+  uint16 frame = 0;
+  uint8 numMessages = 0;
+  uint8 maxMessageBytes = 0;
+  uint16 totalMessageBytes = 0;
+  while (frame < 2400)
+  {
+    PlayVersusUntilMessage(frame);
+    const uint8 numBytes = TransferVersusBytes(g.m_versus, s_peer);
+    TestVerify(DoesOpponentGridMatch(s_peer));
+    numMessages++;
+    maxMessageBytes = Max(maxMessageBytes, numBytes);
+    totalMessageBytes += numBytes;
+  }
+  TestVerify(g.m_gameState == GameState::Playing);
+  TestVerify(numMessages > 10);
+  TestVerify(maxMessageBytes <= Versus::k_maxMessageBytes);
+  // A piece only changes the few rows it lands in
+  TestVerify(totalMessageBytes * 2 < numMessages * Versus::k_maxMessageBytes);
+
+  // Garbage cancels out garbage that's on its way, and the rest is added to the bottom of the grid between pieces
+  s_peer.AddLinesCleared(4);
+  s_peer.OnStackSettled();
+  TransferVersusBytes(s_peer, g.m_versus);
+  TestVerify(g.m_versus.GetPendingGarbage() == 4);
+  g.m_versus.AddLinesCleared(2);
+  TestVerify(g.m_versus.GetPendingGarbage() == 3);
+  const Grid::RowMask bottomRow = g.m_grid.GetRowMask(0);
+  PlayVersusUntilMessage(frame);
+  TestVerify(g.m_versus.GetPendingGarbage() == 0);
+  for (uint8 y = 0; y < 3; y++)
+  {
+    uint8 numEmpty = 0;
+    for (uint8 x = 0; x < k_gridWidth; x++)
+    {
+      numEmpty += g.m_grid.IsEmpty(x, y);
+    }
+    TestVerify(numEmpty == 1);
+  }
+  TestVerify(g.m_grid.GetRowMask(3) == bottomRow);
+  TransferVersusBytes(g.m_versus, s_peer);
+  TestVerify(DoesOpponentGridMatch(s_peer));
+
+  // A corrupt message is dropped. The gap it leaves makes the receiver ask for the whole grid again.
+  PlayVersusUntilMessage(frame);
+  for (uint8 i = 0; g.m_versus.HasBytesToSend(); i++)
+  {
+    // Flips a bit of the payload, after the sync byte and length
+    const uint8 value = g.m_versus.PopByteToSend();
+    s_peer.ReceiveByte((i == 2) ? (value ^ 0x10) : value);
+  }
+  PlayVersusUntilMessage(frame);
+  TransferVersusBytes(g.m_versus, s_peer);
+  s_peer.Update();
+  TestVerify(TransferVersusBytes(s_peer, g.m_versus) > 0);
+  PlayVersusUntilMessage(frame);
+  TransferVersusBytes(g.m_versus, s_peer);
+  TestVerify(DoesOpponentGridMatch(s_peer));
+
+  // The game ends as soon as the other player tops out
+  s_peer.OnGameOver();
+  TransferVersusBytes(s_peer, g.m_versus);
+  TestVerify(g.m_versus.HasWon());
+  g.Loop(0);
+  TestVerify(g.m_gameState == GameState::GameOver);
+
+  ResetGame();
+  TestVerify(!g.m_versus.IsPlaying());
+  TestVerify(IsDebugSerialAvailable());
+}
+
+// Plays the test script with stretches of holding a button and of doing nothing, which is where idle frames happen.
+// Returns a checksum of the game and the screen over every frame, and a snapshot of the game at the end.
+uint16 PlayIdleFramesTestGame(bool idleFramesEnabled, uint16& outNumIdleFrames, uint8* outSnapshot, uint16& outSnapshotSize)
+{
+  g.SetIdleFramesEnabled(idleFramesEnabled);
+  GameSettings settings;
+  settings.randomSeed = 1234;
+  settings.startingLevel = 5;
+  settings.pieceStyle = VisualStyle::Donut;
+  settings.shadowStyle = VisualStyle::CenterDot;
+  settings.initialButtonDownFlags = 0;
+  g.StartGame(settings, false);
+  uint16 checksum = 0;
+  outNumIdleFrames = 0;
+  for (uint16 frame = 0; frame < 2400; frame++)
+  {
+    const uint8 phase = frame % 100;
+    g.Loop((phase < 40) ? GetTestScriptButtons(frame) : ((phase < 60) ? k_leftButton : 0));
+    outNumIdleFrames += g.WasLastFrameIdle();
+    checksum = AddToChecksum(checksum, GetGameStateChecksum());
+    checksum = AddToChecksum(checksum, GetScreenChecksum());
+  }
+  BitWriter writer(outSnapshot, k_snapshotEepromSize);
+  Snapshot::Save(writer);
+  writer.Finish();
+  outSnapshotSize = writer.GetNumBytes();
+  g.SetIdleFramesEnabled(false);
+  return checksum;
+}
+
+void TestIdleFrames()
+{
+  // Idle frames skip updating and drawing, but everything still happens on the same frame it would have
+  static uint8 s_snapshot[k_snapshotEepromSize];
+  static uint8 s_idleSnapshot[k_snapshotEepromSize];
+  uint16 numIdleFrames, snapshotSize;
+  const uint16 checksum = PlayIdleFramesTestGame(false, numIdleFrames, s_snapshot, snapshotSize);
+  TestVerify(g.m_gameState == GameState::Playing);
+  TestVerify(numIdleFrames == 0);
+  uint16 idleSnapshotSize;
+  TestVerify(PlayIdleFramesTestGame(true, numIdleFrames, s_idleSnapshot, idleSnapshotSize) == checksum);
+  TestVerify(idleSnapshotSize == snapshotSize);
+  TestVerify(memcmp(s_snapshot, s_idleSnapshot, snapshotSize) == 0);
+  TestVerify(numIdleFrames > 0);
+  TestVerify(numIdleFrames < 2400);
+
+  // Pressing a button always runs the frame
+  g.SetIdleFramesEnabled(true);
+  g.Loop(0);
+  g.Loop(0);
+  g.Loop(k_rotateCwButton);
+  TestVerify(!g.WasLastFrameIdle());
+  g.SetIdleFramesEnabled(false);
+
+  ResetGame();
+}
+
+void TestFailure()
+{
+  TestVerify(1 + 1 == 2);
+  TestVerify(uint8(uint8(255) + uint8(1)) == 0);
+  TestVerify(1 + 7 == 93);  // Fail
+  TestVerify(2 * 2 == 4);
+}
+
+void __RunTestHelper(const __FlashStringHelper* testName, void(*testFunction)())
+{
+  g_testPassCount = 0;
+  g_testFailCount = 0;
+  (*testFunction)();
+  if (g_testFailCount == 0)
+  {
+    arduboy.setTextColor(WHITE);
+    arduboy.setTextBackground(BLACK);
+  }
+  else
+  {
+    arduboy.setTextColor(BLACK);
+    arduboy.setTextBackground(WHITE);
+  }
+  arduboy.print(testName);
+  arduboy.print(F(": "));
+  arduboy.print(g_testPassCount);
+  arduboy.print(F("/"));
+  arduboy.println(g_testPassCount + g_testFailCount);
+  // Also over Serial, so the results can be read when they don't fit on screen, and checked by host builds
+  Serial.print(testName);
+  Serial.print(F(": "));
+  Serial.print(g_testPassCount);
+  Serial.print(F("/"));
+  Serial.println(g_testPassCount + g_testFailCount);
+}
+
+#endif // #ifdef TEST_BUILD
+//--------------------------------------------------------------------------
+// Entry points for TEST_BUILD
+//==========================================================================
+
+//==========================================================================
+// Entry points for BENCHMARK_BUILD
+//--------------------------------------------------------------------------
+#ifdef BENCHMARK_BUILD
+
+#define RunBenchmark(benchmark, iterations) __RunBenchmarkHelper(F(#benchmark), benchmark, iterations)
+
+// Benchmarks always play the same sequence of pieces so results can be compared between runs
+constexpr unsigned long k_benchmarkRandomSeed = 0x5EED;
+
+// Results are written here so the optimizer can't throw away the work being measured
+volatile uint8 g_benchmarkSink;
+
+// One step of a scripted button sequence; 'buttons' are held down for 'frames' frames
+struct InputScriptStep
+{
+  uint8 buttons;
+  uint8 frames;
+};
+
+// Plays from the main menu through game over and back again, so it can be looped forever.
+// It isn't trying to play well, just to exercise movement, rotation, soft drop, hold, and locking pieces.
+const InputScriptStep k_benchmarkInputScript[] PROGMEM =
+{
+  {B_BUTTON, 1}, {0, 1},                  // Main Menu - Play
+  {LEFT_BUTTON, 12}, {DOWN_BUTTON, 40},
+  {B_BUTTON, 1}, {RIGHT_BUTTON, 12}, {DOWN_BUTTON, 40},
+  {A_BUTTON, 1}, {0, 1}, {A_BUTTON, 1}, {LEFT_BUTTON, 3}, {DOWN_BUTTON, 40},
+  {UP_BUTTON, 1}, {RIGHT_BUTTON, 5}, {DOWN_BUTTON, 40},
+  {B_BUTTON, 1}, {0, 1}, {B_BUTTON, 1}, {DOWN_BUTTON, 40},
+  {0, 30},
+  {A_BUTTON, 1}, {0, 1},                  // Game Over - Back to the menu if the game has ended
+};
+
+void setup()
+{
+  Serial.begin(9600);
+  while (!Serial); // wait for serial port to connect. Needed for native USB
+  arduboy.begin();
+  arduboy.setFrameRate(k_frameRate);
+}
+
+void loop()
+{
+  // pause render until it's time for the next frame
+  if (!(arduboy.nextFrame()))
+  {
+    return;
+  }
+
+  // One benchmark per frame so results show up as they're measured
+  static uint8 s_frameNum = 0;
+  switch (s_frameNum)
+  {
+    case 0: arduboy.clear(); break;
+    case 1: RunBenchmark(BenchmarkDoesPieceFitInGrid, 1000); break;
+    case 2: RunBenchmark(BenchmarkTryRotate, 1000); break;
+    case 3: RunBenchmark(BenchmarkProcessFullLines, 200); break;
+    case 4: RunBenchmark(BenchmarkGridCopy, 200); break;
+    case 5: RunBenchmark(BenchmarkGridDrawFull, 50); break;
+    case 6: RunBenchmark(BenchmarkGridDrawUnchanged, 1000); break;
+    case 7: RunBenchmark(BenchmarkGetBlockForPiece, 1000); break;
+    case 8: BenchmarkScriptedGame(3000); break;
+    case 9: BenchmarkResolvedVisualStyles(500); break;
+    case 10: BenchmarkScriptedGameDisplayBytes(3000); break;
+    case 11: BenchmarkSnapshot(100); break;
+    case 12: RunBenchmark(BenchmarkDrawStatsFull, 100); break;
+    case 13: RunBenchmark(BenchmarkDrawStatsUnchanged, 1000); break;
+    case 14: BenchmarkVersus(3000); break;
+    case 15: BenchmarkIdleFrames(3000); break;
+  }
+  if (s_frameNum < 255) {
+    s_frameNum++;
+  }
+
+  arduboy.display();
+}
+
+// Fills the bottom of the grid with a ragged stack so collision tests have something to hit
+void SetupBenchmarkGrid()
+{
+  ResetGame();
+  g.m_gameMode.SetLevel(k_minStartingLevel);
+  for (uint8 y = 0; y < 8; y++)
+  {
+    for (uint8 x = 0; x < k_gridWidth; x++)
+    {
+      if (((x * 7) + (y * 3)) % 5 != 0)
+      {
+        g.m_grid.Set(x, y, BlockIndex::Donut);
+      }
+    }
+  }
+}
+
+void BenchmarkDoesPieceFitInGrid(uint16 iterations)
+{
+  uint8 fitCount = 0;
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    const PieceData& pieceData = g_pieceData[i % uint8(PieceIndex::Count)];
+    fitCount += pieceData.DoesPieceFitInGrid(PieceOrientation(i & 0x03), uint8(i % k_gridWidth) - 1, uint8(i % 12));
+  }
+  g_benchmarkSink = fitCount;
+}
+
+void BenchmarkTryRotate(uint16 iterations)
+{
+  // Rotating against the left wall, on top of the stack, exercises the wall and floor kicks
+  g.m_currentPiece.SpawnNewPiece(PieceIndex::T);
+  while (g.m_currentPiece.TryMove(-1, 0)) {}
+  while (g.m_currentPiece.TryMove(0, -1)) {}
+  uint8 rotateCount = 0;
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    rotateCount += g.m_currentPiece.TryRotate((i & 0x04) ? RotationDirection::Clockwise : RotationDirection::CounterClockwise);
+  }
+  g_benchmarkSink = rotateCount;
+}
+
+// Each iteration clears four lines, so the grid has to be restored every time.
+// BenchmarkGridCopy measures the cost of restoring it, which should be subtracted from this result.
+void BenchmarkProcessFullLines(uint16 iterations)
+{
+  static Grid s_grid;
+  s_grid = g.m_grid;
+  for (uint8 y = 0; y < 4; y++)
+  {
+    for (uint8 x = 0; x < k_gridWidth; x++)
+    {
+      s_grid.Set(x, y * 2, BlockIndex::X);
+    }
+  }
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    g.m_grid = s_grid;
+    g.m_grid.ProcessFullLines();
+  }
+  g_benchmarkSink = g.m_grid.GetRowMask(0);
+}
+
+void BenchmarkGridCopy(uint16 iterations)
+{
+  static Grid s_grid;
+  s_grid = g.m_grid;
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    g.m_grid = s_grid;
+    g_benchmarkSink = g.m_grid.GetRowMask(0);
+  }
+}
+
+void BenchmarkGridDrawFull(uint16 iterations)
+{
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    g.m_grid.MarkAllDirty();
+    g.m_grid.Draw();
+  }
+}
+
+void BenchmarkGridDrawUnchanged(uint16 iterations)
+{
+  g.m_grid.Draw();
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    g.m_grid.Draw();
+  }
+}
+
+void BenchmarkDrawStatsFull(uint16 iterations)
+{
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    g.m_gameMode.MarkStatsDirty();
+    g.m_gameMode.DrawStats();
+  }
+}
+
+void BenchmarkDrawStatsUnchanged(uint16 iterations)
+{
+  g.m_gameMode.DrawStats();
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    g.m_gameMode.DrawStats();
+  }
+}
+
+void BenchmarkGetBlockForPiece(uint16 iterations)
+{
+  uint8 blockSum = 0;
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    VisualStyleHelper styleHelper(VisualStyle(i % uint8(VisualStyle::Count)), PieceIndex(i % uint8(PieceIndex::Count)));
+    blockSum += uint8(styleHelper.GetBlock(PieceOrientation((i >> 3) & 0x03), i & 0x03));
+  }
+  g_benchmarkSink = blockSum;
+}
+
+// Looks up all the blocks of a piece with one helper, the way PieceData::Draw does
+uint8 BenchmarkStyleLookups(VisualStyle visualStyle, PieceIndex piece, uint16 iterations)
+{
+  uint8 blockSum = 0;
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    VisualStyleHelper styleHelper(visualStyle, piece);
+    const PieceOrientation orientation = PieceOrientation(i & 0x03);
+    for (uint8 index = 0; index < PieceData::GetNumBlocksInPiece(); index++)
+    {
+      blockSum += uint8(styleHelper.GetBlock(orientation, index));
+    }
+  }
+  return blockSum;
+}
+
+// Compares decoding each style from PROGMEM against reading it from a resolved style, in ns/piece
+// Every style is printed over Serial, and the average over all styles is shown on screen
+void BenchmarkResolvedVisualStyles(uint16 iterations)
+{
+  arduboy.clear();
+  arduboy.setCursor(0, 0);
+  PrintBenchmarkResult(F("ResolvedVisualStyle"), sizeof(ResolvedVisualStyle), F(" bytes"));
+  uint32 totalUnresolvedMicros = 0;
+  uint32 totalResolvedMicros = 0;
+  for (uint8 style = 0; style < uint8(VisualStyle::Count); style++)
+  {
+    // Styles resolved by earlier benchmarks would make the first run take the resolved path too
+    for (uint8 i = 0; i < k_numResolvedVisualStyles; i++)
+    {
+      g_resolvedVisualStyles[i] = ResolvedVisualStyle();
+    }
+    // The game only resolves the current piece, so this times one piece the same way
+    const PieceIndex piece = PieceIndex(style % uint8(PieceIndex::Count));
+    uint32 startMicros = micros();
+    g_benchmarkSink = BenchmarkStyleLookups(VisualStyle(style), piece, iterations);
+    const uint32 unresolvedMicros = micros() - startMicros;
+
+    g_resolvedVisualStyles[0].Resolve(VisualStyle(style), piece);
+    startMicros = micros();
+    g_benchmarkSink = BenchmarkStyleLookups(VisualStyle(style), piece, iterations);
+    const uint32 resolvedMicros = micros() - startMicros;
+
+    Serial.print((const __FlashStringHelper*)pgm_read_word(&k_styleNames[style]));
+    Serial.print(F(": "));
+    Serial.print((unresolvedMicros * 1000) / iterations);
+    Serial.print(F(" -> "));
+    Serial.print((resolvedMicros * 1000) / iterations);
+    Serial.println(F(" ns/piece"));
+    totalUnresolvedMicros += unresolvedMicros;
+    totalResolvedMicros += resolvedMicros;
+  }
+  const uint32 totalIterations = uint32(iterations) * uint8(VisualStyle::Count);
+  PrintBenchmarkResult(F("Unresolved"), (totalUnresolvedMicros * 1000) / totalIterations, F(" ns/piece"));
+  PrintBenchmarkResult(F("Resolved"), (totalResolvedMicros * 1000) / totalIterations, F(" ns/piece"));
+}
+
+// Returns the buttons held for the next frame of the benchmark's input script
+uint8 GetBenchmarkScriptButtons(uint8& step, uint8& framesLeftInStep, uint8& buttons)
+{
+  if (framesLeftInStep == 0)
+  {
+    buttons = pgm_read_byte(&k_benchmarkInputScript[step].buttons);
+    framesLeftInStep = pgm_read_byte(&k_benchmarkInputScript[step].frames);
+    step = (step + 1) % countof(k_benchmarkInputScript);
+  }
+  framesLeftInStep--;
+  return buttons;
+}
+
+void BenchmarkScriptedGame(uint16 frames)
+{
+  ResetGame();
+  uint8 step = 0;
+  uint8 framesLeftInStep = 0;
+  uint8 buttons = 0;
+  const uint32 startMicros = micros();
+  for (uint16 frame = 0; frame < frames; frame++)
+  {
+    g.Loop(GetBenchmarkScriptButtons(step, framesLeftInStep, buttons));
+  }
+  const uint32 elapsedMicros = micros() - startMicros;
+  arduboy.clear();
+  PrintBenchmarkResult(F("ScriptedGame"), (uint32(frames) * 1000) / Max<uint32>(elapsedMicros / 1000, 1), F(" frames/s"));
+  PrintBenchmarkResult(F("ScriptedGame"), (elapsedMicros / frames), F(" us/frame"));
+}
+
+// Plays the same game as BenchmarkScriptedGame, but measures how much of the screen has to be sent each frame
+void BenchmarkScriptedGameDisplayBytes(uint16 frames)
+{
+  ResetGame();
+  uint8 step = 0;
+  uint8 framesLeftInStep = 0;
+  uint8 buttons = 0;
+  uint32 totalBytes = 0;
+  uint16 maxBytes = 0;
+  for (uint16 frame = 0; frame < frames; frame++)
+  {
+    g.Loop(GetBenchmarkScriptButtons(step, framesLeftInStep, buttons));
+    const uint16 numBytes = g_display.GetNumBytesToSend();
+    g_display.MarkClean();
+    totalBytes += numBytes;
+    maxBytes = Max(maxBytes, numBytes);
+  }
+  arduboy.clear();
+  PrintBenchmarkResult(F("DisplayBytes"), totalBytes / frames, F(" avg B/frame"));
+  PrintBenchmarkResult(F("DisplayBytes"), maxBytes, F(" max B/frame"));
+  PrintBenchmarkResult(F("DisplayBytes"), sizeof(arduboy.sBuffer), F(" full B/frame"));
+}
+
+// Plays a versus game with the same script as BenchmarkScriptedGame against a stand-in for the other Arduboy, and
+// measures how much it sends over serial. Then times sending and receiving the biggest message there can be.
+void BenchmarkVersus(uint16 frames)
+{
+  static Versus s_peer;
+  GameSettings settings;
+  settings.randomSeed = k_benchmarkRandomSeed;
+  settings.startingLevel = k_minStartingLevel;
+  settings.pieceStyle = VisualStyle::Donut;
+  settings.shadowStyle = VisualStyle::CenterDot;
+  settings.initialButtonDownFlags = 0;
+  g.StartVersusGame(settings);
+  s_peer.Start(k_benchmarkRandomSeed);
+  uint8 step = 0;
+  uint8 framesLeftInStep = 0;
+  uint8 buttons = 0;
+  uint32 totalBytes = 0;
+  uint16 numMessages = 0;
+  uint8 maxMessageBytes = 0;
+  for (uint16 frame = 0; frame < frames; frame++)
+  {
+    g.Loop(GetBenchmarkScriptButtons(step, framesLeftInStep, buttons));
+    uint8 numBytes = 0;
+    while (g.m_versus.HasBytesToSend())
+    {
+      s_peer.ReceiveByte(g.m_versus.PopByteToSend());
+      numBytes++;
+    }
+    if (numBytes > 0)
+    {
+      totalBytes += numBytes;
+      numMessages++;
+      maxMessageBytes = Max(maxMessageBytes, numBytes);
+    }
+  }
+
+  // Every visible row has something in it, and the whole grid is sent
+  ResetGame();
+  for (uint8 y = 0; y < k_visibleGridHeight; y++)
+  {
+    for (uint8 x = 0; x < k_gridWidth; x++)
+    {
+      if (((x * 7) + (y * 3)) % 5 != 0)
+      {
+        g.m_grid.Set(x, y, BlockIndex::Donut);
+      }
+    }
+  }
+  constexpr uint8 k_iterations = 100;
+  uint8 worstMessageBytes = 0;
+  const uint32 startMicros = micros();
+  for (uint8 i = 0; i < k_iterations; i++)
+  {
+    g.m_versus.Start(k_benchmarkRandomSeed);
+    g.m_versus.OnStackSettled();
+    worstMessageBytes = 0;
+    while (g.m_versus.HasBytesToSend())
+    {
+      s_peer.ReceiveByte(g.m_versus.PopByteToSend());
+      worstMessageBytes++;
+    }
+  }
+  const uint32 worstMicros = (micros() - startMicros) / k_iterations;
+  ResetGame();
+
+  arduboy.clear();
+  PrintBenchmarkResult(F("Versus"), sizeof(Versus), F(" bytes"));
+  PrintBenchmarkResult(F("Versus"), (totalBytes * k_frameRate) / frames, F(" avg B/s"));
+  PrintBenchmarkResult(F("Versus"), totalBytes / Max<uint16>(numMessages, 1), F(" avg B/msg"));
+  PrintBenchmarkResult(F("Versus"), maxMessageBytes, F(" max B/msg"));
+  PrintBenchmarkResult(F("Versus"), worstMessageBytes, F(" worst B/msg"));
+  PrintBenchmarkResult(F("Versus"), worstMicros, F(" worst us/msg"));
+}
+
+// Plays the same game as BenchmarkScriptedGame with and without idle frames, and measures how much time they save
+void BenchmarkIdleFrames(uint16 frames)
+{
+  uint32 elapsedMicros[2];
+  uint16 numIdleFrames = 0;
+  for (uint8 idleFramesEnabled = 0; idleFramesEnabled < 2; idleFramesEnabled++)
+  {
+    g.SetIdleFramesEnabled(idleFramesEnabled);
+    ResetGame();
+    uint8 step = 0;
+    uint8 framesLeftInStep = 0;
+    uint8 buttons = 0;
+    const uint32 startMicros = micros();
+    for (uint16 frame = 0; frame < frames; frame++)
+    {
+      g.Loop(GetBenchmarkScriptButtons(step, framesLeftInStep, buttons));
+      numIdleFrames += g.WasLastFrameIdle();
+    }
+    elapsedMicros[idleFramesEnabled] = micros() - startMicros;
+  }
+  g.SetIdleFramesEnabled(false);
+  ResetGame();
+
+  arduboy.clear();
+  PrintBenchmarkResult(F("IdleFrames"), elapsedMicros[0] / frames, F(" us/frame off"));
+  PrintBenchmarkResult(F("IdleFrames"), elapsedMicros[1] / frames, F(" us/frame on"));
+  PrintBenchmarkResult(F("IdleFrames"), (uint32(numIdleFrames) * 100) / frames, F("% idle"));
+}
+
+// Measures how big a paused game is and how long saving and resuming it takes.
+// Loading has to fit in a frame so resuming doesn't stutter.
+void BenchmarkSnapshot(uint16 iterations)
+{
+  SetupBenchmarkGrid();
+  uint8 buffer[k_snapshotEepromSize];
+  uint16 numBytes = 0;
+  uint32 startMicros = micros();
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    BitWriter writer(buffer, sizeof(buffer));
+    Snapshot::Save(writer);
+    writer.Finish();
+    numBytes = writer.GetNumBytes();
+  }
+  const uint32 saveMicros = micros() - startMicros;
+
+  startMicros = micros();
+  for (uint16 i = 0; i < iterations; i++)
+  {
+    BitReader reader(buffer, numBytes);
+    g_benchmarkSink = Snapshot::Load(reader);
+  }
+  const uint32 loadMicros = micros() - startMicros;
+
+  // Writing EEPROM is slow enough that once is plenty, and it wears the EEPROM out
+  startMicros = micros();
+  const uint16 eepromBytes = Snapshot::SaveToEeprom();
+  const uint32 eepromMicros = micros() - startMicros;
+  Snapshot::EraseFromEeprom();
+
+  arduboy.clear();
+  PrintBenchmarkResult(F("Snapshot"), numBytes, F(" bytes"));
+  PrintBenchmarkResult(F("Save"), saveMicros / iterations, F(" us"));
+  PrintBenchmarkResult(F("Load"), loadMicros / iterations, F(" us"));
+  PrintBenchmarkResult(F("EEPROM save"), eepromMicros, F(" us"));
+  PrintBenchmarkResult(F("EEPROM size"), eepromBytes, F(" bytes"));
+}
+
+void PrintBenchmarkResult(const __FlashStringHelper* name, uint32 value, const __FlashStringHelper* units)
+{
+  Serial.print(name);
+  Serial.print(F(": "));
+  Serial.print(value);
+  Serial.println(units);
+  arduboy.print(name);
+  arduboy.print(F(" "));
+  arduboy.print(value);
+  arduboy.println(units);
+}
+
+void __RunBenchmarkHelper(const __FlashStringHelper* benchmarkName, void(*benchmarkFunction)(uint16), uint16 iterations)
+{
+  // Every benchmark starts from the same state
+  SetupBenchmarkGrid();
+  const uint32 startMicros = micros();
+  (*benchmarkFunction)(iterations);
+  const uint32 elapsedMicros = micros() - startMicros;
+
+  // Drawing benchmarks leave the screen in a state that's not useful to look at
+  arduboy.clear();
+  arduboy.setCursor(0, 0);
+  PrintBenchmarkResult(benchmarkName, (elapsedMicros * 1000) / iterations, F(" ns/op"));
+}
+
+#endif // #ifdef BENCHMARK_BUILD
+//--------------------------------------------------------------------------
+// Entry points for BENCHMARK_BUILD
+//==========================================================================
+
+//==========================================================================
+// Entry points for SOAK_BUILD
+//--------------------------------------------------------------------------
+#ifdef SOAK_BUILD
+
+// Soak runs play the same games every time, so changes to the rules can be compared
+constexpr uint32 k_soakRandomSeed = 0x50A4;
+// Level every game starts at; change this to look at a particular part of the gravity table
+constexpr uint8 k_soakStartingLevel = k_minStartingLevel;
+// Results are reported after every this many games
+constexpr uint8 k_soakReportInterval = 10;
+// Lines per game are counted in buckets this many lines wide. The last bucket also counts everything above it.
+constexpr uint8 k_soakLinesBucketSize = 25;
+constexpr uint8 k_soakNumLinesBuckets = 12;
+
+// Totals and distributions over every game played so far
+struct SoakStats
+{
+  uint32 games;
+  uint32 frames;
+  uint32 pieces;
+  uint32 totalLines;
+  uint16 minLines;
+  uint16 maxLines;
+  uint32 minScore;
+  uint32 maxScore;
+  // Number of games that ended at each level
+  uint16 levelCounts[k_maxLevel + 1];
+  uint16 linesCounts[k_soakNumLinesBuckets];
+};
+
+// Host builds play games on several threads at once (see host/SoakMain.cpp), each with its own stats
+PER_THREAD SoakStats g_soakStats;
+Random g_soakRandom;
+uint32 g_soakStartMillis;
+
+void setup()
+{
+  Serial.begin(9600);
+  while (!Serial); // wait for serial port to connect. Needed for native USB
+  arduboy.begin();
+  ResetGame();
+  g_soakRandom.SetSeed(k_soakRandomSeed);
+  ResetSoakStats();
+  g_soakStartMillis = millis();
+  StartSoakGame(g_soakRandom.Next32());
+}
+
+void loop()
+{
+  // Frames are run as fast as they can be, instead of waiting for the next one
+  g.Loop(0x00);
+  g_soakStats.frames++;
+
+  if (g.m_gameState == GameState::GameOver)
+  {
+    TrackSoakGame();
+    if ((g_soakStats.games % k_soakReportInterval) == 0)
+    {
+      PrintSoakStats();
+    }
+    StartSoakGame(g_soakRandom.Next32());
+  }
+}
+
+void ResetSoakStats()
+{
+  g_soakStats = SoakStats();
+  g_soakStats.minLines = 0xFFFF;
+  g_soakStats.minScore = 0xFFFFFFFF;
+}
+
+void StartSoakGame(uint32 randomSeed)
+{
+  GameSettings settings;
+  settings.randomSeed = randomSeed;
+  settings.startingLevel = k_soakStartingLevel;
+  settings.pieceStyle = VisualStyle::Donut;
+  settings.shadowStyle = VisualStyle::CenterDot;
+  settings.initialButtonDownFlags = 0x00;
+  // Soak builds play too many games to record them without wearing out the EEPROM
+  g.StartGame(settings, false);
+  g.StartBot();
+}
+
+void TrackSoakGame()
+{
+  const uint16 lines = g.m_gameMode.GetTotalLines();
+  const uint32 score = g.m_gameMode.GetScore();
+  SoakStats& stats = g_soakStats;
+  stats.games++;
+  stats.pieces += g.GetBot().GetPiecesPlaced();
+  stats.totalLines += lines;
+  stats.minLines = Min(stats.minLines, lines);
+  stats.maxLines = Max(stats.maxLines, lines);
+  stats.minScore = Min(stats.minScore, score);
+  stats.maxScore = Max(stats.maxScore, score);
+  stats.levelCounts[Min(g.m_gameMode.GetLevel(), k_maxLevel)]++;
+  stats.linesCounts[Min<uint16>(lines / k_soakLinesBucketSize, k_soakNumLinesBuckets - 1)]++;
+}
+
+void PrintSoakStats()
+{
+  const SoakStats& stats = g_soakStats;
+  const uint32 elapsedSeconds = Max<uint32>((millis() - g_soakStartMillis) / 1000, 1);
+
+  // AVR plays games slowly enough that games per second would always be 0
+  Serial.print(F("Games: "));
+  Serial.print(stats.games);
+  Serial.print(F(" ("));
+  Serial.print((stats.games * 3600) / elapsedSeconds);
+  Serial.print(F(" games/h, "));
+  Serial.print(stats.frames / elapsedSeconds);
+  Serial.println(F(" frames/s)"));
+
+  Serial.print(F("Lines avg/min/max: "));
+  Serial.print(stats.totalLines / stats.games);
+  Serial.print(F(" / "));
+  Serial.print(stats.minLines);
+  Serial.print(F(" / "));
+  Serial.println(stats.maxLines);
+
+  // In game time, so it's how fast the bot plays, not how fast the games are run
+  const uint32 piecesPerSecondX100 = (stats.pieces * 100) / Max<uint32>(stats.frames / k_frameRate, 1);
+  Serial.print(F("Pieces/s: "));
+  Serial.print(piecesPerSecondX100 / 100);
+  Serial.print(F("."));
+  Serial.print((piecesPerSecondX100 / 10) % 10);
+  Serial.println(piecesPerSecondX100 % 10);
+
+  Serial.print(F("Score min/max: "));
+  Serial.print(stats.minScore);
+  Serial.print(F(" / "));
+  Serial.println(stats.maxScore);
+
+  Serial.print(F("Final level:"));
+  for (uint8 level = k_minStartingLevel; level <= k_maxLevel; level++)
+  {
+    if (stats.levelCounts[level] > 0)
+    {
+      Serial.print(F(" "));
+      Serial.print(level);
+      Serial.print(F("="));
+      Serial.print(stats.levelCounts[level]);
+    }
+  }
+  Serial.println();
+
+  Serial.print(F("Lines:"));
+  for (uint8 i = 0; i < k_soakNumLinesBuckets; i++)
+  {
+    if (stats.linesCounts[i] > 0)
+    {
+      Serial.print(F(" "));
+      Serial.print(i * k_soakLinesBucketSize);
+      Serial.print((i + 1 < k_soakNumLinesBuckets) ? F("+") : F("++"));
+      Serial.print(F("="));
+      Serial.print(stats.linesCounts[i]);
+    }
+  }
+  Serial.println();
+
+  // A summary on screen, so a soak run can be checked on without a Serial connection
+  arduboy.clear();
+  arduboy.setCursor(0, 0);
+  arduboy.print(F("Games "));
+  arduboy.println(stats.games);
+  arduboy.print(F("Lines avg "));
+  arduboy.println(stats.totalLines / stats.games);
+  arduboy.print(F("Lines max "));
+  arduboy.println(stats.maxLines);
+  arduboy.print(F("Games/h "));
+  arduboy.println((stats.games * 3600) / elapsedSeconds);
+  arduboy.display();
+}
+
+#endif // #ifdef SOAK_BUILD
+//--------------------------------------------------------------------------
+// Entry points for SOAK_BUILD
+//==========================================================================
+
+void Global::Loop(uint8 buttonDownFlags, GameTicks pressTicks)
+{
+  // The replay's buttons are used instead of the real ones until it runs out
+  if (m_replay.IsPlaying() && !m_replay.GetNextFrame(buttonDownFlags, pressTicks) && m_replay.WasTruncated())
+  {
+    // The rest of the game wasn't recorded, so it ends here and says why, instead of carrying on with the player's buttons
+    m_replayTruncated = true;
+    if (m_gameState == GameState::Playing)
+    {
+      m_gameState = GameState::GameOver;
+    }
+  }
+  else if (m_bot.IsPlaying())
+  {
+    // The bot's buttons replace the player's, and get recorded the same way
+    buttonDownFlags = m_bot.Update();
+    pressTicks = 0;
+  }
+  const bool inputChanged = (buttonDownFlags != m_input.GetButtonDownFlags()) || (pressTicks != 0);
+  if (inputChanged)
+  {
+    m_entropy.Mix(micros());
+  }
+  m_input.Update(buttonDownFlags, pressTicks);
+  m_replay.RecordFrame(buttonDownFlags, pressTicks);
+
+  if (m_versus.IsPlaying())
+  {
+    // The game ends as soon as either player tops out
+    if (m_versus.HasWon())
+    {
+      if (m_gameState == GameState::Playing)
+      {
+        m_gameState = GameState::GameOver;
+      }
+    }
+    else if (m_gameState == GameState::GameOver)
+    {
+      m_versus.OnGameOver();
+    }
+    m_versus.Update();
+  }
+
+  m_lastFrameIdle = IsIdleFrame(inputChanged);
+  if (m_lastFrameIdle)
+  {
+    ProfileSection(Logic);
+    // The same as running the frame, which would only have counted these down
+    if (m_gameState == GameState::Playing)
+    {
+      m_controller.SkipFrame();
+      m_currentPiece.SkipFrame(m_controller.IsSoftDrop());
+    }
+  }
+  else
+  {
+    ProfileSection(Logic);
+    const GameState gameState = m_gameState;
+    const PlayingState playingState = m_playingState;
+    const uint8 cameraRow = m_viewport.GetCameraRow();
+    switch (m_gameState)
+    {
+      case GameState::MainMenu:
+        m_menus.Loop();
+        break;
+      case GameState::Playing:
+        PlayingLoop();
+        break;
+      case GameState::Paused:
+        PausedLoop();
+        break;
+      case GameState::GameOver:
+        GameOverLoop();
+        break;
+    }
+    // A new state draws for the first time on the frame after it starts, and the view can keep scrolling for
+    // several frames, so frames after those have to run in full too
+    m_screenUpToDate = IsDrawingEnabled() && (m_gameState == gameState) && (m_playingState == playingState) &&
+                       (m_viewport.GetCameraRow() == cameraRow);
+  }
+
+  // Recording ends with the game, or when it's paused, since a replay can't be resumed
+  if (m_replay.IsRecording() && (m_gameState != GameState::Playing))
+  {
+    m_replay.StopRecording(m_gameState == GameState::GameOver);
+  }
+  m_replay.Flush();
+}
+
+bool Global::IsIdleFrame(bool inputChanged)
+{
+  // The bot searches for moves every frame, and the other player in a versus game can send something any time
+  if (!m_idleFramesEnabled || !m_screenUpToDate || inputChanged || m_bot.IsPlaying() || m_versus.IsPlaying())
+  {
+    return false;
+  }
+  return GetTicksUntilNextEvent() > k_gameTicksPerFrame;
+}
+
+GameTicks Global::GetTicksUntilNextEvent()
+{
+  // Menus, messages, and pausing only change when a button does
+  if (m_gameState != GameState::Playing)
+  {
+    return k_ticksUntilInput;
+  }
+  // The line clear animation and the shake after a piece locks change every frame, and the piece is placed
+  // on the frame it's no longer valid
+  if ((m_playingState != PlayingState::MovingPiece) || !m_currentPiece.IsValidPiece())
+  {
+    return 0;
+  }
+  return Min(m_controller.GetTicksUntilNextEvent(), m_currentPiece.GetTicksUntilNextEvent(m_controller.IsSoftDrop()));
+}
+
+void Global::StartGame(const GameSettings& settings, bool recordReplay)
+{
+  BeginGame(settings);
+  if (recordReplay)
+  {
+    m_replay.StartRecording(settings);
+  }
+}
+
+void Global::StartVersusGame(const GameSettings& settings)
+{
+  BeginGame(settings);
+  // USB serial runs at the same speed whatever the baud rate is
+  Serial.begin(9600);
+  m_versus.Start(GenerateRandomSeed());
+}
+
+bool Global::StartReplay()
+{
+  GameSettings settings;
+  if (!m_replay.StartPlayback(settings))
+  {
+    return false;
+  }
+  BeginGame(settings);
+  return true;
+}
+
+void Global::BeginGame(const GameSettings& settings)
+{
+  for (uint8 i = 0; i < uint8(PieceIndex::Count); i++)
+  {
+    m_pieceStyle[i] = settings.pieceStyle;
+  }
+  m_shadowStyle = settings.shadowStyle;
+
+  ResetGame();
+  m_bot.Reset();
+  m_replayTruncated = false;
+  // Reseed so the pieces only depend on the settings
+  m_next.Reset(settings.randomSeed);
+  m_gameMode.SetLevel(settings.startingLevel);
+  m_gameState = GameState::Playing;
+  // Next frame's presses are detected against the same buttons whether the game is being played or replayed
+  m_input.Update(settings.initialButtonDownFlags, 0);
+}
+
+bool Global::CanPause() const
+{
+  return !m_replay.IsPlaying() && !m_bot.IsPlaying() && !m_versus.IsPlaying();
+}
+
+void Global::Pause()
+{
+  // Recording stops at the end of the frame
+  m_gameState = GameState::Paused;
+  Snapshot::SaveToEeprom();
+}
+
+void Global::Unpause()
+{
+  Snapshot::EraseFromEeprom();
+  m_gameState = GameState::Playing;
+  // The pause message was drawn over things that only get redrawn when they change
+  RedrawScreen();
+}
+
+bool Global::ResumeSavedGame()
+{
+  if (!Snapshot::LoadFromEeprom())
+  {
+    return false;
+  }
+  m_gameState = GameState::Paused;
+  return true;
+}
+
+void Replay::StartRecording(const GameSettings& settings)
+{
+  m_state = State::Recording;
+  m_address = k_replayEepromStart;
+  m_runFrames = 0;
+  m_queueStart = 0;
+  m_queueCount = 0;
+  m_truncated = false;
+
+  // Anything but the header tag, so the old replay isn't played back part way through being overwritten
+  QueueByte(uint8(~k_replayHeaderTag));
+  const uint8* settingsBytes = reinterpret_cast<const uint8*>(&settings);
+  for (uint8 i = 0; i < sizeof(settings); i++)
+  {
+    QueueByte(settingsBytes[i]);
+  }
+}
+
+void Replay::RecordFrame(uint8 buttonDownFlags, GameTicks pressTicks)
+{
+  if ((m_state != State::Recording) || m_truncated)
+  {
+    return;
+  }
+  Assert(pressTicks <= k_replayPressTicksMask);
+  if ((m_runFrames > 0) && ((buttonDownFlags != m_runButtonDownFlags) || (pressTicks != 0) || (m_runFrames == 0xFF)))
+  {
+    QueueRun();
+  }
+  if (m_runFrames == 0)
+  {
+    m_runButtonDownFlags = buttonDownFlags;
+    m_runPressTicks = pressTicks;
+  }
+  m_runFrames++;
+}
+
+void Replay::StopRecording(bool gameOver)
+{
+  if (m_state != State::Recording)
+  {
+    return;
+  }
+  if (m_runFrames > 0)
+  {
+    QueueRun();
+  }
+  // QueueRun() always leaves room for this
+  QueueByte((m_truncated || !gameOver) ? k_replayTruncatedMask : 0);
+  QueueByte(0);
+  m_state = State::Saving;
+}
+
+bool Replay::CanQueue(uint8 numBytes) const
+{
+  return ((m_queueCount + numBytes) <= k_replayQueueSize) &&
+         ((m_address + m_queueCount + numBytes) <= (k_replayEepromStart + k_replayEepromSize));
+}
+
+void Replay::QueueByte(uint8 value)
+{
+  Assert(CanQueue(1));
+  m_queue[(m_queueStart + m_queueCount) % k_replayQueueSize] = value;
+  m_queueCount++;
+}
+
+void Replay::QueueRun()
+{
+  // Room has to be left after the run for the run that ends the stream
+  if (!m_truncated && CanQueue(2 + 2))
+  {
+    QueueByte(m_runButtonDownFlags | m_runPressTicks);
+    QueueByte(m_runFrames);
+  }
+  else
+  {
+    // Out of space, or the EEPROM fell too far behind; the replay ends here
+    m_truncated = true;
+  }
+  m_runFrames = 0;
+}
+
+void Replay::Flush()
+{
+  if (((m_queueCount == 0) && (m_state != State::Saving)) || !eeprom_is_ready())
+  {
+    return;
+  }
+  if (m_queueCount > 0)
+  {
+    EEPROM.update(m_address, m_queue[m_queueStart]);
+    m_address++;
+    m_queueStart = (m_queueStart + 1) % k_replayQueueSize;
+    m_queueCount--;
+  }
+  else
+  {
+    // Everything else is written, so the replay is complete
+    EEPROM.update(k_replayEepromStart, k_replayHeaderTag);
+    m_state = State::Idle;
+  }
+}
+
+uint8 FramePacer::GetNumFramesDue(uint32 nowMicros)
+{
+  uint8 numFrames = 0;
+  while ((numFrames < k_maxFramesPerDraw) && (int32(nowMicros - m_nextFrameMicros) >= 0))
+  {
+    m_nextFrameMicros += k_microsPerFrame;
+    numFrames++;
+  }
+  if (int32(nowMicros - m_nextFrameMicros) >= 0)
+  {
+    // Too far behind to catch up
+    m_nextFrameMicros = nowMicros + k_microsPerFrame;
+  }
+  return numFrames;
+}
+
+bool Replay::StartPlayback(GameSettings& outSettings)
+{
+  if (m_state != State::Idle)
+  {
+    return false;
+  }
+  if (EEPROM.read(k_replayEepromStart) != k_replayHeaderTag)
+  {
+    return false;
+  }
+  EEPROM.get(k_replayEepromStart + 1, outSettings);
+  m_address = k_replayEepromStart + 1 + sizeof(outSettings);
+  m_runFrames = 0;
+  m_truncated = false;
+  m_state = State::Playing;
+  return true;
+}
+
+bool Replay::GetNextFrame(uint8& outButtonDownFlags, GameTicks& outPressTicks)
+{
+  if (m_runFrames == 0)
+  {
+    // Saved replays always end with a run of 0 frames, but the data can't be trusted to
+    const bool outOfSpace = ((m_address + 2) > (k_replayEepromStart + k_replayEepromSize));
+    const uint8 runMask = outOfSpace ? k_replayTruncatedMask : EEPROM.read(m_address);
+    const uint8 frames = outOfSpace ? 0 : EEPROM.read(m_address + 1);
+    if (frames == 0)
+    {
+      m_truncated = (runMask == k_replayTruncatedMask);
+      m_state = State::Idle;
+      return false;
+    }
+    m_runButtonDownFlags = runMask & ~k_replayPressTicksMask;
+    m_runPressTicks = runMask & k_replayPressTicksMask;
+    m_runFrames = frames;
+    m_address += 2;
+  }
+  m_runFrames--;
+  outButtonDownFlags = m_runButtonDownFlags;
+  outPressTicks = m_runPressTicks;
+  // Only the first frame of the run has press ticks
+  m_runPressTicks = 0;
+  return true;
+}
+
+void BitWriter::Write(uint32 value, uint8 numBits)
+{
+  while (numBits > 0)
+  {
+    const uint8 numBitsToAdd = Min<uint8>(8 - m_numPendingBits, numBits);
+    m_pendingBits |= (uint8(value) & uint8((1 << numBitsToAdd) - 1)) << m_numPendingBits;
+    m_numPendingBits += numBitsToAdd;
+    value >>= numBitsToAdd;
+    numBits -= numBitsToAdd;
+    if (m_numPendingBits == 8)
+    {
+      WriteByte(m_pendingBits);
+      m_pendingBits = 0;
+      m_numPendingBits = 0;
+    }
+  }
+}
+
+void BitWriter::Finish()
+{
+  if (m_numPendingBits > 0)
+  {
+    WriteByte(m_pendingBits);
+    m_pendingBits = 0;
+    m_numPendingBits = 0;
+  }
+}
+
+void BitWriter::WriteByte(uint8 value)
+{
+  if (m_numBytes < m_maxBytes)
+  {
+    if (m_buffer != nullptr)
+    {
+      m_buffer[m_numBytes] = value;
+    }
+    else
+    {
+      EEPROM.update(m_eepromAddress + m_numBytes, value);
+    }
+  }
+  m_numBytes++;
+}
+
+uint32 BitReader::Read(uint8 numBits)
+{
+  uint32 value = 0;
+  uint8 numBitsRead = 0;
+  while (numBitsRead < numBits)
+  {
+    if (m_numPendingBits == 0)
+    {
+      m_pendingBits = ReadByte();
+      m_numPendingBits = 8;
+    }
+    const uint8 numBitsToTake = Min<uint8>(m_numPendingBits, numBits - numBitsRead);
+    value |= uint32(m_pendingBits & uint8((1 << numBitsToTake) - 1)) << numBitsRead;
+    m_pendingBits = uint16(m_pendingBits) >> numBitsToTake;
+    m_numPendingBits -= numBitsToTake;
+    numBitsRead += numBitsToTake;
+  }
+  return value;
+}
+
+uint8 BitReader::ReadByte()
+{
+  uint8 value = 0;
+  if (m_numBytes < m_maxBytes)
+  {
+    value = (m_buffer != nullptr) ? m_buffer[m_numBytes] : EEPROM.read(m_eepromAddress + m_numBytes);
+  }
+  m_numBytes++;
+  return value;
+}
+
+// static
+void Snapshot::Save(BitWriter& writer)
+{
+  for (uint8 i = 0; i < uint8(PieceIndex::Count); i++)
+  {
+    writer.Write(uint8(g.m_pieceStyle[i]), k_visualStyleBits);
+  }
+  writer.Write(uint8(g.m_shadowStyle), k_visualStyleBits);
+  writer.Write(uint8(g.m_playingState), k_playingStateBits);
+  writer.Write(g.m_playingStateTimer, sizeof(g.m_playingStateTimer) * 8);
+  g.m_grid.Save(writer);
+  g.m_currentPiece.Save(writer);
+  g.m_next.Save(writer);
+  g.m_controller.Save(writer);
+  g.m_gameMode.Save(writer);
+}
+
+// static
+bool Snapshot::Load(BitReader& reader)
+{
+  ResetGame();
+  bool valid = true;
+  for (uint8 i = 0; i < uint8(PieceIndex::Count); i++)
+  {
+    g.m_pieceStyle[i] = VisualStyle(reader.Read(k_visualStyleBits));
+    valid = valid && (g.m_pieceStyle[i] < VisualStyle::Count);
+  }
+  g.m_shadowStyle = VisualStyle(reader.Read(k_visualStyleBits));
+  g.m_playingState = PlayingState(reader.Read(k_playingStateBits));
+  g.m_playingStateTimer = reader.Read(sizeof(g.m_playingStateTimer) * 8);
+  valid = valid && (g.m_shadowStyle < VisualStyle::Count) && (g.m_playingState <= PlayingState::NextPieceDelay);
+  // Everything is read in the order it was saved, and reading stops at the first thing that isn't valid
+  valid = valid && g.m_grid.Load(reader);
+  valid = valid && g.m_currentPiece.Load(reader);
+  valid = valid && g.m_next.Load(reader);
+  if (valid)
+  {
+    g.m_controller.Load(reader);
+  }
+  valid = valid && g.m_gameMode.Load(reader) && !reader.HasOverflowed();
+  if (!valid)
+  {
+    return false;
+  }
+
+  g.m_gameState = GameState::Playing;
+  RedrawScreen();
+  return true;
+}
+
+// static
+uint16 Snapshot::SaveToEeprom()
+{
+  // The header tag is written last, so a snapshot that's only partly written is never loaded
+  EEPROM.update(k_snapshotEepromStart, 0x00);
+  BitWriter writer(uint16(k_snapshotEepromStart + 1), k_snapshotEepromSize - 1);
+  Save(writer);
+  writer.Finish();
+  if (writer.HasOverflowed())
+  {
+    return 0;
+  }
+  EEPROM.update(k_snapshotEepromStart, k_snapshotHeaderTag);
+  return writer.GetNumBytes() + 1;
+}
+
+// static
+bool Snapshot::LoadFromEeprom()
+{
+  if (EEPROM.read(k_snapshotEepromStart) != k_snapshotHeaderTag)
+  {
+    return false;
+  }
+  BitReader reader(uint16(k_snapshotEepromStart + 1), k_snapshotEepromSize - 1);
+  if (!Load(reader))
+  {
+    ResetGame();
+    return false;
+  }
+  return true;
+}
+
+// static
+void Snapshot::EraseFromEeprom()
+{
+  EEPROM.update(k_snapshotEepromStart, 0x00);
+}
+
+void Bot::Start()
+{
+  m_state = State::WaitingForPiece;
+  m_lastButtons = 0;
+  m_piecesPlaced = 0;
+  m_startMillis = millis();
+  m_elapsedMillis = 0;
+}
+
+uint16 Bot::GetPiecesPerSecondX100() const
+{
+  return (m_elapsedMillis > 0) ? uint16((uint32(m_piecesPlaced) * 100000) / m_elapsedMillis) : 0;
+}
+
+uint8 Bot::Update()
+{
+  if (g.m_gameState != GameState::Playing)
+  {
+    Stop();
+    return 0;
+  }
+  m_elapsedMillis = millis() - m_startMillis;
+
+  if (!g.m_currentPiece.IsValidPiece() || (g.m_playingState != PlayingState::MovingPiece))
+  {
+    if (m_state != State::WaitingForPiece)
+    {
+      // The piece that was being searched for or moved has locked
+      m_piecesPlaced++;
+      m_state = State::WaitingForPiece;
+    }
+    m_lastButtons = 0;
+    return 0;
+  }
+
+  if (m_state == State::WaitingForPiece)
+  {
+    // If nothing fits, the piece is dropped where it is
+    m_bestPlacement = (uint8(g.m_currentPiece.GetOrientation()) * k_numPlacementColumns) + uint8(g.m_currentPiece.GetX() + Grid::k_wallWidth);
+    m_bestScore = INT16_MIN;
+    m_placement = 0;
+    m_state = State::Searching;
+  }
+
+  if (m_state == State::Searching)
+  {
+    // The piece keeps falling while the search is spread across frames
+    const uint32 startMicros = micros();
+    do
+    {
+      SearchPlacement(m_placement);
+      m_placement++;
+    } while ((m_placement < k_numPlacements) && ((micros() - startMicros) < k_botSearchMicrosPerFrame));
+
+    if (m_placement < k_numPlacements)
+    {
+      m_lastButtons = 0;
+      return 0;
+    }
+    m_state = State::Moving;
+    m_moveFrames = 0;
+  }
+
+  return GetMoveButtons();
+}
+
+void Bot::SearchPlacement(uint8 placement)
+{
+  const bool useHold = placement >= (k_numPlacements / 2);
+  const PieceOrientation orientation = PieceOrientation((placement / k_numPlacementColumns) % uint8(PieceOrientation::Count));
+  const uint8 pieceX = (placement % k_numPlacementColumns) - Grid::k_wallWidth;
+
+  PieceIndex pieceIndex = g.m_currentPiece.GetPieceIndex();
+  if (useHold)
+  {
+    if (!g.m_currentPiece.IsHoldAvailable())
+    {
+      return;
+    }
+    // Holding for the first time brings out the next piece
+    pieceIndex = g.m_currentPiece.GetHoldPiece();
+    if (pieceIndex == PieceIndex::Invalid)
+    {
+      pieceIndex = g.m_next.PeekPiece(0);
+    }
+  }
+
+  uint8 pieceRows[k_pieceMaskSize];
+  g_pieceData[uint8(pieceIndex)].GetRowMasks(orientation, pieceRows);
+  // Only placements the piece can fall straight into from the top of the grid are considered
+  if (!g.m_grid.DoesPieceMaskFit(pieceX, k_searchStartY, pieceRows))
+  {
+    return;
+  }
+  const uint8 pieceY = g.m_grid.GetPieceMaskLandingY(pieceX, k_searchStartY, pieceRows);
+  const int16 score = ScoreBoard(pieceX, pieceY, pieceRows);
+  if (score > m_bestScore)
+  {
+    m_bestScore = score;
+    m_bestPlacement = placement;
+  }
+}
+
+// static
+int16 Bot::ScoreBoard(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize])
+{
+  // Weights of the usual four-feature heuristic, scaled up to integers
+  constexpr int16 k_linesWeight = 76;
+  constexpr int16 k_heightWeight = -51;
+  constexpr int16 k_holesWeight = -36;
+  constexpr int16 k_bumpinessWeight = -18;
+
+  // Build the rows the placement would leave, leaving out the ones it clears
+  Grid::RowMask rows[k_gridHeight];
+  uint8 numRows = 0;
+  uint8 linesCleared = 0;
+  for (uint8 y = 0; y < k_gridHeight; y++)
+  {
+    Grid::RowMask rowMask = g.m_grid.GetRowMask(y);
+    const uint8 pieceRow = y - pieceY;
+    if (pieceRow < k_pieceMaskSize)
+    {
+      // Same walled row space as Grid::DoesPieceMaskFit, so pieces hanging off the left side shift correctly
+      rowMask |= (Grid::RowMask(pieceRows[pieceRow]) << uint8(pieceX + Grid::k_wallWidth)) >> Grid::k_wallWidth;
+    }
+    if (rowMask == Grid::k_fullRowMask)
+    {
+      linesCleared++;
+    }
+    else
+    {
+      rows[numRows++] = rowMask;
+    }
+  }
+
+  // Walk down from the top to find the skyline and the holes under it
+  uint8 heights[k_gridWidth] = {};
+  uint8 holes = 0;
+  Grid::RowMask coveredColumns = 0;
+  for (uint8 y = numRows; y > 0; y--)
+  {
+    const Grid::RowMask rowMask = rows[y - 1];
+    for (Grid::RowMask emptyCovered = coveredColumns & ~rowMask; emptyCovered != 0; emptyCovered &= emptyCovered - 1)
+    {
+      holes++;
+    }
+    Grid::RowMask columnTops = rowMask & ~coveredColumns;
+    for (uint8 x = 0; columnTops != 0; x++, columnTops >>= 1)
+    {
+      if (columnTops & 0x01)
+      {
+        heights[x] = y;
+      }
+    }
+    coveredColumns |= rowMask;
+  }
+
+  uint8 aggregateHeight = heights[0];
+  uint8 bumpiness = 0;
+  for (uint8 x = 1; x < k_gridWidth; x++)
+  {
+    aggregateHeight += heights[x];
+    bumpiness += (heights[x - 1] > heights[x]) ? (heights[x - 1] - heights[x]) : (heights[x] - heights[x - 1]);
+  }
+
+  return (k_linesWeight * linesCleared) + (k_heightWeight * aggregateHeight) + (k_holesWeight * holes) + (k_bumpinessWeight * bumpiness);
+}
+
+uint8 Bot::GetMoveButtons()
+{
+  const bool useHold = m_bestPlacement >= (k_numPlacements / 2);
+  const PieceOrientation orientation = PieceOrientation((m_bestPlacement / k_numPlacementColumns) % uint8(PieceOrientation::Count));
+  const int8 pieceX = int8(m_bestPlacement % k_numPlacementColumns) - Grid::k_wallWidth;
+
+  // Once the piece is in place, or can't get there, it's soft dropped the rest of the way
+  uint8 buttons = k_softDropButton;
+  if (m_moveFrames < k_botMaxMoveFrames)
+  {
+    m_moveFrames++;
+    const PieceOrientation currentOrientation = g.m_currentPiece.GetOrientation();
+    if (useHold && g.m_currentPiece.IsHoldAvailable())
+    {
+      buttons = k_holdButton;
+    }
+    else if (orientation != currentOrientation)
+    {
+      const bool rotateCcw = uint8(orientation) == ((uint8(currentOrientation) + uint8(PieceOrientation::Count) - 1) % uint8(PieceOrientation::Count));
+      buttons = rotateCcw ? k_rotateCcwButton : k_rotateCwButton;
+    }
+    else if (pieceX < int8(g.m_currentPiece.GetX()))
+    {
+      buttons = k_leftButton;
+    }
+    else if (pieceX > int8(g.m_currentPiece.GetX()))
+    {
+      buttons = k_rightButton;
+    }
+  }
+
+  // Everything but soft drop only happens on the frame its button goes down, so it's let go for a frame between presses
+  if (buttons & m_lastButtons & ~k_softDropButton)
+  {
+    buttons = 0;
+  }
+  m_lastButtons = buttons;
+  return buttons;
+}
+
+void Versus::Start(uint32 randomSeed)
+{
+  m_state = State::Playing;
+  memset(m_sentRows, 0x00, sizeof(m_sentRows));
+  memset(m_opponentRows, 0x00, sizeof(m_opponentRows));
+  m_sendStart = 0;
+  m_sendCount = 0;
+  m_sendSequence = 0;
+  m_sentGarbageTotal = 0;
+  m_receiveState = ReceiveState::Sync;
+  m_pendingGarbage = 0;
+  m_random.SetSeed(randomSeed);
+  m_hasReceived = false;
+  m_sendFullGrid = true;
+  m_needFullGrid = false;
+  m_needsSend = false;
+  m_opponentGridChanged = true;
+}
+
+void Versus::AddLinesCleared(uint8 numLines)
+{
+  if ((m_state != State::Playing) || (numLines == 0))
+  {
+    return;
+  }
+  const uint8 garbage = pgm_read_byte(&k_versusGarbageForLines[numLines - 1]);
+  const uint8 numCancelled = Min(garbage, m_pendingGarbage);
+  m_pendingGarbage -= numCancelled;
+  // Sent with the grid once the stack settles
+  m_sentGarbageTotal += garbage - numCancelled;
+}
+
+bool Versus::OnStackSettled()
+{
+  bool fits = true;
+  if ((m_state == State::Playing) && (m_pendingGarbage > 0))
+  {
+    fits = g.m_grid.AddGarbageRows(m_pendingGarbage, m_random.NextInRange(k_gridWidth), BlockIndex::X);
+    m_pendingGarbage = 0;
+  }
+  QueueMessage();
+  return fits;
+}
+
+void Versus::OnGameOver()
+{
+  if (m_state == State::Playing)
+  {
+    m_state = State::Lost;
+    QueueMessage();
+  }
+}
+
+void Versus::Update()
+{
+  if (m_needsSend)
+  {
+    QueueMessage();
+  }
+}
+
+void Versus::QueueMessage()
+{
+  uint8 flags = 0;
+  if (m_state == State::Lost)
+  {
+    flags |= k_flagToppedOut;
+  }
+  if (m_sendFullGrid)
+  {
+    flags |= k_flagFullGrid;
+  }
+  if (m_needFullGrid)
+  {
+    flags |= k_flagNeedFullGrid;
+  }
+
+  // A full grid leaves out empty rows instead of unchanged ones
+  uint8 changedRows[k_visibleGridHeight];
+  uint8 numRows = 0;
+  for (uint8 y = 0; y < k_visibleGridHeight; y++)
+  {
+    const Grid::RowMask baseRow = m_sendFullGrid ? 0 : m_sentRows[y];
+    if (g.m_grid.GetRowMask(y) != baseRow)
+    {
+      changedRows[numRows++] = y;
+    }
+  }
+
+  uint8 payload[k_maxPayloadBytes];
+  BitWriter writer(payload, sizeof(payload));
+  writer.Write(flags, k_flagBits);
+  writer.Write(uint8(m_sendSequence + 1), 8);
+  writer.Write(m_sentGarbageTotal, 8);
+  writer.Write(numRows, k_numRowsBits);
+  for (uint8 i = 0; i < numRows; i++)
+  {
+    const uint8 y = changedRows[i];
+    writer.Write(y, k_rowBits);
+    writer.Write(g.m_grid.GetRowMask(y), k_gridWidth);
+  }
+  writer.Finish();
+  Assert(!writer.HasOverflowed());
+
+  const uint8 numBytes = writer.GetNumBytes();
+  if (m_sendCount + k_framingBytes + numBytes > k_versusSendQueueSize)
+  {
+    // The serial port is behind. Nothing is marked as sent, so the next try includes everything this one had.
+    m_needsSend = true;
+    return;
+  }
+  QueueByte(k_versusSyncByte);
+  QueueByte(numBytes);
+  uint8 checksum = numBytes;
+  for (uint8 i = 0; i < numBytes; i++)
+  {
+    QueueByte(payload[i]);
+    checksum += payload[i];
+  }
+  QueueByte(checksum);
+
+  m_sendSequence++;
+  for (uint8 y = 0; y < k_visibleGridHeight; y++)
+  {
+    m_sentRows[y] = g.m_grid.GetRowMask(y);
+  }
+  m_sendFullGrid = false;
+  m_needsSend = false;
+}
+
+void Versus::QueueByte(uint8 value)
+{
+  Assert(m_sendCount < k_versusSendQueueSize);
+  m_sendQueue[(m_sendStart + m_sendCount) % k_versusSendQueueSize] = value;
+  m_sendCount++;
+}
+
+uint8 Versus::PopByteToSend()
+{
+  Assert(m_sendCount > 0);
+  const uint8 value = m_sendQueue[m_sendStart];
+  m_sendStart = (m_sendStart + 1) % k_versusSendQueueSize;
+  m_sendCount--;
+  return value;
+}
+
+void Versus::ReceiveByte(uint8 value)
+{
+  switch (m_receiveState)
+  {
+    case ReceiveState::Sync:
+      if (value == k_versusSyncByte)
+      {
+        m_receiveState = ReceiveState::Length;
+      }
+      break;
+    case ReceiveState::Length:
+      if ((value == 0) || (value > k_maxPayloadBytes))
+      {
+        // Not really the start of a message, but this byte could be
+        m_receiveState = (value == k_versusSyncByte) ? ReceiveState::Length : ReceiveState::Sync;
+        break;
+      }
+      m_receiveLength = value;
+      m_receiveCount = 0;
+      m_receiveChecksum = value;
+      m_receiveState = ReceiveState::Payload;
+      break;
+    case ReceiveState::Payload:
+      m_receiveBuffer[m_receiveCount++] = value;
+      m_receiveChecksum += value;
+      if (m_receiveCount == m_receiveLength)
+      {
+        m_receiveState = ReceiveState::Checksum;
+      }
+      break;
+    case ReceiveState::Checksum:
+      // A corrupt message is dropped, and shows up as a gap in the sequence numbers
+      if (value == m_receiveChecksum)
+      {
+        ProcessMessage();
+      }
+      m_receiveState = ReceiveState::Sync;
+      break;
+  }
+}
+
+void Versus::ProcessMessage()
+{
+  BitReader reader(m_receiveBuffer, m_receiveLength);
+  const uint8 flags = reader.Read(k_flagBits);
+  const uint8 sequence = reader.Read(8);
+  const uint8 garbageTotal = reader.Read(8);
+  const uint8 numRows = reader.Read(k_numRowsBits);
+
+  // The first message only says where the other player's total starts from
+  if (m_hasReceived && (m_state == State::Playing))
+  {
+    m_pendingGarbage = Min<uint8>(m_pendingGarbage + uint8(garbageTotal - m_receivedGarbageTotal), k_gridHeight);
+  }
+  m_receivedGarbageTotal = garbageTotal;
+
+  if (flags & k_flagNeedFullGrid)
+  {
+    m_sendFullGrid = true;
+    m_needsSend = true;
+  }
+
+  if (flags & k_flagFullGrid)
+  {
+    memset(m_opponentRows, 0x00, sizeof(m_opponentRows));
+    m_needFullGrid = false;
+  }
+  else if (!m_hasReceived || (sequence != uint8(m_receivedSequence + 1)))
+  {
+    // The rows that changed in the missed messages are wrong until a full grid arrives. Deltas are still applied in
+    // the meantime, since they're more up to date than what's there.
+    if (!m_needFullGrid)
+    {
+      m_needFullGrid = true;
+      m_needsSend = true;
+    }
+  }
+  for (uint8 i = 0; (i < numRows) && !reader.HasOverflowed(); i++)
+  {
+    const uint8 y = reader.Read(k_rowBits);
+    const Grid::RowMask rowMask = reader.Read(k_gridWidth);
+    if (y < k_visibleGridHeight)
+    {
+      m_opponentRows[y] = rowMask;
+    }
+  }
+  m_opponentGridChanged = true;
+  m_receivedSequence = sequence;
+  m_hasReceived = true;
+
+  if ((flags & k_flagToppedOut) && (m_state == State::Playing))
+  {
+    m_state = State::Won;
+  }
+}
+
+void Versus::DrawOpponentGrid()
+{
+  if (!m_opponentGridChanged && !g_display.IsDirty(k_previewLeft, 2 * k_gridWidth, k_previewFirstPage, k_displayNumPages - 1))
+  {
+    return;
+  }
+  m_opponentGridChanged = false;
+  // Each page holds 4 rows, with the top row of the page at the top of the byte
+  for (uint8 page = 0; page < k_previewNumPages; page++)
+  {
+    const uint8 topRow = k_visibleGridHeight - 1 - (page * 4);
+    uint8* column = &arduboy.sBuffer[((k_previewFirstPage + page) * WIDTH) + k_previewLeft];
+    for (uint8 x = 0; x < k_gridWidth; x++)
+    {
+      uint8 pixels = 0;
+      for (uint8 i = 0; i < 4; i++)
+      {
+        if (m_opponentRows[topRow - i] & (Grid::RowMask(1) << x))
+        {
+          pixels |= 0x03 << (2 * i);
+        }
+      }
+      *column++ = pixels;
+      *column++ = pixels;
+    }
+  }
+  g_display.MarkDirty(k_previewLeft, 2 * k_gridWidth, k_previewFirstPage, k_displayNumPages - 1);
+}
+
+
+void Input::Update(uint8 buttonDownFlags, GameTicks pressTicks)
+{
+  m_previousButtonDownFlags = m_currentButtonDownFlags;
+  m_currentButtonDownFlags = buttonDownFlags;
+  m_pressTicks = pressTicks;
+}
 
-void Global::Loop()
+// static
+uint8 Input::ReadButtons(ButtonSampler& sampler, GameTicks& outPressTicks)
 {
-  m_input.Update();
+  ProfileSection(Input);
+  uint8 pressedFlags = 0x00;
+  bool movePressed = false;
+  uint8 movePressSampleTime = 0;
+  ButtonEvent event = {};
+  while (sampler.PopEvent(event))
+  {
+    const uint8 eventPressedFlags = event.changedFlags & event.buttonDownFlags;
+    pressedFlags |= eventPressedFlags;
+    if (eventPressedFlags & (k_leftButton | k_rightButton))
+    {
+      movePressed = true;
+      movePressSampleTime = event.sampleTime;
+    }
+  }
+  // Taps that were over before this frame still count as being down for it, so they aren't missed
+  const uint8 buttonDownFlags = sampler.GetButtonDownFlags() | pressedFlags;
 
-  switch (g_gameState)
+  outPressTicks = 0;
+  if (movePressed)
   {
-    case GameState::MainMenu:
-      g_menus.Loop();
-      break;
-    case GameState::Playing:
-      PlayingLoop();
-      break;
-    case GameState::GameOver:
-      GameOverLoop();
-      break;
+    // Read after the queue is empty, so it's never older than the press
+    const uint8 samplesSincePress = sampler.GetSampleTime() - movePressSampleTime;
+    const uint32 ticksSincePress = (uint32(samplesSincePress) * k_buttonSampleMicros * k_gameTicksPerSecond) / 1000000;
+    // The press can only look older than a frame if the last frame ran long
+    outPressTicks = Min<uint32>(ticksSincePress, k_gameTicksPerFrame - 1);
   }
+  return buttonDownFlags;
 }
 
+// Picks the random seed for a new game
+uint32 GenerateRandomSeed()
+{
+#ifdef BENCHMARK_BUILD
+  // Benchmarks need the same pieces every run
+  return k_benchmarkRandomSeed;
+#else // #ifdef BENCHMARK_BUILD
+  return g.GenerateRandomSeed();
+#endif // #else // #ifdef BENCHMARK_BUILD
+}
 
-void Input::Update()
+uint8 Random::NextInRange(uint8 range)
 {
-  m_previousButtonDownFlags = m_currentButtonDownFlags;
-  m_currentButtonDownFlags = 0x00;
-  for (uint8 i = 0; i < 8; i++)
+  Assert(range > 0);
+  // Smallest all-ones mask that covers every value in the range
+  uint8 mask = range - 1;
+  mask |= mask >> 1;
+  mask |= mask >> 2;
+  mask |= mask >> 4;
+  // At worst, half of the values get rejected, so this almost never takes more than a few tries
+  while (true)
   {
-    uint8 buttonFlag = 1 << i;
-    if (SampleRawInput(buttonFlag))
+    // The top bits of xorshift are a little better than the bottom ones
+    const uint8 value = uint8(Next32() >> 24) & mask;
+    if (value < range)
     {
-      m_currentButtonDownFlags |= buttonFlag;
+      return value;
     }
   }
 }
 
-// static
-bool Input::SampleRawInput(uint8 buttons)
+uint32 Global::GenerateRandomSeed()
 {
-  return arduboy.pressed(buttons);
+  // Hardware noise is mixed with the timing of every button press so far
+  m_entropy.Mix(arduboy.generateRandomSeed());
+  return m_entropy.Next32();
 }
 
 void ResetGame()
 {
   arduboy.clear();
+  g_display.MarkAllDirty();
+  g.ForceFullFrame();
+  g.m_gameOverText.MarkDirty();
+  g.m_pausedText.MarkDirty();
 
-  g_grid.Clear();
-  g_gameMode.Reset();
+  g.m_grid.Clear();
+  g.m_gameMode.Reset();
   // TODO: This should be incorporated into GameMode
-  g_gameState = GameState::MainMenu;
+  g.m_gameState = GameState::MainMenu;
 
-  g_next.Reset();
-  g_currentPiece.Reset();
-  g_controller.Reset();
+  g.m_next.Reset(GenerateRandomSeed());
+  g.m_currentPiece.Reset();
+  g.m_controller.Reset();
 
-  g_menus.Reset();
+  g.m_menus.Reset();
+  g.m_versus.Stop();
 
-  g_playingState = PlayingState::MovingPiece;
-  g_playingStateTimer = 0;  // Unused at the beginning
+  g.m_playingState = PlayingState::MovingPiece;
+  g.m_playingStateTimer = 0;  // Unused at the beginning
+}
+
+// Draws everything that normally only gets drawn when it changes.
+// Needed after something else, like a debugging overlay, has drawn over the game.
+void RedrawScreen()
+{
+  arduboy.clear();
+  g_display.MarkAllDirty();
+  g.ForceFullFrame();
+  g.m_menus.MarkAllDirty();
+  g.m_gameOverText.MarkDirty();
+  g.m_pausedText.MarkDirty();
+  if (g.m_gameState != GameState::MainMenu)
+  {
+    g.m_gameMode.MarkStatsDirty();
+    g.m_grid.MarkAllDirty();
+    g.m_next.Draw();
+    g.m_currentPiece.DrawHold();
+  }
 }
 
 void Menus::Loop()
@@ -908,22 +4693,30 @@ void Menus::Loop()
     case 0: // "Play"
       if (input.WasButtonPressed(A_BUTTON) | input.WasButtonPressed(B_BUTTON))
       {
-        // TODO: Clean this up! There needs to be a better way to manage this state
-        // Dirty workaround since m_startingLevel and m_visualStyle get cleared in ResetGame()
-        for (uint8 i = 0; i < uint8(PieceIndex::Count); i++)
+        // Settings are copied out since m_startingLevel and m_visualStyle get cleared in ResetGame()
+        GameSettings settings;
+        settings.randomSeed = GenerateRandomSeed();
+        settings.startingLevel = m_startingLevel;
+        settings.pieceStyle = m_visualStyle;
+        settings.shadowStyle = m_shadowStyle;
+        settings.initialButtonDownFlags = input.GetButtonDownFlags();
+        if (m_playMode == PlayMode::Versus)
         {
-          g_pieceStyle[i] = m_visualStyle;
+          g.StartVersusGame(settings);
+        }
+        else
+        {
+          g.StartGame(settings, m_recordReplay);
+          if (m_playMode == PlayMode::Bot)
+          {
+            g.StartBot();
+          }
         }
-        g_shadowStyle = m_shadowStyle;
-        
-        uint8 startingLevel = m_startingLevel;
-        ResetGame();
-        g_gameMode.SetLevel(startingLevel);
-        g_gameState = GameState::Playing;
       }
       break;
       
     case 1: // "Mode"
+      m_playMode = PlayMode(((uint8(m_playMode) + uint8(PlayMode::Count) + goForward - goBack)) % uint8(PlayMode::Count));
       break;
       
     case 2: // "Level"
@@ -944,43 +4737,108 @@ void Menus::Loop()
     case 4: // "Shadow"
       m_shadowStyle = VisualStyle(((uint8(m_shadowStyle) + uint8(VisualStyle::Count) + goForward - goBack)) % uint8(VisualStyle::Count));
       break;
+
+    case 5: // "Blocks"
+      // Block size only changes how the grid is drawn, so it isn't part of GameSettings and works with replays too
+      if (goForward || goBack)
+      {
+        g.m_viewport.SetLargeBlocks(!g.m_viewport.HasLargeBlocks());
+      }
+      break;
+
+    case 6: // "Record"
+      if (goForward || goBack)
+      {
+        m_recordReplay = !m_recordReplay;
+      }
+      break;
+
+    case 7: // "Replay"
+      if (input.WasButtonPressed(A_BUTTON) | input.WasButtonPressed(B_BUTTON))
+      {
+        // Nothing happens if there isn't a replay saved
+        g.StartReplay();
+      }
+      break;
   }
 
-  arduboy.clear();
-  // TODO: Clean this up. State transitions should be cleaner and not have to rely on hacks like this to clear the screen
-  // Early-out if we're not in the main menu game state anymore.
-  if (g_gameState != GameState::MainMenu)
+  // Starting a game clears the screen, and the game draws everything from then on
+  if (g.m_gameState != GameState::MainMenu)
   {
     return;
   }
 
-  for (uint8 i = 0; i < countof(k_menuItems); i++)
+  for (uint8 i = 0; i < k_numLines; i++)
   {
-    arduboy.print(m_selectedIndex == i ? F("> ") : F("   "));
-    arduboy.print((__FlashStringHelper*)pgm_read_word(&(k_menuItems[i])));
-    switch (i)
+    const uint8 lineState = GetLineState(i);
+    // The line might also have been drawn over by something else, like the profiler overlay
+    if ((lineState != m_drawnLineStates[i]) || g_display.IsDirty(0, WIDTH, i, i))
     {
-      case 0: // Play
-        break;
-      case 1: // Mode
-        break;
-      case 2: // Level
-        arduboy.print(F(" ["));
-        arduboy.print(m_startingLevel);
-        arduboy.print(F("]"));
-        break;
-      case 3: // Skin
-        arduboy.print(F(" ["));
-        arduboy.print((__FlashStringHelper*)pgm_read_word(&(k_styleNames[uint8(m_visualStyle)])));
-        arduboy.print(F("]"));
-        break;
-      case 4: // Shadow
-        arduboy.print(F(" ["));
-        arduboy.print((__FlashStringHelper*)pgm_read_word(&(k_styleNames[uint8(m_shadowStyle)])));
-        arduboy.print(F("]"));
-        break;
+      DrawLine(i);
+      m_drawnLineStates[i] = lineState;
     }
-    arduboy.println();
+  }
+}
+
+uint8 Menus::GetLineState(uint8 line) const
+{
+  uint8 lineState = 0;
+  switch (line)
+  {
+    case 1: lineState = uint8(m_playMode); break;
+    case 2: lineState = m_startingLevel; break;
+    case 3: lineState = uint8(m_visualStyle); break;
+    case 4: lineState = uint8(m_shadowStyle); break;
+    case 5: lineState = g.m_viewport.HasLargeBlocks(); break;
+    case 6: lineState = m_recordReplay; break;
+  }
+  if (line == m_selectedIndex)
+  {
+    lineState |= k_lineStateSelected;
+  }
+  return lineState;
+}
+
+void Menus::DrawLine(uint8 line) const
+{
+  // Lines can get shorter, so the old one is erased first
+  memset(&arduboy.sBuffer[line * WIDTH], 0, WIDTH);
+  g_display.MarkDirty(0, WIDTH, line, line);
+  arduboy.setCursor(0, line * k_fontLineHeight);
+  arduboy.print(m_selectedIndex == line ? F("> ") : F("   "));
+  arduboy.print((__FlashStringHelper*)pgm_read_word(&(k_menuItems[line])));
+  switch (line)
+  {
+    case 0: // Play
+      break;
+    case 1: // Mode
+      arduboy.print(F(" ["));
+      arduboy.print((__FlashStringHelper*)pgm_read_word(&(k_playModeNames[uint8(m_playMode)])));
+      arduboy.print(F("]"));
+      break;
+    case 2: // Level
+      arduboy.print(F(" ["));
+      arduboy.print(m_startingLevel);
+      arduboy.print(F("]"));
+      break;
+    case 3: // Skin
+      arduboy.print(F(" ["));
+      arduboy.print((__FlashStringHelper*)pgm_read_word(&(k_styleNames[uint8(m_visualStyle)])));
+      arduboy.print(F("]"));
+      break;
+    case 4: // Shadow
+      arduboy.print(F(" ["));
+      arduboy.print((__FlashStringHelper*)pgm_read_word(&(k_styleNames[uint8(m_shadowStyle)])));
+      arduboy.print(F("]"));
+      break;
+    case 5: // Blocks
+      arduboy.print(g.m_viewport.HasLargeBlocks() ? F(" [4x4]") : F(" [3x3]"));
+      break;
+    case 6: // Record
+      arduboy.print(m_recordReplay ? F(" [On]") : F(" [Off]"));
+      break;
+    case 7: // Replay
+      break;
   }
 }
 
@@ -1000,7 +4858,13 @@ void Menus::ProcessInput()
 
 void PlayingLoop()
 {
-  switch (g_playingState)
+  if (g.CanPause() && g.GetInput().WereButtonsPressed(k_pauseButtons))
+  {
+    g.Pause();
+    return;
+  }
+
+  switch (g.m_playingState)
   {
     case PlayingState::MovingPiece:
       PlayingLoopMovingPiece();
@@ -1013,11 +4877,46 @@ void PlayingLoop()
       break;
   }
 
-  // TODO: Don't draw the entire grid every frame when it hasn't changed
-  g_grid.Draw();
-  g_currentPiece.DrawShadow();
-  g_currentPiece.Draw();
-  g_gameMode.DrawStats();
+  DrawPlayfield();
+}
+
+void PausedLoop()
+{
+  if (g.GetInput().WasButtonPressed(k_resumeButton))
+  {
+    g.Unpause();
+    return;
+  }
+
+  // Draws the game the first time after it's resumed from EEPROM. After that, nothing changes unless the view is still scrolling.
+  DrawPlayfield();
+  constexpr uint8 k_pausedX = (k_screenWidth - (6 * 5)) / 2;
+  constexpr uint8 k_pausedY = (k_screenHeight - 7) / 2;
+  g.m_pausedText.Draw(arduboy, k_pausedX, k_pausedY, F("Paused"));
+}
+
+void DrawPlayfield()
+{
+  if (!g.IsDrawingEnabled())
+  {
+    return;
+  }
+  // The view only needs to follow the piece when it doesn't fit the whole grid on screen
+  if (g.m_currentPiece.IsValidPiece())
+  {
+    g.m_viewport.ScrollTowards(g.m_currentPiece.GetY() + k_pieceMaskSize - 1);
+  }
+  g.m_grid.PrepareDraw();
+  // Only the parts of the grid that changed are redrawn, so the piece has to erase itself first
+  g.m_currentPiece.PrepareDraw();
+  g.m_grid.Draw();
+  g.m_currentPiece.DrawShadow();
+  g.m_currentPiece.Draw();
+  g.m_gameMode.DrawStats();
+  if (g.m_versus.IsPlaying())
+  {
+    g.m_versus.DrawOpponentGrid();
+  }
 }
 
 void PlayingLoopMovingPiece()
@@ -1026,201 +4925,764 @@ void PlayingLoopMovingPiece()
   if (g.GetInput().WasButtonPressed(k_holdButton))
   {
     // Hold is allowed to be used once per drop. It won't do anything if it's already been used.
-    PieceIndex knownNextPiece = g_currentPiece.TryHold();
+    PieceIndex knownNextPiece = g.m_currentPiece.TryHold();
     if (knownNextPiece != PieceIndex::Invalid)
     {
       // Swap out current piece with next
-      const bool spawnSuccess = g_currentPiece.SpawnNewPiece(knownNextPiece);
+      const bool spawnSuccess = g.m_currentPiece.SpawnNewPiece(knownNextPiece);
       if (!spawnSuccess)
       {
         // Game Over because of BlockOut
         // Getting blocked-out because of switching to your held piece is possible, but likely very rare
-        g_gameState = GameState::GameOver;
+        g.m_gameState = GameState::GameOver;
       }
     }
   }
   
-  if (g_currentPiece.IsValidPiece())
+  if (g.m_currentPiece.IsValidPiece())
+  {
+    g.m_controller.ProcessInput();
+    g.m_currentPiece.MoveDown(g.m_controller.IsSoftDrop());
+    return;
+  }
+
+  // The piece has locked down
+  const uint8 numFullLines = g.m_grid.BeginClearingFullLines();
+  g.m_versus.AddLinesCleared(numFullLines);
+  if (numFullLines > 0)
   {
-    g_controller.ProcessInput();
-    g_currentPiece.MoveDown(g_controller.IsSoftDrop());
+    // Full lines are animated away before the stack collapses
+    g.m_playingState = PlayingState::ClearingLines;
+    g.m_playingStateTimer = k_lineClearAnimationTicks;
   }
   else
   {
-    // Test for, and remove full lines
-    g_grid.ProcessFullLines();
     // Get ready for the next piece
-    g_playingState = PlayingState::NextPieceDelay;
-    g_playingStateTimer = k_ticksBetweenLockDownAndNextPiece;
+    g.m_playingState = PlayingState::NextPieceDelay;
+    g.m_playingStateTimer = k_ticksBetweenLockDownAndNextPiece;
   }
 }
 
 void PlayingLoopClearingLines()
 {
-  
+  if (g.m_playingStateTimer > k_gameTicksPerFrame)
+  {
+    g.m_playingStateTimer -= k_gameTicksPerFrame;
+    // Erase the lines from the middle out, finishing a couple of frames before the collapse starts
+    constexpr uint8 k_halfWidth = k_gridWidth / 2;
+    const uint8 elapsedTicks = k_lineClearAnimationTicks - g.m_playingStateTimer;
+    const uint8 numErasedPairs = ((uint16(elapsedTicks) * k_halfWidth) + k_lineClearAnimationTicks - 1) / k_lineClearAnimationTicks;
+    const Grid::RowMask erasedColumns = ((Grid::RowMask(1) << (2 * numErasedPairs)) - 1) << (k_halfWidth - numErasedPairs);
+    g.m_grid.SetClearedColumns(erasedColumns);
+  }
+  else
+  {
+    // One line is removed per frame so a Tetris costs no more in a single frame than a single does.
+    // The screen can only be shifted if it's about to be drawn and the piece isn't on it.
+    const bool shiftScreen = g.IsDrawingEnabled() && !g.m_currentPiece.IsDrawn();
+    if (!g.m_grid.CollapseClearedLine(shiftScreen))
+    {
+      // Clearing the lines took longer than the delay for a piece that doesn't clear any
+      SpawnNextPiece();
+    }
+  }
 }
 
 void PlayingLoopNextPieceDelay()
 {
-  if (g_playingStateTimer > k_gameTicksPerFrame)
+  if (g.m_playingStateTimer > k_gameTicksPerFrame)
   {
     // Count down timer to spawn next piece
-    g_playingStateTimer -= k_gameTicksPerFrame;
+    g.m_playingStateTimer -= k_gameTicksPerFrame;
+  }
+  else
+  {
+    SpawnNextPiece();
+  }
+}
+
+void SpawnNextPiece()
+{
+  // Garbage from the other player is only added between pieces, so it never moves the piece being played
+  const bool garbageFits = !g.m_versus.IsPlaying() || g.m_versus.OnStackSettled();
+  // Spawn a new piece from the default randomization system
+  const bool spawnSuccess = garbageFits && g.m_currentPiece.SpawnNewPiece();
+  if (!spawnSuccess)
+  {
+    // Game Over because of BlockOut, or garbage pushing the stack off the top
+    g.m_gameState = GameState::GameOver;
+  }
+  g.m_playingState = PlayingState::MovingPiece;
+}
+
+void GameOverLoop()
+{
+  constexpr uint8 k_gameOverX = (k_screenWidth - (9 * 5)) / 2;
+  constexpr uint8 k_gameOverY = (k_screenHeight - 7) / 2;
+  constexpr uint8 k_youWinX = (k_screenWidth - (7 * 5)) / 2;
+  constexpr uint8 k_replayTruncatedX = (k_screenWidth - (16 * 5)) / 2;
+  bool drewGameOver;
+  if (g.m_versus.HasWon())
+  {
+    drewGameOver = g.m_gameOverText.Draw(arduboy, k_youWinX, k_gameOverY, F("You Win"));
+  }
+  else if (g.WasReplayTruncated())
+  {
+    // The replay filled the EEPROM before its game ended, so this isn't really where the game ended
+    drewGameOver = g.m_gameOverText.Draw(arduboy, k_replayTruncatedX, k_gameOverY, F("Replay Truncated"));
+  }
+  else
+  {
+    drewGameOver = g.m_gameOverText.Draw(arduboy, k_gameOverX, k_gameOverY, F("Game Over"));
+  }
+
+  // The bot's score can't change after the game is over, so it only needs drawing along with the message
+  const Bot& bot = g.GetBot();
+  if (drewGameOver && bot.HasPlayed())
+  {
+    // Pieces per second the bot managed to play at
+    const uint16 piecesPerSecondX100 = bot.GetPiecesPerSecondX100();
+    constexpr uint8 k_ppsX = (k_screenWidth - (8 * 5)) / 2;
+    constexpr uint8 k_ppsY = k_gameOverY + 10;
+    arduboy.setCursorX(k_ppsX);
+    arduboy.setCursorY(k_ppsY);
+    arduboy.print(F("PPS "));
+    arduboy.print(piecesPerSecondX100 / 100);
+    arduboy.print(F("."));
+    arduboy.print((piecesPerSecondX100 / 10) % 10);
+    arduboy.print(piecesPerSecondX100 % 10);
+    g_display.MarkRectDirty(k_ppsX, k_ppsY, arduboy.getCursorX() - k_ppsX, k_fontLineHeight);
+  }
+
+  if (g.GetInput().WasButtonReleased(A_BUTTON) || g.GetInput().WasButtonReleased(B_BUTTON))
+  {
+    ResetGame();
+  }
+}
+
+// Most blocks one call to DrawBlockStrip() can draw, one for each bit of its 'cellMask'
+constexpr uint8 k_maxBlockStripCount = 16;
+
+// Draws a horizontal strip of 3x3 blocks straight into the frame buffer
+// blocks : Blocks to draw, left to right
+// count : Number of blocks in the strip
+// cellMask : Only blocks whose bit is set are drawn. Bit 0 is the left-most block.
+// left, top : Screen position of the top-left pixel of the first block
+// Produces the same pixels as clearing each block with fillRect and then drawing its sprite,
+// but without going through the general-purpose sprite code.
+// 'blockSize' is the width and height of the blocks; either k_blockWidth or k_largeBlockSize
+static void DrawBlockStrip(const BlockIndex* blocks, uint8 count, uint16 cellMask, uint8 left, uint8 top, uint8 blockSize)
+{
+  DebugStack;
+  static_assert((k_blockWidth == 3) && (k_blockHeight == 3), "BlockSprites are 3x3 blocks");
+  constexpr uint8 k_blockSpriteDataOffset = 2;  // Skip width and height
+  Assert((blockSize == k_blockWidth) || (blockSize == k_largeBlockSize));
+  Assert(top < k_screenHeight);
+  const uint8* const sprites = (blockSize == k_largeBlockSize) ? LargeBlockSprites : BlockSprites;
+  const uint8 blockColumnMask = (1 << blockSize) - 1;
+
+  // A block is at most 4 pixels tall, so it can straddle two 8-pixel pages. Multiplying a sprite column by
+  // (1 << shift) puts the bits for the upper page in the low byte and the bits for the lower page in the high byte.
+  const uint8 page = top / 8;
+  const uint8 shift = top & 0x07;
+  const uint8 multiplier = uint8(1) << shift;
+  const uint16 shiftedMask = uint16(blockColumnMask) * multiplier;
+  const uint8 keepMask0 = ~uint8(shiftedMask);
+  // The lower page is skipped when the block doesn't reach into it, or it's off the bottom of the screen
+  const uint8 keepMask1 = ~uint8(shiftedMask >> 8);
+  const bool drawLowerPage = (keepMask1 != 0xFF) && (page + 1 < k_screenHeight / 8);
+  uint8* const page0 = &arduboy.sBuffer[page * k_screenWidth];
+  uint8* const page1 = page0 + k_screenWidth;
+
+  uint8 x = left;
+  uint8 dirtyLeft = k_screenWidth;
+  uint8 dirtyRight = 0;
+  for (uint8 i = 0; i < count; i++)
+  {
+    if (cellMask & (uint16(1) << i))
+    {
+      Assert(blocks[i] >= BlockIndex::Empty && blocks[i] < BlockIndex::Count);
+      Assert(x + blockSize <= k_screenWidth);
+      dirtyLeft = Min(dirtyLeft, x);
+      dirtyRight = x + blockSize;
+      const uint8* sprite = &sprites[k_blockSpriteDataOffset + (uint8(blocks[i]) * blockSize)];
+      for (uint8 column = 0; column < blockSize; column++)
+      {
+        const uint16 shifted = uint16(pgm_read_byte(sprite + column)) * multiplier;
+        page0[x + column] = (page0[x + column] & keepMask0) | uint8(shifted);
+        if (drawLowerPage)
+        {
+          page1[x + column] = (page1[x + column] & keepMask1) | uint8(shifted >> 8);
+        }
+      }
+    }
+    x += blockSize;
+  }
+  if (dirtyLeft < dirtyRight)
+  {
+    g_display.MarkDirty(dirtyLeft, dirtyRight - dirtyLeft, page, drawLowerPage ? page + 1 : page);
+  }
+}
+
+// Moves the pixels above 'bottom' in a range of columns down by 'distance' pixels, leaving black at the top.
+// The pixels from 'bottom' down don't change, and the 'distance' pixels right above 'bottom' are overwritten.
+static void ShiftScreenColumnsDown(uint8 left, uint8 width, uint8 bottom, uint8 distance)
+{
+  Assert((distance > 0) && (distance < 8) && (bottom >= distance) && (bottom <= k_screenHeight));
+  // The last page is only partly shifted; bits from 'bottom' down are kept as they are
+  const uint8 lastPage = (bottom - 1) / 8;
+  const uint8 keepMask = uint8(0xFF << (((bottom - 1) & 0x07) + 1));
+  for (uint8 x = left; x < left + width; x++)
+  {
+    // Bit 0 is the top of a page, so moving down shifts left and carries into the next page
+    uint8* pageByte = &arduboy.sBuffer[x];
+    uint8 carry = 0;
+    for (uint8 page = 0; page < lastPage; page++)
+    {
+      const uint8 bits = *pageByte;
+      *pageByte = (bits << distance) | carry;
+      carry = bits >> (8 - distance);
+      pageByte += k_screenWidth;
+    }
+    const uint8 bits = *pageByte;
+    *pageByte = (((bits << distance) | carry) & ~keepMask) | (bits & keepMask);
+  }
+  g_display.MarkDirty(left, width, 0, lastPage);
+}
+
+// Moves the pixels above 'bottom' in a range of columns up by 'distance' pixels, leaving black right above 'bottom'.
+// The pixels from 'bottom' down don't change, and the top 'distance' pixels are lost.
+static void ShiftScreenColumnsUp(uint8 left, uint8 width, uint8 bottom, uint8 distance)
+{
+  Assert((distance > 0) && (distance < 8) && (bottom >= distance) && (bottom <= k_screenHeight));
+  const uint8 lastPage = (bottom - 1) / 8;
+  const uint8 keepMask = uint8(0xFF << (((bottom - 1) & 0x07) + 1));
+  for (uint8 x = left; x < left + width; x++)
+  {
+    // Moving up shifts right, and carries the top of each page into the bottom of the page above it
+    uint8* pageByte = &arduboy.sBuffer[(lastPage * k_screenWidth) + x];
+    const uint8 lastBits = *pageByte;
+    const uint8 movingBits = lastBits & ~keepMask;
+    *pageByte = (movingBits >> distance) | (lastBits & keepMask);
+    uint8 carry = movingBits << (8 - distance);
+    for (uint8 page = lastPage; page > 0; page--)
+    {
+      pageByte -= k_screenWidth;
+      const uint8 bits = *pageByte;
+      *pageByte = (bits >> distance) | carry;
+      carry = bits << (8 - distance);
+    }
+  }
+  g_display.MarkDirty(left, width, 0, lastPage);
+}
+
+#ifdef DEBUGGING_ENABLED
+template <uint8 t_width, uint8 t_height>
+void GridT<t_width, t_height>::DebugPrint(const char* msg) const
+{
+  if (!IsDebugSerialAvailable())
+  {
+    return;
+  }
+  Serial.print(__FUNCTION__);
+  Serial.println(msg);
+  for (uint8 y = 0; y < t_height; y++)
+  {
+    for (uint8 x = 0; x < t_width; x++)
+    {
+      Serial.print(uint8(Get(x, y)));
+    }
+    Serial.println();
+  }
+  Serial.println();
+}
+#endif // #ifdef DEBUGGING_ENABLED
+
+void Viewport::ScrollTowards(uint8 topRow)
+{
+  // Rows above the visible part of the grid never need to be shown
+  topRow = Min<uint8>(topRow, k_visibleGridHeight - 1);
+  const uint8 numRowsInView = (GetBottom() / m_blockSize) + 1;
+  const uint8 targetRow = (topRow >= numRowsInView) ? (topRow + 1 - numRowsInView) : 0;
+  // One row per frame keeps every scroll a single shift of the screen
+  if (targetRow > m_cameraRow)
+  {
+    m_cameraRow++;
+  }
+  else if (targetRow < m_cameraRow)
+  {
+    m_cameraRow--;
+  }
+}
+
+template <uint8 t_width, uint8 t_height>
+void GridT<t_width, t_height>::Draw()
+{
+  DebugStack;
+  ProfileSection(GridDraw);
+
+  // Hack to make the grid shake slightly when a piece is locked in
+  // Not sure how much I like the visuals... I definitely don't like how it's implemented
+  uint8 gridBottom = g.m_viewport.GetBottom();
+  constexpr uint8 numFramesShift = 1;
+  if (((g.m_playingState == PlayingState::NextPieceDelay) && (g.m_playingStateTimer >= k_ticksBetweenLockDownAndNextPiece - (numFramesShift * k_gameTicksPerFrame))) ||
+      ((g.m_playingState == PlayingState::ClearingLines) && (g.m_playingStateTimer >= k_lineClearAnimationTicks - (numFramesShift * k_gameTicksPerFrame))))
+  {
+    gridBottom += 1;
+  }
+  const uint8 blockSize = g.m_viewport.GetBlockSize();
+  if ((gridBottom != m_drawnBottomPos) || (blockSize != m_drawnBlockSize))
+  {
+    // Everything moved, so everything needs to be redrawn
+    m_drawnBottomPos = gridBottom;
+    m_drawnBlockSize = blockSize;
+    MarkAllDirty();
+  }
+
+  // Draw dirty blocks a row at a time
+  const uint8 left = g.m_viewport.GetLeft(t_width);
+  bool anyDrawn = false;
+  for (uint8 y = 0; y < t_height; y++)
+  {
+    const RowMask dirty = m_dirtyCells[y];
+    if (dirty != 0)
+    {
+      // If row is above the top of the screen or below the bottom, don't try to draw it
+      const uint8 yOffset = (y - m_drawnCameraRow) * blockSize;
+      if ((y >= m_drawnCameraRow) && (yOffset <= gridBottom))
+      {
+        // Cells that have been erased by the line clear animation are still in the grid until the line is collapsed
+        const RowMask erased = (m_clearingRows & (LineMask(1) << y)) ? (dirty & m_clearedColumns) : 0;
+        // Rows wider than a strip are drawn a strip at a time. The standard grid is always a single strip.
+        for (uint8 x = 0; x < t_width; x += k_maxBlockStripCount)
+        {
+          const uint8 count = Min<uint8>(t_width - x, k_maxBlockStripCount);
+          const uint8 stripLeft = left + (x * blockSize);
+          DrawBlockStrip(&m_grid[GetIndex(x, y)], count, uint16((dirty & ~erased) >> x), stripLeft, gridBottom - yOffset, blockSize);
+          if ((erased >> x) != 0)
+          {
+            static const BlockIndex k_emptyRow[Min<uint8>(t_width, k_maxBlockStripCount)] = {};
+            DrawBlockStrip(k_emptyRow, count, uint16(erased >> x), stripLeft, gridBottom - yOffset, blockSize);
+          }
+        }
+      }
+      m_dirtyCells[y] = 0;
+      anyDrawn = true;
+    }
+  }
+
+  // Draw border lines. Only needed if blocks were drawn, since the shake can draw over the bottom border.
+  if (anyDrawn)
+  {
+    const uint8 borderLeft = left - 1;
+    const uint8 borderRight = left + g.m_viewport.GetWidth(t_width);
+    arduboy.drawLine(borderLeft, 0, borderLeft, k_borderBottomPos, WHITE);
+    arduboy.drawLine(borderRight, 0, borderRight, k_borderBottomPos, WHITE);
+    g_display.MarkRectDirty(borderLeft, 0, 1, k_borderBottomPos + 1);
+    g_display.MarkRectDirty(borderRight, 0, 1, k_borderBottomPos + 1);
+    // There's only room for the floor with small blocks, and then the camera never moves
+    if (!g.m_viewport.HasLargeBlocks())
+    {
+      arduboy.drawLine(borderLeft, k_borderBottomPos, borderRight, k_borderBottomPos, WHITE);
+      g_display.MarkRectDirty(borderLeft, k_borderBottomPos, borderRight - borderLeft + 1, 1);
+    }
+  }
+}
+
+template <uint8 t_width, uint8 t_height>
+void GridT<t_width, t_height>::PrepareDraw()
+{
+  const uint8 cameraRow = g.m_viewport.GetCameraRow();
+  if (cameraRow == m_drawnCameraRow)
+  {
+    return;
+  }
+
+  const uint8 blockSize = g.m_viewport.GetBlockSize();
+  if (blockSize == m_drawnBlockSize)
+  {
+    // Everything on screen moves by a block, so the cells stay lined up with the grid and nothing but
+    // the row that comes into view needs drawing. That includes anything drawn over the grid, like the piece.
+    const uint8 left = g.m_viewport.GetLeft(t_width);
+    const uint8 width = g.m_viewport.GetWidth(t_width);
+    const uint8 bottom = Min<uint8>(m_drawnBottomPos + blockSize, k_screenHeight);
+    const uint8 numRowsInView = (m_drawnBottomPos / blockSize) + 1;
+    if (cameraRow == m_drawnCameraRow + 1)
+    {
+      ShiftScreenColumnsDown(left, width, bottom, blockSize);
+      m_dirtyCells[cameraRow + numRowsInView - 1] = k_fullRowMask;
+    }
+    else if (cameraRow + 1 == m_drawnCameraRow)
+    {
+      ShiftScreenColumnsUp(left, width, bottom, blockSize);
+      m_dirtyCells[cameraRow] = k_fullRowMask;
+    }
+    else
+    {
+      MarkAllDirty();
+    }
+  }
+  // A new block size gets everything redrawn by Draw()
+  m_drawnCameraRow = cameraRow;
+}
+
+template <uint8 t_width, uint8 t_height>
+void GridT<t_width, t_height>::MarkPieceMaskDirty(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize])
+{
+  // Pieces can hang off the left edge, so shift through walled row space to avoid negative shifts
+  const uint8 shift = pieceX + k_wallWidth;
+  for (uint8 i = 0; i < k_pieceMaskSize; i++)
+  {
+    const uint8 y = pieceY + i;
+    if (y < t_height)
+    {
+      m_dirtyCells[y] |= (RowMask(pieceRows[i]) << shift) >> k_wallWidth;
+    }
+  }
+}
+
+template <uint8 t_width, uint8 t_height>
+bool GridT<t_width, t_height>::IsPieceMaskDirty(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize]) const
+{
+  const uint8 shift = pieceX + k_wallWidth;
+  for (uint8 i = 0; i < k_pieceMaskSize; i++)
+  {
+    const uint8 y = pieceY + i;
+    if ((y < t_height) && (m_dirtyCells[y] & ((RowMask(pieceRows[i]) << shift) >> k_wallWidth)))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <uint8 t_width, uint8 t_height>
+bool GridT<t_width, t_height>::DoesPieceMaskFit(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize]) const
+{
+  // Shift that moves the piece's left-most column to 'pieceX' in walled row space.
+  // Negative positions wrap around to large values and get rejected here along with positions past the right wall.
+  const uint8 shift = pieceX + k_wallWidth;
+  if (shift > k_maxPieceShift)
+  {
+    return false;
+  }
+
+  for (uint8 i = 0; i < k_pieceMaskSize; i++)
+  {
+    if (pieceRows[i] != 0)
+    {
+      const uint8 y = pieceY + i;
+      // Rows below the floor (which wrap around) and above the top of the grid are solid
+      if (y >= t_height)
+      {
+        return false;
+      }
+      const RowMask walledRow = (m_rowMasks[y] << k_wallWidth) | k_wallMask;
+      if (walledRow & (RowMask(pieceRows[i]) << shift))
+      {
+        // Something is blocking this piece; early-out
+        return false;
+      }
+    }
+  }
+  // Nothing blocked the piece
+  return true;
+}
+
+template <uint8 t_width, uint8 t_height>
+uint8 GridT<t_width, t_height>::BeginClearingFullLines()
+{
+  uint8 numFullLines = 0;
+  m_clearingRows = 0;
+  m_clearedColumns = 0;
+  for (uint8 y = 0; y < t_height; y++)
+  {
+    if (m_rowMasks[y] == k_fullRowMask)
+    {
+      m_clearingRows |= LineMask(1) << y;
+      numFullLines++;
+    }
+  }
+
+  if (numFullLines > 0)
+  {
+    g.m_gameMode.TrackLinesCompleted(numFullLines);
   }
-  else
+  return numFullLines;
+}
+
+template <uint8 t_width, uint8 t_height>
+void GridT<t_width, t_height>::SetClearedColumns(RowMask columns)
+{
+  const RowMask newlyErased = columns & ~m_clearedColumns;
+  for (uint8 y = 0; y < t_height; y++)
   {
-    // Spawn a new piece from the default randomization system
-    const bool spawnSuccess = g_currentPiece.SpawnNewPiece();
-    if (!spawnSuccess)
+    if (m_clearingRows & (LineMask(1) << y))
     {
-      // Game Over because of BlockOut
-      g_gameState = GameState::GameOver;
+      m_dirtyCells[y] |= newlyErased;
     }
-    g_playingState = PlayingState::MovingPiece;
   }
+  m_clearedColumns = columns;
 }
 
-void GameOverLoop()
+template <uint8 t_width, uint8 t_height>
+bool GridT<t_width, t_height>::CollapseClearedLine(bool shiftScreen)
 {
-  arduboy.setTextBackground(BLACK);
-  arduboy.setTextColor(WHITE);
-  arduboy.setCursorX((k_screenWidth - (9 * 5)) / 2);
-  arduboy.setCursorY((k_screenHeight - 7) / 2);
-  arduboy.print(F("Game Over"));
+  Assert(m_clearingRows != 0);
+  // Removing the highest line first means the lines below it don't move
+  uint8 y = t_height - 1;
+  while ((m_clearingRows & (LineMask(1) << y)) == 0)
+  {
+    y--;
+  }
+  m_clearingRows &= ~(LineMask(1) << y);
+
+  // Copy every row above the line down in one go, and empty the top row
+  const uint8 numRowsAbove = t_height - 1 - y;
+  memmove(&m_grid[GetIndex(0, y)], &m_grid[GetIndex(0, y + 1)], numRowsAbove * t_width * sizeof(*m_grid));
+  memmove(&m_rowMasks[y], &m_rowMasks[y + 1], numRowsAbove * sizeof(*m_rowMasks));
+  memset(&m_grid[GetIndex(0, t_height - 1)], 0x00, t_width * sizeof(*m_grid));
+  m_rowMasks[t_height - 1] = 0;
+  m_revision++;
+
+  // A full line has a block in every column, so it was under the top of every column.
+  // The column's new top is usually just its old top moved down, unless its old top was in the line.
+  for (uint8 x = 0; x < t_width; x++)
+  {
+    LowerColumnHeight(x, m_columnHeights[x] - 1);
+  }
 
-  if (g.GetInput().WasButtonReleased(A_BUTTON) || g.GetInput().WasButtonReleased(B_BUTTON))
+  const uint8 blockSize = m_drawnBlockSize;
+  // Checking the block size first also makes sure the grid has been drawn before
+  if (shiftScreen && (blockSize == g.m_viewport.GetBlockSize()) && (y <= m_drawnCameraRow + (m_drawnBottomPos / blockSize)))
   {
-    ResetGame();
+    const uint8 topRowInView = m_drawnCameraRow + (m_drawnBottomPos / blockSize);
+    // Move what's on screen down over the line. Cells waiting to be redrawn move down with it.
+    // If the line is below the view, everything in view moves down.
+    const uint8 bottom = (y >= m_drawnCameraRow) ? (m_drawnBottomPos - ((y - m_drawnCameraRow) * blockSize)) : m_drawnBottomPos;
+    ShiftScreenColumnsDown(g.m_viewport.GetLeft(t_width), g.m_viewport.GetWidth(t_width), Min<uint8>(bottom + blockSize, k_screenHeight), blockSize);
+    memmove(&m_dirtyCells[y], &m_dirtyCells[y + 1], numRowsAbove * sizeof(*m_dirtyCells));
+    // The top row on screen moved down from a row that wasn't visible, so it's the only one that needs drawing
+    m_dirtyCells[t_height - 1] = 0;
+    m_dirtyCells[topRowInView] = k_fullRowMask;
+  }
+  else
+  {
+    // Every row from the line up has changed
+    for (; y < t_height; y++)
+    {
+      m_dirtyCells[y] = k_fullRowMask;
+    }
   }
+  return m_clearingRows != 0;
 }
 
-static void DrawBlock(uint8 x, uint8 y, BlockIndex block, uint8 leftAnchorScreenPos, uint8 bottomAnchorScreenPos)
+template <uint8 t_width, uint8 t_height>
+void GridT<t_width, t_height>::ProcessFullLines()
 {
-  DebugStack;
-  const uint8 xOffset = x * k_blockWidth;
-  const uint8 yOffset = y * k_blockHeight;
-  // If block is above the top of the screen, don't try to draw it
-  if (yOffset <= bottomAnchorScreenPos)
+  if (BeginClearingFullLines() > 0)
   {
-    const uint8 left = leftAnchorScreenPos + xOffset;
-    const uint8 top = bottomAnchorScreenPos - yOffset;
-  
-    // TODO: These asserts fail in debug! Fix them!
-    Assert(left < k_screenWidth);
-    Assert(top < k_screenHeight);
-  
-    // TODO: Figure out why this is necessary! Shouldn't drawExternalMask work?
-    arduboy.fillRect(left, top, 3, 3, BLACK);
-    
-    Assert(block >= BlockIndex::Empty && block < BlockIndex::Count);
-    Sprites::drawExternalMask(left, top, BlockSprites, BlockSprites, uint8(block), uint8(BlockIndex::SolidWhite));
+    while (CollapseClearedLine(false))
+    {
+    }
   }
 }
 
-#ifdef DEBUGGING_ENABLED
-void Grid::DebugPrint(const char* msg) const
+template <uint8 t_width, uint8 t_height>
+bool GridT<t_width, t_height>::AddGarbageRows(uint8 count, uint8 holeX, BlockIndex block)
 {
-  Serial.print(__FUNCTION__);
-  Serial.println(msg);
-  for (uint8 y = 0; y < k_gridHeight; y++)
+  Assert((count > 0) && (count <= t_height) && (holeX < t_width));
+  Assert(m_clearingRows == 0);
+  const bool fits = GetMaxColumnHeight() + count <= t_height;
+
+  // Copy every row up in one go, dropping the ones pushed off the top, then fill in the garbage under them
+  const uint8 numRowsKept = t_height - count;
+  memmove(&m_grid[GetIndex(0, count)], &m_grid[0], numRowsKept * t_width * sizeof(*m_grid));
+  memmove(&m_rowMasks[count], &m_rowMasks[0], numRowsKept * sizeof(*m_rowMasks));
+  const RowMask garbageMask = k_fullRowMask & ~(RowMask(1) << holeX);
+  for (uint8 y = 0; y < count; y++)
   {
-    for (uint8 x = 0; x < k_gridWidth; x++)
+    for (uint8 x = 0; x < t_width; x++)
     {
-      Serial.print(uint8(Get(x, y)));
+      m_grid[GetIndex(x, y)] = (x == holeX) ? BlockIndex::Empty : block;
     }
-    Serial.println();
+    m_rowMasks[y] = garbageMask;
   }
-  Serial.println();
+  m_revision++;
+
+  // Every column moves up, except that an empty column with the hole in it stays empty
+  for (uint8 x = 0; x < t_width; x++)
+  {
+    LowerColumnHeight(x, Min<uint8>(m_columnHeights[x] + count, t_height));
+  }
+  MarkAllDirty();
+  return fits;
 }
-#endif // #ifdef DEBUGGING_ENABLED
 
-void Grid::Draw() const
+// Only filled cells store a block, and only as an index into a palette of the blocks that are used.
+// A game usually only uses a few different blocks, and with some styles only one, which takes no bits at all.
+template <uint8 t_width, uint8 t_height>
+void GridT<t_width, t_height>::Save(BitWriter& writer) const
 {
-  DebugStack;
-
-  // Hack to make the grid shake slightly when a piece is locked in
-  // Not sure how much I like the visuals... I definitely don't like how it's implemented
-  uint8 gridBottom = k_gridBottomPos;
-  if (g_playingState == PlayingState::NextPieceDelay)
+  static_assert((t_width <= 32) && (t_height <= 32), "BitWriter can't write a whole row or column mask at once");
+  constexpr uint8 k_noPaletteIndex = 0xFF;
+  uint8 paletteIndices[uint8(BlockIndex::Count)];
+  memset(paletteIndices, k_noPaletteIndex, sizeof(paletteIndices));
+  BlockIndex palette[uint8(BlockIndex::Count)];
+  uint8 paletteSize = 0;
+  for (uint8 y = 0; y < t_height; y++)
   {
-    constexpr uint8 numFramesShift = 1;
-    if (g_playingStateTimer >= k_ticksBetweenLockDownAndNextPiece - (numFramesShift * k_gameTicksPerFrame))
+    for (uint8 x = 0; x < t_width; x++)
     {
-      gridBottom += 1;
+      const BlockIndex block = Get(x, y);
+      if (!IsEmpty(x, y) && (paletteIndices[uint8(block)] == k_noPaletteIndex))
+      {
+        paletteIndices[uint8(block)] = paletteSize;
+        palette[paletteSize++] = block;
+      }
     }
   }
-  
-  // Draw blocks
-  for (uint8 y = 0; y < k_gridHeight; y++)
+  writer.Write(paletteSize, k_paletteSizeBits);
+  for (uint8 i = 0; i < paletteSize; i++)
   {
-    for (uint8 x = 0; x < k_gridWidth; x++)
+    writer.Write(uint8(palette[i]), k_blockIndexBits);
+  }
+
+  const uint8 paletteIndexBits = BitsFor(paletteSize);
+  for (uint8 y = 0; y < t_height; y++)
+  {
+    const RowMask rowMask = m_rowMasks[y];
+    writer.Write(rowMask, t_width);
+    for (uint8 x = 0; x < t_width; x++)
     {
-      DrawBlock(x, y, Get(x, y), k_gridLeftPos, gridBottom);
+      if (rowMask & (RowMask(1) << x))
+      {
+        writer.Write(paletteIndices[uint8(Get(x, y))], paletteIndexBits);
+      }
     }
   }
-  
-  // Draw border lines
-  arduboy.drawLine(k_borderLeftPos, 0, k_borderLeftPos, k_borderBottomPos, WHITE);
-  arduboy.drawLine(k_borderRightPos, 0, k_borderRightPos, k_borderBottomPos, WHITE);
-  arduboy.drawLine(k_borderLeftPos, k_borderBottomPos, k_borderRightPos, k_borderBottomPos, WHITE);
+  writer.Write(m_clearingRows, t_height);
+  writer.Write(m_clearedColumns, t_width);
 }
 
-void Grid::ProcessFullLines()
+template <uint8 t_width, uint8 t_height>
+bool GridT<t_width, t_height>::Load(BitReader& reader)
 {
-  uint8 numCleared = 0;
-  for (uint8 y = 0; y < k_gridHeight; y++)
+  static_assert((t_width <= 32) && (t_height <= 32), "BitReader can't read a whole row or column mask at once");
+  Clear();
+  BlockIndex palette[uint8(BlockIndex::Count)];
+  const uint8 paletteSize = reader.Read(k_paletteSizeBits);
+  if (paletteSize > uint8(BlockIndex::Count))
   {
-    bool lineFull = true;
-    for (uint8 x = 0; x < k_gridWidth; x++)
+    return false;
+  }
+  for (uint8 i = 0; i < paletteSize; i++)
+  {
+    palette[i] = BlockIndex(reader.Read(k_blockIndexBits));
+  }
+
+  const uint8 paletteIndexBits = BitsFor(paletteSize);
+  for (uint8 y = 0; y < t_height; y++)
+  {
+    const RowMask rowMask = reader.Read(t_width);
+    for (uint8 x = 0; x < t_width; x++)
     {
-      BlockIndex block = Get(x, y);
-      // Copy block to row below if any lines were cleared. Set is a no-op if numCleared is 0
-      Set(x, y - numCleared, block);
-      if (block == BlockIndex::Empty)
+      if (rowMask & (RowMask(1) << x))
       {
-        lineFull = false;
+        const uint8 paletteIndex = reader.Read(paletteIndexBits);
+        if (paletteIndex >= paletteSize)
+        {
+          return false;
+        }
+        Set(x, y, palette[paletteIndex]);
       }
     }
-    if (lineFull)
-    {
-      numCleared++;
-    }
   }
+  m_clearingRows = reader.Read(t_height);
+  m_clearedColumns = reader.Read(t_width);
+  return true;
+}
 
-  // Make sure the lines above the highest one copied down gets zeroed out
-  for (uint8 y = k_gridHeight - numCleared; y < k_gridHeight; y++)
+template <uint8 t_width, uint8 t_height>
+uint8 GridT<t_width, t_height>::GetPieceMaskLandingY(uint8 pieceX, uint8 pieceY, const uint8 (&pieceRows)[k_pieceMaskSize]) const
+{
+  // If every column of the piece is above the skyline, the piece lands on whichever column it hits first.
+  // Otherwise it's tucked under an overhang and has to be walked down one row at a time.
+  int8 landingY = -k_pieceMaskSize;
+  for (uint8 column = 0; column < k_pieceMaskSize; column++)
   {
-    for (uint8 x = 0; x < k_gridWidth; x++)
+    const uint8 columnBit = 1 << column;
+    for (uint8 i = 0; i < k_pieceMaskSize; i++)
     {
-      Set(x, y, BlockIndex::Empty);
+      if (pieceRows[i] & columnBit)
+      {
+        // 'i' is the piece's lowest block in this column
+        const int8 columnHeight = m_columnHeights[uint8(pieceX + column)];
+        if (int8(pieceY + i) < columnHeight)
+        {
+          uint8 y = pieceY;
+          while (DoesPieceMaskFit(pieceX, y - 1, pieceRows))
+          {
+            y--;
+          }
+          return y;
+        }
+        landingY = Max<int8>(landingY, columnHeight - i);
+        break;
+      }
     }
   }
+  return uint8(landingY);
+}
 
-  if (numCleared > 0)
+template <uint8 t_width, uint8 t_height>
+uint8 GridT<t_width, t_height>::GetMaxColumnHeight() const
+{
+  uint8 maxHeight = 0;
+  for (uint8 x = 0; x < t_width; x++)
   {
-    g_gameMode.TrackLinesCompleted(numCleared);
+    maxHeight = Max(maxHeight, m_columnHeights[x]);
   }
+  return maxHeight;
 }
 
-bool PieceData::DoesPieceFitInGrid(PieceOrientation orientation, uint8 pieceX, uint8 pieceY) const
+template <uint8 t_width, uint8 t_height>
+typename GridT<t_width, t_height>::Index GridT<t_width, t_height>::CountHoles() const
 {
-  uint8 blockOffsetX;
-  uint8 blockOffsetY;
-  for (uint8 blockIndex = 0; blockIndex < GetNumBlocksInPiece(); blockIndex++)
+  // Walk down from the top, tracking which columns have had a filled cell above the current row
+  Index holes = 0;
+  RowMask coveredColumns = 0;
+  for (uint8 y = GetMaxColumnHeight(); y > 0; y--)
   {
-    GetBlockOffsetForIndexAndRotation(blockIndex, orientation, blockOffsetX, blockOffsetY);
-    uint8 testX = pieceX + blockOffsetX;
-    uint8 testY = pieceY + blockOffsetY;
-    if (!(g_grid.IsValidPosition(testX, testY) && g_grid.IsEmpty(testX, testY)))
+    const RowMask rowMask = m_rowMasks[y - 1];
+    for (RowMask emptyCovered = coveredColumns & ~rowMask; emptyCovered != 0; emptyCovered &= emptyCovered - 1)
     {
-      // Something is blocking this piece; early-out
-      return false;
+      holes++;
     }
+    coveredColumns |= rowMask;
   }
-  // Nothing blocked the piece
-  return true;
+  return holes;
+}
+
+template <uint8 t_width, uint8 t_height>
+typename GridT<t_width, t_height>::Index GridT<t_width, t_height>::GetBumpiness() const
+{
+  Index bumpiness = 0;
+  for (uint8 x = 1; x < t_width; x++)
+  {
+    const uint8 a = m_columnHeights[x - 1];
+    const uint8 b = m_columnHeights[x];
+    bumpiness += (a > b) ? (a - b) : (b - a);
+  }
+  return bumpiness;
+}
+
+bool PieceData::DoesPieceFitInGrid(PieceOrientation orientation, uint8 pieceX, uint8 pieceY) const
+{
+  return DoesPieceFitInGrid(g.m_grid, orientation, pieceX, pieceY);
 }
 
+#ifdef TEST_BUILD
 void PieceData::GetBlockOffsetForIndexAndRotation(int8 blockIndex, PieceOrientation orientation, uint8& outOffsetX, uint8& outOffsetY) const
 {
   // WARNING - Bad data or bad input will cause this to hang!
@@ -1231,17 +5693,18 @@ void PieceData::GetBlockOffsetForIndexAndRotation(int8 blockIndex, PieceOrientat
     {
       bitIndex++;
       Assert(bitIndex < 8, F("m_defaultBlockPositions and/or blockIndex were bad"));
-    } while ((m_defaultBlockPositions & (uint8(0x01) << bitIndex)) == 0);
+    } while ((pgm_read_byte(&m_defaultBlockPositions) & (uint8(0x01) << bitIndex)) == 0);
     blockIndex--;
   } while (blockIndex >= 0);
 
   uint8 m4 = bitIndex & 0x03;   // m4 = bitIndex % 4;
   uint8 d4 = bitIndex / 4;      // d4 = bitIndex / 4;
 
-  Assert(m_rotationFormula == RotationFormula::Rotation2x4 || m_rotationFormula == RotationFormula::Rotation2x3);
+  const RotationFormula rotationFormula = RotationFormula(pgm_read_byte(&m_rotationFormula));
+  Assert(rotationFormula == RotationFormula::Rotation2x4 || rotationFormula == RotationFormula::Rotation2x3);
   // Rotation of 2x3 blocks is very similar to 2x4. Rather than having two separate
   // calculations, the differences are encapsulated in a few targeted fixups
-  int8 fixup = (m_rotationFormula == RotationFormula::Rotation2x4) ? 0 : -1;
+  int8 fixup = (rotationFormula == RotationFormula::Rotation2x4) ? 0 : -1;
   switch (orientation)
   {
     case PieceOrientation::North:
@@ -1262,20 +5725,36 @@ void PieceData::GetBlockOffsetForIndexAndRotation(int8 blockIndex, PieceOrientat
       break;
   }
 }
+#endif // #ifdef TEST_BUILD
 
 // TODO: Figure out how to not pass PieceIndex into the PieceData. Either PieceData should
 //       already know that (or be able to figure it out), or it shouldn't need to know it.
-void PieceData::Draw(uint8 x, uint8 y, PieceOrientation orientation, VisualStyle visualStyle, PieceIndex pieceIndex, uint8 leftAnchorScreenPos, uint8 bottomAnchorScreenPos) const
+void PieceData::Draw(uint8 x, uint8 y, PieceOrientation orientation, VisualStyle visualStyle, PieceIndex pieceIndex, uint8 leftAnchorScreenPos, uint8 bottomAnchorScreenPos, uint8 blockSize) const
 {
   DebugStack;
-  VisualStyleHelper styleHelper(visualStyle);
+  // Sort the blocks into rows so each row can be drawn as one strip
+  BlockIndex rowBlocks[k_pieceMaskSize][k_pieceMaskSize];
+  VisualStyleHelper styleHelper(visualStyle, pieceIndex);
   for (uint8 i = 0; i < GetNumBlocksInPiece(); i++)
   {
     uint8 dx;
     uint8 dy;
-    GetBlockOffsetForIndexAndRotation(i, orientation, dx, dy);
-    const BlockIndex blockIndex = styleHelper.GetBlockForPiece(pieceIndex, orientation, i);
-    DrawBlock(x + dx, y + dy, blockIndex, leftAnchorScreenPos, bottomAnchorScreenPos);
+    GetBlockOffset(i, orientation, dx, dy);
+    rowBlocks[dy][dx] = styleHelper.GetBlock(orientation, i);
+  }
+
+  uint8 pieceRows[k_pieceMaskSize];
+  GetRowMasks(orientation, pieceRows);
+  const uint8 left = leftAnchorScreenPos + (x * blockSize);
+  for (uint8 row = 0; row < k_pieceMaskSize; row++)
+  {
+    // If the row is below the bottom of the view or above the top of the screen, don't try to draw it
+    const int8 rowY = int8(y + row);
+    const uint8 yOffset = rowY * blockSize;
+    if ((pieceRows[row] != 0) && (rowY >= 0) && (yOffset <= bottomAnchorScreenPos))
+    {
+      DrawBlockStrip(rowBlocks[row], k_pieceMaskSize, pieceRows[row], left, bottomAnchorScreenPos - yOffset, blockSize);
+    }
   }
 }
 
@@ -1295,11 +5774,12 @@ bool CurrentPiece::SpawnNewPiece(PieceIndex knownNextPiece)
   else
   {
     // Pull next piece from 7-bag (or other randomization abstraction)
-    m_pieceIndex = g_next.GetNextPiece();
+    m_pieceIndex = g.m_next.GetNextPiece();
   }
   SetPiecePosition(k_defaultPieceSpawnX, k_defaultPieceSpawnY);
   m_orientation = PieceOrientation::North;
-  m_ticksToFall = g_gameMode.GetFallTime();
+  InvalidateLandingY();
+  m_ticksToFall = g.m_gameMode.GetFallTime();
   m_lockDownTickTimer = k_defaultLockDownDelay;
   m_lockDownMoveCounter = k_defaultLockDownMoveCount;
   m_lockDownLowestY = m_y;
@@ -1313,29 +5793,69 @@ bool CurrentPiece::SpawnNewPiece(PieceIndex knownNextPiece)
   return GetPieceData().DoesPieceFitInGrid(m_orientation, m_x, m_y);
 }
 
+void CurrentPiece::PrepareDraw()
+{
+  const uint8 shadowY = (m_pieceIndex != PieceIndex::Invalid) ? GetLandingY() : m_y;
+
+  const bool changed =
+    (m_pieceIndex != m_drawnPieceIndex) ||
+    (m_x != m_drawnX) ||
+    (m_y != m_drawnY) ||
+    (m_orientation != m_drawnOrientation) ||
+    (shadowY != m_drawnShadowY);
+
+  if (changed)
+  {
+    // Erase the piece and shadow from where they were last drawn
+    if (m_drawnPieceIndex != PieceIndex::Invalid)
+    {
+      uint8 pieceRows[k_pieceMaskSize];
+      g_pieceData[uint8(m_drawnPieceIndex)].GetRowMasks(m_drawnOrientation, pieceRows);
+      g.m_grid.MarkPieceMaskDirty(m_drawnX, m_drawnY, pieceRows);
+      g.m_grid.MarkPieceMaskDirty(m_drawnX, m_drawnShadowY, pieceRows);
+    }
+    m_drawnPieceIndex = m_pieceIndex;
+    m_drawnX = m_x;
+    m_drawnY = m_y;
+    m_drawnOrientation = m_orientation;
+    m_drawnShadowY = shadowY;
+    m_needsRedraw = true;
+  }
+  else if (m_pieceIndex != PieceIndex::Invalid)
+  {
+    // Nothing moved, but the grid may be about to draw over the piece or its shadow
+    uint8 pieceRows[k_pieceMaskSize];
+    GetPieceData().GetRowMasks(m_orientation, pieceRows);
+    m_needsRedraw = g.m_grid.IsPieceMaskDirty(m_x, m_y, pieceRows) || g.m_grid.IsPieceMaskDirty(m_x, shadowY, pieceRows);
+  }
+  else
+  {
+    m_needsRedraw = false;
+  }
+}
+
 void CurrentPiece::Draw() const
 {
-  if (m_pieceIndex != PieceIndex::Invalid)
+  if (m_needsRedraw && (m_pieceIndex != PieceIndex::Invalid))
   {
     const VisualStyle visualStyle = GetVisualStyleFromPiece(m_pieceIndex);
-    GetPieceData().Draw(m_x, m_y, m_orientation, visualStyle, m_pieceIndex, k_gridLeftPos, k_gridBottomPos);
+    // The current piece is redrawn every time it moves, so its blocks are only decoded the first time it is drawn
+    g_resolvedVisualStyles[k_resolvedPieceSlot].Resolve(visualStyle, m_pieceIndex);
+    GetPieceData().Draw(m_x, m_y - g.m_viewport.GetCameraRow(), m_orientation, visualStyle, m_pieceIndex, g.m_viewport.GetLeft(), g.m_viewport.GetBottom(), g.m_viewport.GetBlockSize());
   }
 }
 
 void CurrentPiece::DrawShadow() const
 {
+  ProfileSection(DrawShadow);
   // TODO: Merge this function with Draw()
-  if (m_pieceIndex != PieceIndex::Invalid)
+  if (m_needsRedraw && (m_pieceIndex != PieceIndex::Invalid))
   {
-    const PieceData& pieceData = GetPieceData();
-    uint8 shadowY = m_y;
-    while (pieceData.DoesPieceFitInGrid(m_orientation, m_x, shadowY - 1))
+    // Shadow position was found in PrepareDraw()
+    if (m_drawnShadowY != m_y)
     {
-      shadowY--;
-    }
-    if (shadowY != m_y)
-    {
-      pieceData.Draw(m_x, shadowY, m_orientation, g_shadowStyle, m_pieceIndex, k_gridLeftPos, k_gridBottomPos);
+      g_resolvedVisualStyles[k_resolvedShadowSlot].Resolve(g.m_shadowStyle, m_pieceIndex);
+      GetPieceData().Draw(m_x, m_drawnShadowY - g.m_viewport.GetCameraRow(), m_orientation, g.m_shadowStyle, m_pieceIndex, g.m_viewport.GetLeft(), g.m_viewport.GetBottom(), g.m_viewport.GetBlockSize());
     }
   }
 }
@@ -1367,8 +5887,10 @@ void CurrentPiece::MoveDown(bool trySoftDrop)
     }
     else
     {
-      if (TryMove(0, -1))
+      // Positions can be just below the bottom of the grid (ie. -1) when the piece has empty bottom rows
+      if (int8(m_y) > int8(GetLandingY()))
       {
+        SetPiecePosition(m_x, m_y - 1);
         // The piece moved down... check if it's a new lowest. If so, reset the lock down timer and move counter
         if (m_y < m_lockDownLowestY)
         {
@@ -1381,10 +5903,10 @@ void CurrentPiece::MoveDown(bool trySoftDrop)
         ticksToSubtract -= m_ticksToFall;
 
         // Check if the piece is now resting on a surface
-        if(GetPieceData().DoesPieceFitInGrid(m_orientation, m_x, m_y - 1))
+        if (int8(m_y) > int8(GetLandingY()))
         {
           // The piece can continue to fall, so reset the m_ticksToFall timer
-          m_ticksToFall = g_gameMode.GetFallTime();
+          m_ticksToFall = g.m_gameMode.GetFallTime();
         }
         else
         {
@@ -1412,12 +5934,42 @@ void CurrentPiece::MoveDown(bool trySoftDrop)
   }
 }
 
-void CurrentPiece::DoHardDrop()
+GameTicks CurrentPiece::GetTicksUntilNextEvent(bool trySoftDrop)
 {
-  DebugPrintLine(F("HardDrop"));
-  while (TryMove(0, -1))
+  if (k_debugDisableGravity && !trySoftDrop)
+  {
+    return k_ticksUntilInput;
+  }
+  if (m_ticksToFall > 0)
+  {
+    // Soft drop counts the fall timer down faster
+    const uint8 fallSpeed = trySoftDrop ? k_softDropSpeedScalar : 1;
+    return (uint16(m_ticksToFall) + fallSpeed - 1) / fallSpeed;
+  }
+  // The fall timer stays at 0 while the piece rests on something, and the lock down timer counts instead
+  return (int8(m_y) > int8(GetLandingY())) ? 0 : m_lockDownTickTimer;
+}
+
+void CurrentPiece::SkipFrame(bool trySoftDrop)
+{
+  if (k_debugDisableGravity && !trySoftDrop)
+  {
+    return;
+  }
+  if (m_ticksToFall > 0)
+  {
+    m_ticksToFall -= trySoftDrop ? (k_gameTicksPerFrame * k_softDropSpeedScalar) : k_gameTicksPerFrame;
+  }
+  else
   {
+    m_lockDownTickTimer -= k_gameTicksPerFrame;
   }
+}
+
+void CurrentPiece::DoHardDrop()
+{
+  DebugPrintLine(F("HardDrop"));
+  SetPiecePosition(m_x, GetLandingY());
   LockPieceInGrid();
 }
 
@@ -1442,16 +5994,25 @@ bool CurrentPiece::TryRotate(RotationDirection rotationDirection)
   testOrientation = PieceOrientation((int8(testOrientation) + int8(PieceOrientation::Count)) % int8(PieceOrientation::Count));
 
   const PieceData& pieceData = GetPieceData();
-  const RotationOffsets* rotationOffsets = pieceData.GetRotationOffsets();
-  const uint8 numRotationsToTest = (rotationOffsets == nullptr) ? 1 : rotationOffsets->GetNumRotationOffsets();
-  for (int rotationIndex = 0; rotationIndex < numRotationsToTest; rotationIndex++)
+  const uint8* packedKicks = pieceData.GetPackedKicks();
+  // The first test is always the plain rotation, followed by the kicks
+  const uint8 numRotationsToTest = (packedKicks == nullptr) ? 1 : (1 + k_numSrsKicks);
+  for (uint8 rotationIndex = 0; rotationIndex < numRotationsToTest; rotationIndex++)
   {
     int8 deltaX = 0;
     int8 deltaY = 0;
-    if (rotationOffsets != nullptr)
+    if (packedKicks != nullptr)
     {
-      RotationOffset offset = rotationOffsets->GetRotationOffset(m_orientation, rotationDirection, rotationIndex);
-      offset.UnpackOffset(deltaX, deltaY);
+      if (rotationIndex > 0)
+      {
+        const uint8 packedKick = PieceData::GetPackedKick(packedKicks, rotationDirection, m_orientation, rotationIndex - 1);
+        if (packedKick == k_packedSrsKickNone)
+        {
+          continue;
+        }
+        deltaX = UnpackSrsKickX(packedKick);
+        deltaY = UnpackSrsKickY(packedKick);
+      }
 #ifdef DEBUGGING_ENABLED
       sprintf(g_debugStr,
               "Piece:%d (%d, %d) Orient:%s Rot:%s[%d] delta(%d, %d)\n",
@@ -1474,6 +6035,7 @@ bool CurrentPiece::TryRotate(RotationDirection rotationDirection)
     {
       SetPiecePosition(newX, newY);
       m_orientation = testOrientation;
+      InvalidateLandingY();
       // Rotation succeeded; return true
       return true;
     }
@@ -1503,17 +6065,25 @@ PieceIndex CurrentPiece::TryHold()
     {
       // Special-case this to hide the previous piece
       const VisualStyle visualStyle = VisualStyle::SolidBlack;
-      g_pieceData[uint8(oldHoldPiece)].Draw(0, 0, PieceOrientation::North, visualStyle, oldHoldPiece, k_holdDisplayLeft, k_holdDisplayBottom);
+      g_pieceData[uint8(oldHoldPiece)].Draw(0, 0, PieceOrientation::North, visualStyle, oldHoldPiece, k_holdDisplayLeft, k_holdDisplayBottom, k_blockHeight);
     }
     Assert(m_holdPiece != PieceIndex::Invalid);
-    const VisualStyle visualStyle = GetVisualStyleFromPiece(m_holdPiece);
-    g_pieceData[uint8(m_holdPiece)].Draw(0, 0, PieceOrientation::North, visualStyle, m_holdPiece, k_holdDisplayLeft, k_holdDisplayBottom);
+    DrawHold();
 
     DebugPrintLine(F("Hold"));
   }
   return oldHoldPiece;
 }
 
+void CurrentPiece::DrawHold() const
+{
+  if (m_holdPiece != PieceIndex::Invalid)
+  {
+    const VisualStyle visualStyle = GetVisualStyleFromPiece(m_holdPiece);
+    g_pieceData[uint8(m_holdPiece)].Draw(0, 0, PieceOrientation::North, visualStyle, m_holdPiece, k_holdDisplayLeft, k_holdDisplayBottom, k_blockHeight);
+  }
+}
+
 void CurrentPiece::DecrementMoveLockDownCounter(uint8 moveAndRotationCount)
 {
   if (moveAndRotationCount > 0)
@@ -1537,15 +6107,15 @@ void CurrentPiece::DecrementMoveLockDownCounter(uint8 moveAndRotationCount)
 void CurrentPiece::LockPieceInGrid()
 {
   // Write all the blocks to the grid
-  VisualStyleHelper styleHelper(GetVisualStyleFromPiece(m_pieceIndex));
+  VisualStyleHelper styleHelper(GetVisualStyleFromPiece(m_pieceIndex), m_pieceIndex);
   const PieceData& pieceData = GetPieceData();
   for (uint8 index = 0; index < pieceData.GetNumBlocksInPiece(); index++)
   {
     uint8 blockOffsetX;
     uint8 blockOffsetY;
-    pieceData.GetBlockOffsetForIndexAndRotation(index, m_orientation, blockOffsetX, blockOffsetY);
-    const BlockIndex blockIndex = styleHelper.GetBlockForPiece(m_pieceIndex, m_orientation, index);
-    g_grid.Set(m_x + blockOffsetX, m_y + blockOffsetY, blockIndex);
+    pieceData.GetBlockOffset(index, m_orientation, blockOffsetX, blockOffsetY);
+    const BlockIndex blockIndex = styleHelper.GetBlock(m_orientation, index);
+    g.m_grid.Set(m_x + blockOffsetX, m_y + blockOffsetY, blockIndex);
   }
 
   // Invalidate the piece now that it's been written to the grid
@@ -1557,66 +6127,148 @@ void CurrentPiece::LockPieceInGrid()
 
 void CurrentPiece::SetPiecePosition(uint8 newX, uint8 newY)
 {
+  // Falling straight down doesn't change where the piece will land
+  if ((newX != m_x) || (int8(newY) > int8(m_y)))
+  {
+    InvalidateLandingY();
+  }
   m_x = newX;
   m_y = newY;
 }
 
+void CurrentPiece::Save(BitWriter& writer) const
+{
+  writer.Write(uint8(m_holdPiece), k_pieceIndexBits);
+  writer.Write(m_holdActionAvailable, 1);
+  writer.Write(uint8(m_pieceIndex), k_pieceIndexBits);
+  if (m_pieceIndex == PieceIndex::Invalid)
+  {
+    // Nothing else means anything without a piece
+    return;
+  }
+  // The piece can hang off the left and bottom of the grid by less than its size, which makes the position negative
+  writer.Write(uint8(m_x + k_pieceMaskSize), k_pieceXBits);
+  writer.Write(uint8(m_y + k_pieceMaskSize), k_pieceYBits);
+  writer.Write(uint8(m_orientation), k_orientationBits);
+  writer.Write(m_ticksToFall, sizeof(m_ticksToFall) * 8);
+  writer.Write(m_lockDownTickTimer, sizeof(m_lockDownTickTimer) * 8);
+  writer.Write(m_lockDownMoveCounter, k_lockDownMoveCounterBits);
+  writer.Write(uint8(m_lockDownLowestY + k_pieceMaskSize), k_pieceYBits);
+}
+
+bool CurrentPiece::Load(BitReader& reader)
+{
+  m_holdPiece = PieceIndex(reader.Read(k_pieceIndexBits));
+  m_holdActionAvailable = reader.Read(1);
+  m_pieceIndex = PieceIndex(reader.Read(k_pieceIndexBits));
+  m_drawnPieceIndex = PieceIndex::Invalid;
+  m_landingYValid = false;
+  if (m_pieceIndex == PieceIndex::Invalid)
+  {
+    return true;
+  }
+  m_x = reader.Read(k_pieceXBits) - k_pieceMaskSize;
+  m_y = reader.Read(k_pieceYBits) - k_pieceMaskSize;
+  m_orientation = PieceOrientation(reader.Read(k_orientationBits));
+  m_ticksToFall = reader.Read(sizeof(m_ticksToFall) * 8);
+  m_lockDownTickTimer = reader.Read(sizeof(m_lockDownTickTimer) * 8);
+  m_lockDownMoveCounter = reader.Read(k_lockDownMoveCounterBits);
+  m_lockDownLowestY = reader.Read(k_pieceYBits) - k_pieceMaskSize;
+  return (m_lockDownMoveCounter <= k_defaultLockDownMoveCount) && GetPieceData().DoesPieceFitInGrid(m_orientation, m_x, m_y);
+}
+
+uint8 CurrentPiece::GetLandingY()
+{
+  if (!m_landingYValid || (m_landingYGridRevision != g.m_grid.GetRevision()))
+  {
+    uint8 pieceRows[k_pieceMaskSize];
+    GetPieceData().GetRowMasks(m_orientation, pieceRows);
+    m_landingY = g.m_grid.GetPieceMaskLandingY(m_x, m_y, pieceRows);
+    m_landingYGridRevision = g.m_grid.GetRevision();
+    m_landingYValid = true;
+  }
+  return m_landingY;
+}
+
 //==========================================================================
 // Unit tests for - Next class
 //--------------------------------------------------------------------------
 #ifdef TEST_BUILD
 void Next::UnitTest()
 {
-  Next test;
-  memset(&test, 0x00, sizeof(test));
-  TestVerify(test.m_next[0] == PieceIndex(0));
-
-  // Verify initial shuffle contains one of each piece
-  test.Reset();
-  for (uint8 i = 0; i < uint8(PieceIndex::Count); i++)
+  // Every permutation index should decode to a bag with one of each piece
+  for (uint16 permutation = 0; permutation < k_numBagPermutations; permutation++)
   {
-    PieceIndex piece = PieceIndex(i);
-    bool pieceFound = false;
-    for (uint8 j = 0; j < uint8(PieceIndex::Count); j++)
+    uint8 piecesFound = 0;
+    for (uint8 i = 0; i < k_bagSize; i++)
     {
-      if (test.m_next[j] == piece)
-      {
-        pieceFound = true;
-      }
+      piecesFound |= 1 << uint8(DecodeBag(permutation, i));
     }
-    TestVerify(pieceFound);
+    TestVerify(piecesFound == (1 << k_bagSize) - 1);
   }
+  // The first and last permutations are the bag in order and reversed
+  TestVerify(DecodeBag(0, 0) == PieceIndex(0));
+  TestVerify(DecodeBag(0, k_bagSize - 1) == PieceIndex(k_bagSize - 1));
+  TestVerify(DecodeBag(k_numBagPermutations - 1, 0) == PieceIndex(k_bagSize - 1));
+  TestVerify(DecodeBag(k_numBagPermutations - 1, k_bagSize - 1) == PieceIndex(0));
+
+  Next test;
+  test.Reset(GenerateRandomSeed());
 
   uint8 pieceCounts[uint8(PieceIndex::Count)] = {0};
-  const uint8 bagIterations = 50;
+  uint8 firstPieceCounts[uint8(PieceIndex::Count)] = {0};
+  // Enough bags for the ring buffer to wrap around many times
+  const uint8 bagIterations = 200;
   for (uint8 iterations = 0; iterations < bagIterations; iterations++)
   {
     for (uint8 i = 0; i < uint8(PieceIndex::Count); i++)
     {
-      test.DebugPrint();
-      pieceCounts[uint8(test.GetNextPiece())]++;
+      // Looking ahead should agree with the pieces that are handed out later, including across bags
+      PieceIndex lookahead[k_nextLookahead];
+      for (uint8 j = 0; j < k_nextLookahead; j++)
+      {
+        lookahead[j] = test.PeekPiece(j);
+      }
+      const PieceIndex piece = test.GetNextPiece();
+      TestVerify(piece == lookahead[0]);
+      for (uint8 j = 1; j < k_nextLookahead; j++)
+      {
+        TestVerify(test.PeekPiece(j - 1) == lookahead[j]);
+      }
+      pieceCounts[uint8(piece)]++;
+      if (i == 0)
+      {
+        firstPieceCounts[uint8(piece)]++;
+      }
     }
 
     // Make sure all pieces were chosen the same number of times
-    bool allChosen = true;
     for (uint8 i = 0; i < countof(pieceCounts); i++)
     {
       TestVerify(pieceCounts[i] == iterations + 1);
     }
+    if (iterations < 2)
+    {
+      test.DebugPrint();
+    }
+  }
+
+  // Every piece should show up at the start of a bag sometimes. With 200 bags, the chance of any
+  // piece never being first is about 7 * (6/7)^200, which is effectively never
+  for (uint8 i = 0; i < countof(firstPieceCounts); i++)
+  {
+    TestVerify(firstPieceCounts[i] > 0);
   }
 }
 
 void Next::DebugPrint() const
 {
   const char* k_pieces[] = {"O", "I", "T", "L", "J", "S", "Z"};
-  for (uint8 i = 0; i < countof(m_next); i++)
+  Serial.print(F("["));
+  for (uint8 i = 0; i < k_nextLookahead; i++)
   {
-    if (i == m_index)
-    {
-      Serial.print(F("["));
-    }
-    Serial.print(k_pieces[uint8(m_next[i])]);
-    if (i == m_index)
+    Serial.print(k_pieces[uint8(PeekPiece(i))]);
+    if (i == 0)
     {
       Serial.print(F("]"));
     }
@@ -1628,13 +6280,14 @@ void Next::DebugPrint() const
 // Unit tests for - Next class
 //==========================================================================
 
-void Next::Reset()
+void Next::Reset(uint32 seed)
 {
-  // TODO: Randomize things better. Maybe take into acount player input?
-  arduboy.initRandomSeed();
-  // Initialize two bags
-  ShuffleBag(0);
-  ShuffleBag(7);
+  m_random.SetSeed(seed);
+  for (uint8 i = 0; i < k_numBags; i++)
+  {
+    m_bags[i] = ShuffleBag(m_random);
+  }
+  m_bagHead = 0;
   m_index = 0;
 }
 
@@ -1643,55 +6296,119 @@ PieceIndex Next::GetNextPiece()
   // Hacky way to clear the previous "Next" display. First clear the old display, then draw the new one.
   // It's nice in that it only updates the display when something changes, but drawing in GetNextPiece feels dirty.
   Draw(false);  // Note: Passing 'false' in here will draw black over all the pieces
-  PieceIndex nextPiece = m_next[m_index];
+  PieceIndex nextPiece = PeekPiece(0);
   m_index++;
-  // TODO: Make this magic number a constant or computed?
-  // If the index has progressed this far, another bag needs to be randomized
-  if (m_index >= 7)
-  {
-    Assert(m_index == 7);
-    // This is likely less code than a loop to copy, or to treat the whole think like a ring buffer
-    memmove(m_next, m_next + m_index, (countof(m_next) * sizeof(*m_next)) - m_index);
-    ShuffleBag(7);
+  // Once the oldest bag is empty, it gets reshuffled and becomes the newest
+  if (m_index >= k_bagSize)
+  {
+    Assert(m_index == k_bagSize);
+    m_bags[m_bagHead] = ShuffleBag(m_random);
+    m_bagHead = (m_bagHead + 1) % k_numBags;
     m_index = 0;
   }
-#ifdef GAME_BUILD
+#if defined(GAME_BUILD) || defined(BENCHMARK_BUILD)
   // Update the Next display in game builds
   // TODO: Figure out a nicer way to do this and not have drawing code in the middle of GetNextPiece
   Draw();
-#endif // #ifdef GAME_BUILD
+#endif // #if defined(GAME_BUILD) || defined(BENCHMARK_BUILD)
   return nextPiece;
 }
 
+PieceIndex Next::PeekPiece(uint8 offset) const
+{
+  Assert(offset < k_nextLookahead);
+  const uint8 index = m_index + offset;
+  const uint8 bag = (m_bagHead + (index / k_bagSize)) % k_numBags;
+  return DecodeBag(m_bags[bag], index % k_bagSize);
+}
+
 void Next::Draw(bool setFalseToClear) const
 {
   for (uint8 i = 0; i < k_numNextPiecesToShow; i++)
   {
-    const PieceIndex pieceIndex = m_next[m_index + i];
+    const PieceIndex pieceIndex = PeekPiece(i);
     const PieceData& pieceData = g_pieceData[uint8(pieceIndex)];
     // TODO: What block index should be used for the Next display?
     // TODO: Formalize the position of these draws
     VisualStyle visualStyle = setFalseToClear ? GetVisualStyleFromPiece(pieceIndex) : VisualStyle::SolidBlack;
-    pieceData.Draw(0, (1 + k_numNextPiecesToShow - i) * 3, PieceOrientation::North, visualStyle, pieceIndex, k_nextDisplayLeftPos, k_nextDisplayBottomPos);
+    pieceData.Draw(0, (1 + k_numNextPiecesToShow - i) * 3, PieceOrientation::North, visualStyle, pieceIndex, k_nextDisplayLeftPos, k_nextDisplayBottomPos, k_blockHeight);
   }
 }
 
-void Next::ShuffleBag(uint8 startingIndex)
+// Picks a random permutation of the bag the same way a Fisher-Yates shuffle would, but keeps the
+// choices as digits of a mixed radix number instead of moving pieces around
+// static
+uint16 Next::ShuffleBag(Random& random)
 {
-  Assert(startingIndex <= countof(m_next) - uint8(PieceIndex::Count));
-  // Put one of each piece in the "bag"
-  for (uint8 i = 0; i < uint8(PieceIndex::Count); i++)
+  uint16 permutation = 0;
+  for (uint8 i = 0; i < k_bagSize; i++)
   {
-    m_next[i + startingIndex] = PieceIndex(i);
+    const uint8 remaining = k_bagSize - i;
+    permutation = (permutation * remaining) + random.NextInRange(remaining);
   }
+  Assert(permutation < k_numBagPermutations);
+  return permutation;
+}
 
-  // Shuffle the bag
-  for (uint8 i = 0; i < uint8(PieceIndex::Count); i++)
+void Next::Save(BitWriter& writer) const
+{
+  for (uint8 i = 0; i < k_numBags; i++)
+  {
+    writer.Write(m_bags[i], BitsFor(k_numBagPermutations));
+  }
+  writer.Write(m_bagHead, BitsFor(k_numBags));
+  writer.Write(m_index, BitsFor(k_bagSize));
+  writer.Write(m_random.GetState(), 32);
+}
+
+bool Next::Load(BitReader& reader)
+{
+  bool valid = true;
+  for (uint8 i = 0; i < k_numBags; i++)
+  {
+    m_bags[i] = reader.Read(BitsFor(k_numBagPermutations));
+    valid = valid && (m_bags[i] < k_numBagPermutations);
+  }
+  m_bagHead = reader.Read(BitsFor(k_numBags));
+  m_index = reader.Read(BitsFor(k_bagSize));
+  m_random.SetSeed(reader.Read(32));
+  return valid && (m_bagHead < k_numBags) && (m_index < k_bagSize);
+}
+
+// Returns the piece at 'index' of the bag whose permutation index is 'permutation'
+// static
+PieceIndex Next::DecodeBag(uint16 permutation, uint8 index)
+{
+  // Peel off the digits from the least significant end, which is the last piece chosen
+  uint8 choices[k_bagSize];
+  for (uint8 i = k_bagSize; i > 0; i--)
+  {
+    const uint8 remaining = k_bagSize + 1 - i;
+    choices[i - 1] = permutation % remaining;
+    permutation /= remaining;
+  }
+
+  // Each choice is an index into the pieces that haven't been taken out of the bag yet
+  uint8 taken = 0;
+  for (uint8 i = 0; ; i++)
   {
-    uint8 swapIndex = random(i, uint32(PieceIndex::Count));
-    PieceIndex temp = m_next[i + startingIndex];
-    m_next[i + startingIndex] = m_next[swapIndex + startingIndex];
-    m_next[swapIndex + startingIndex] = temp;
+    uint8 piece = 0;
+    for (uint8 skip = choices[i]; ; piece++)
+    {
+      if ((taken & (1 << piece)) == 0)
+      {
+        if (skip == 0)
+        {
+          break;
+        }
+        skip--;
+      }
+    }
+    if (i == index)
+    {
+      return PieceIndex(piece);
+    }
+    taken |= 1 << piece;
   }
 }
 
@@ -1707,8 +6424,8 @@ uint8 Controller::ProcessMoveHorizontal(uint8 button, uint8& out_ticksUntilAutoR
     // A value of '0' here indicates the button wasn't down the previous frame
     if (out_ticksUntilAutoRepeat == 0)
     {
-      // Initial press may have a different repeat delay
-      out_ticksUntilAutoRepeat = k_autoRepeatFirstDelayTicks;
+      // Initial press may have a different repeat delay. It's timed from when the button actually went down.
+      out_ticksUntilAutoRepeat = k_autoRepeatFirstDelayTicks - g.GetInput().GetPressTicks();
       moveAmount++;
     }
     else
@@ -1732,6 +6449,41 @@ uint8 Controller::ProcessMoveHorizontal(uint8 button, uint8& out_ticksUntilAutoR
   return moveAmount;
 }
 
+GameTicks Controller::GetTicksUntilNextEvent() const
+{
+  const Input& input = g.GetInput();
+  if ((m_isSoftDrop != input.IsButtonDown(k_softDropButton)) || (m_hardDropButtonWasDown != input.IsButtonDown(k_hardDropButton)))
+  {
+    return 0;
+  }
+  return Min(GetTicksUntilAutoRepeat(k_leftButton, m_ticksUntilAutoRepeatLeft), GetTicksUntilAutoRepeat(k_rightButton, m_ticksUntilAutoRepeatRight));
+}
+
+// static
+GameTicks Controller::GetTicksUntilAutoRepeat(uint8 button, GameTicks ticksUntilAutoRepeat)
+{
+  if (g.GetInput().IsButtonDown(button))
+  {
+    // 0 if the press hasn't been handled yet
+    return ticksUntilAutoRepeat;
+  }
+  // The timer of a released button is reset the next time input is processed
+  return (ticksUntilAutoRepeat == 0) ? k_ticksUntilInput : 0;
+}
+
+void Controller::SkipFrame()
+{
+  const Input& input = g.GetInput();
+  if (input.IsButtonDown(k_leftButton))
+  {
+    m_ticksUntilAutoRepeatLeft -= k_gameTicksPerFrame;
+  }
+  if (input.IsButtonDown(k_rightButton))
+  {
+    m_ticksUntilAutoRepeatRight -= k_gameTicksPerFrame;
+  }
+}
+
 void Controller::ProcessInput()
 {
   // Handle horizontal input and movement
@@ -1745,7 +6497,7 @@ void Controller::ProcessInput()
   const int8 moveDelta = (moveAmount < 0) ? -1 : +1;
   while (moveAmount != 0)
   {
-    if (g_currentPiece.TryMove(moveDelta, 0))
+    if (g.m_currentPiece.TryMove(moveDelta, 0))
     {
       moveAndRotationCount++;
     }
@@ -1756,7 +6508,7 @@ void Controller::ProcessInput()
   const Input& input = g.GetInput();
   if (input.WasButtonPressed(k_rotateCwButton))
   {
-    if (g_currentPiece.TryRotate(RotationDirection::Clockwise))
+    if (g.m_currentPiece.TryRotate(RotationDirection::Clockwise))
     {
       moveAndRotationCount++;
     }
@@ -1764,14 +6516,14 @@ void Controller::ProcessInput()
 
   if (input.WasButtonPressed(k_rotateCcwButton))
   {
-    if (g_currentPiece.TryRotate(RotationDirection::CounterClockwise))
+    if (g.m_currentPiece.TryRotate(RotationDirection::CounterClockwise))
     {
       moveAndRotationCount++;
     }
   }
 
   // Successful moves and rotations decrements the lock down movement counter
-  g_currentPiece.DecrementMoveLockDownCounter(moveAndRotationCount);
+  g.m_currentPiece.DecrementMoveLockDownCounter(moveAndRotationCount);
 
   // Handle drop input
   m_isSoftDrop = input.IsButtonDown(k_softDropButton);
@@ -1779,11 +6531,27 @@ void Controller::ProcessInput()
   bool hardDropButtonDown = input.IsButtonDown(k_hardDropButton);
   if (hardDropButtonDown && !m_hardDropButtonWasDown)
   {
-    g_currentPiece.DoHardDrop();
+    g.m_currentPiece.DoHardDrop();
   }
   m_hardDropButtonWasDown = hardDropButtonDown;
 }
 
+void Controller::Save(BitWriter& writer) const
+{
+  writer.Write(m_ticksUntilAutoRepeatLeft, sizeof(m_ticksUntilAutoRepeatLeft) * 8);
+  writer.Write(m_ticksUntilAutoRepeatRight, sizeof(m_ticksUntilAutoRepeatRight) * 8);
+  writer.Write(m_isSoftDrop, 1);
+  writer.Write(m_hardDropButtonWasDown, 1);
+}
+
+void Controller::Load(BitReader& reader)
+{
+  m_ticksUntilAutoRepeatLeft = reader.Read(sizeof(m_ticksUntilAutoRepeatLeft) * 8);
+  m_ticksUntilAutoRepeatRight = reader.Read(sizeof(m_ticksUntilAutoRepeatRight) * 8);
+  m_isSoftDrop = reader.Read(1);
+  m_hardDropButtonWasDown = reader.Read(1);
+}
+
 uint8 GameMode::GetFallTime() const
 {
   // Formula for calculating fall speed based on level is...
@@ -1804,18 +6572,48 @@ uint8 GameMode::GetFallTime() const
   return pgm_read_byte_near(k_fallSpeeds + Min(levelIndex, k_numFallSpeeds));
 }
 
-void GameMode::DrawStats() const
-{
-  arduboy.setTextBackground(BLACK);
-  arduboy.setTextColor(WHITE);
-  arduboy.setCursorX(0);
-  arduboy.setCursorY(16);
-  arduboy.print(F("Score\n"));
-  arduboy.print(m_score);
-  arduboy.print(F("\n"));
-  arduboy.print(F("Level\n"));
-  arduboy.print(m_level);
-  arduboy.print(F("\n"));
-  arduboy.print(F("Lines\n"));
-  arduboy.print(m_totalLines);
+void GameMode::DrawStats()
+{
+  ProfileSection(DrawStats);
+  // Each label is on the line above its value, starting on the third line of the screen
+  m_drawnLabels[0].Draw(arduboy, 0, 2 * k_fontLineHeight, F("Score"));
+  m_drawnScore.Draw(0, 3, m_score);
+  m_drawnLabels[1].Draw(arduboy, 0, 4 * k_fontLineHeight, F("Level"));
+  m_drawnLevel.Draw(0, 5, m_level);
+  m_drawnLabels[2].Draw(arduboy, 0, 6 * k_fontLineHeight, F("Lines"));
+  m_drawnLines.Draw(0, 7, m_totalLines);
+}
+
+void GameMode::MarkStatsDirty()
+{
+  for (uint8 i = 0; i < countof(m_drawnLabels); i++)
+  {
+    m_drawnLabels[i].MarkDirty();
+  }
+  m_drawnScore.MarkDirty();
+  m_drawnLevel.MarkDirty();
+  m_drawnLines.MarkDirty();
+}
+
+void GameMode::Save(BitWriter& writer) const
+{
+  writer.Write(m_score, sizeof(m_score) * 8);
+  writer.Write(m_totalLines, sizeof(m_totalLines) * 8);
+  for (uint8 i = 0; i < uint8(GameplayStats::Count); i++)
+  {
+    writer.Write(m_stats[i], sizeof(m_stats[i]) * 8);
+  }
+  writer.Write(m_level, k_levelBits);
+}
+
+bool GameMode::Load(BitReader& reader)
+{
+  m_score = reader.Read(sizeof(m_score) * 8);
+  m_totalLines = reader.Read(sizeof(m_totalLines) * 8);
+  for (uint8 i = 0; i < uint8(GameplayStats::Count); i++)
+  {
+    m_stats[i] = reader.Read(sizeof(m_stats[i]) * 8);
+  }
+  m_level = reader.Read(k_levelBits);
+  return (m_level >= k_minStartingLevel) && (m_level <= k_maxLevel);
 }
@@ -0,0 +1,105 @@
+// Samples the buttons from a timer interrupt about a thousand times a second, instead of once a frame.
+// Presses and releases are debounced and queued with the time they happened, so the game can see taps that
+// were over before the next frame started, and can time auto-repeat from the moment a button went down.
+
+// Timer 0 already interrupts at this rate to count millis(), so sampling borrows its other compare interrupt
+constexpr uint16 k_buttonSampleMicros = (64UL * 256 * 1000000) / F_CPU;
+// A button has to read the same for this many samples in a row before it counts as changed
+constexpr uint8 k_buttonDebounceSamples = 4;
+// Must be a power of two
+constexpr uint8 k_buttonEventQueueSize = 8;
+static_assert((k_buttonEventQueueSize & (k_buttonEventQueueSize - 1)) == 0, "Button event queue size must be a power of two");
+
+// A change to the debounced state of one or more buttons
+struct ButtonEvent
+{
+  uint8 buttonDownFlags;  // State of all the buttons after the change
+  uint8 changedFlags;     // Buttons that were pressed or released
+  uint8 sampleTime;       // Sample the change started on. Wraps every 256 samples.
+};
+
+// The interrupt is the only producer and the game loop is the only consumer of the queue. Each side only
+// writes its own end of it, and single bytes are read and written atomically, so neither side has to
+// disable interrupts.
+class ButtonSampler
+{
+public:
+  // Starts sampling from the timer interrupt
+  void Begin();
+  // Adds a sample of the raw button state. Called from the interrupt.
+  void Sample(uint8 rawButtonDownFlags);
+
+  // Returns 'false' if there aren't any changes waiting
+  bool PopEvent(ButtonEvent& outEvent);
+  uint8 GetButtonDownFlags() const { return m_buttonDownFlags; }
+  uint8 GetSampleTime() const { return m_sampleTime; }
+
+private:
+  // Each button has a 2-bit counter of how many samples in a row it's been different from its debounced state.
+  // The counters are split across two bytes so every button's can be updated at once.
+  uint8 m_debounceCountLow = 0;
+  uint8 m_debounceCountHigh = 0;
+  volatile uint8 m_buttonDownFlags = 0;
+  volatile uint8 m_sampleTime = 0;
+
+  volatile ButtonEvent m_events[k_buttonEventQueueSize];
+  volatile uint8 m_eventHead = 0;   // Written by the interrupt
+  volatile uint8 m_eventTail = 0;   // Written by the game loop
+};
+PER_THREAD ButtonSampler g_buttonSampler;
+
+ISR(TIMER0_COMPB_vect)
+{
+  g_buttonSampler.Sample(Arduboy2Core::buttonsState());
+}
+
+
+void ButtonSampler::Begin()
+{
+  // Anywhere in the timer's count works, as long as the compare match happens once per overflow
+  OCR0B = 0x80;
+  TIMSK0 |= _BV(OCIE0B);
+}
+
+void ButtonSampler::Sample(uint8 rawButtonDownFlags)
+{
+  m_sampleTime++;
+  const uint8 differentFlags = rawButtonDownFlags ^ m_buttonDownFlags;
+  // Counters of buttons that read the same as their debounced state are reset, and the rest are incremented
+  m_debounceCountHigh = (m_debounceCountHigh ^ m_debounceCountLow) & differentFlags;
+  m_debounceCountLow = ~m_debounceCountLow & differentFlags;
+  // Counters wrap back to 0 on the k_buttonDebounceSamples'th sample in a row
+  static_assert(k_buttonDebounceSamples == 4, "Debounce counters are 2 bits");
+  const uint8 changedFlags = differentFlags & ~(m_debounceCountLow | m_debounceCountHigh);
+  if (changedFlags == 0)
+  {
+    return;
+  }
+  m_buttonDownFlags ^= changedFlags;
+
+  const uint8 head = m_eventHead;
+  const uint8 nextHead = (head + 1) & (k_buttonEventQueueSize - 1);
+  if (nextHead == m_eventTail)
+  {
+    // The queue is full. The game still sees the new state, but not when it changed.
+    return;
+  }
+  m_events[head].buttonDownFlags = m_buttonDownFlags;
+  m_events[head].changedFlags = changedFlags;
+  m_events[head].sampleTime = m_sampleTime - (k_buttonDebounceSamples - 1);
+  m_eventHead = nextHead;
+}
+
+bool ButtonSampler::PopEvent(ButtonEvent& outEvent)
+{
+  const uint8 tail = m_eventTail;
+  if (tail == m_eventHead)
+  {
+    return false;
+  }
+  outEvent.buttonDownFlags = m_events[tail].buttonDownFlags;
+  outEvent.changedFlags = m_events[tail].changedFlags;
+  outEvent.sampleTime = m_events[tail].sampleTime;
+  m_eventTail = (tail + 1) & (k_buttonEventQueueSize - 1);
+  return true;
+}
@@ -2,9 +2,9 @@
 // Note: If this is defined before the types, I get compiler errors?!?
 #ifdef DEBUGGING_ENABLED
   // TODO: Figure out how to use __FlashStringHelper* string here to avoid eating up dynamic memory
-  static const char* s_stackTrace[10];
-  static short s_stackTraceLine[10];
-  static uint8 s_stackDepth = 0;
+  static PER_THREAD const char* s_stackTrace[10];
+  static PER_THREAD short s_stackTraceLine[10];
+  static PER_THREAD uint8 s_stackDepth = 0;
   class DebugStackTracker
   {
   public:
@@ -44,12 +44,16 @@
   #define DebugStack DebugStackTracker __debugStackTracker(__FUNCTION__, __LINE__)
 
 
-  char g_debugStr[80];
-  void DebugPrint(const __FlashStringHelper* msg) { Serial.print(msg); }
-  void DebugPrintLine(const __FlashStringHelper* msg) { Serial.println(msg); }
+  // Versus mode sends its messages over Serial, so nothing else can be written to it while a versus game is on.
+  // Logs and failed asserts are dropped until it's over. Defined after g.
+  bool IsDebugSerialAvailable();
+
+  PER_THREAD char g_debugStr[80];
+  void DebugPrint(const __FlashStringHelper* msg) { if (IsDebugSerialAvailable()) { Serial.print(msg); } }
+  void DebugPrintLine(const __FlashStringHelper* msg) { if (IsDebugSerialAvailable()) { Serial.println(msg); } }
   void __AssertFunction(const char* func, int line, bool condition, const __FlashStringHelper* msg = nullptr)
   {
-    if (!condition)
+    if (!condition && IsDebugSerialAvailable())
     {
       Serial.print(F("Assert Failed! "));
       Serial.print(func);
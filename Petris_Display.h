@@ -0,0 +1,148 @@
+// Sends only the parts of the frame buffer that changed to the screen, instead of all 1KB of it every frame.
+// Anything that writes to the frame buffer has to mark what it touched, or the change won't show up until
+// something else near it gets sent.
+// The screen is an SSD1306 in horizontal addressing mode. Its column and page address commands set a window,
+// and bytes sent after that fill the window left to right, then top to bottom.
+
+constexpr uint8 k_displayNumPages = HEIGHT / 8;
+
+class PartialDisplay
+{
+public:
+  PartialDisplay() { MarkClean(); MarkAllDirty(); }
+
+  // Marks columns [left, left + width) of pages 'firstPage' to 'lastPage' as changed.
+  // Pages below the screen are ignored.
+  void MarkDirty(uint8 left, uint8 width, uint8 firstPage, uint8 lastPage);
+  // Marks every page a rectangle of pixels touches as changed
+  void MarkRectDirty(uint8 x, uint8 y, uint8 width, uint8 height) { MarkDirty(x, width, y / 8, (y + height - 1) / 8); }
+  void MarkAllDirty() { MarkDirty(0, WIDTH, 0, k_displayNumPages - 1); }
+  // Returns true if any of columns [left, left + width) of pages 'firstPage' to 'lastPage' have changed
+  bool IsDirty(uint8 left, uint8 width, uint8 firstPage, uint8 lastPage) const;
+  bool IsRectDirty(uint8 x, uint8 y, uint8 width, uint8 height) const { return IsDirty(x, width, y / 8, (y + height - 1) / 8); }
+
+  // Returns how many bytes a Flush() would send, including commands
+  uint16 GetNumBytesToSend() const { return Process(false); }
+  // Sends everything that changed to the screen. Returns the number of bytes sent, including commands.
+  uint16 Flush();
+  // Forgets about changes without sending them
+  void MarkClean();
+
+private:
+  // Number of command bytes needed to set the window before sending data
+  static constexpr uint8 k_windowCommandBytes = 6;
+
+  uint16 Process(bool send) const;
+  static void SendWindow(uint8 left, uint8 right, uint8 firstPage, uint8 lastPage);
+
+  // The changed part of each page is columns [m_dirtyLeft, m_dirtyRight). Nothing changed if left >= right.
+  uint8 m_dirtyLeft[k_displayNumPages];
+  uint8 m_dirtyRight[k_displayNumPages];
+};
+PER_THREAD PartialDisplay g_display;
+
+
+void PartialDisplay::MarkDirty(uint8 left, uint8 width, uint8 firstPage, uint8 lastPage)
+{
+  const uint8 right = left + width;
+  // Rects are clipped by drawing, so they can reach past the bottom of the screen
+  const uint8 endPage = Min<uint8>(lastPage, k_displayNumPages - 1) + 1;
+  for (uint8 page = firstPage; page < endPage; page++)
+  {
+    m_dirtyLeft[page] = Min(m_dirtyLeft[page], left);
+    m_dirtyRight[page] = Max(m_dirtyRight[page], right);
+  }
+}
+
+bool PartialDisplay::IsDirty(uint8 left, uint8 width, uint8 firstPage, uint8 lastPage) const
+{
+  const uint8 right = left + width;
+  const uint8 endPage = Min<uint8>(lastPage, k_displayNumPages - 1) + 1;
+  for (uint8 page = firstPage; page < endPage; page++)
+  {
+    if ((m_dirtyLeft[page] < right) && (left < m_dirtyRight[page]))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint16 PartialDisplay::Flush()
+{
+  const uint16 numBytes = Process(true);
+  MarkClean();
+  return numBytes;
+}
+
+void PartialDisplay::MarkClean()
+{
+  memset(m_dirtyLeft, WIDTH, sizeof(m_dirtyLeft));
+  memset(m_dirtyRight, 0, sizeof(m_dirtyRight));
+}
+
+// Groups the changed pages into windows and counts, and optionally sends, the bytes for each of them
+uint16 PartialDisplay::Process(bool send) const
+{
+  uint16 numBytes = 0;
+  uint8 firstPage = 0;
+  while (firstPage < k_displayNumPages)
+  {
+    uint8 left = m_dirtyLeft[firstPage];
+    uint8 right = m_dirtyRight[firstPage];
+    if (left >= right)
+    {
+      firstPage++;
+      continue;
+    }
+
+    // Grow the window down a page at a time while that sends fewer bytes than starting another window
+    uint8 lastPage = firstPage;
+    while (lastPage + 1 < k_displayNumPages)
+    {
+      const uint8 nextLeft = m_dirtyLeft[lastPage + 1];
+      const uint8 nextRight = m_dirtyRight[lastPage + 1];
+      const uint8 mergedLeft = Min(left, nextLeft);
+      const uint8 mergedRight = Max(right, nextRight);
+      const uint8 numPages = lastPage - firstPage + 1;
+      const uint16 mergedBytes = uint16(mergedRight - mergedLeft) * (numPages + 1);
+      const uint16 separateBytes = (uint16(right - left) * numPages) + ((nextLeft < nextRight) ? (nextRight - nextLeft) + k_windowCommandBytes : 0);
+      if (mergedBytes > separateBytes)
+      {
+        break;
+      }
+      left = mergedLeft;
+      right = mergedRight;
+      lastPage++;
+    }
+
+    if (send)
+    {
+      SendWindow(left, right, firstPage, lastPage);
+    }
+    numBytes += k_windowCommandBytes + (uint16(right - left) * (lastPage - firstPage + 1));
+    firstPage = lastPage + 1;
+  }
+  return numBytes;
+}
+
+// static
+void PartialDisplay::SendWindow(uint8 left, uint8 right, uint8 firstPage, uint8 lastPage)
+{
+  // Column address and page address commands, each followed by the first and last (inclusive) to write to
+  Arduboy2::sendLCDCommand(0x21);
+  Arduboy2::sendLCDCommand(left);
+  Arduboy2::sendLCDCommand(right - 1);
+  Arduboy2::sendLCDCommand(0x22);
+  Arduboy2::sendLCDCommand(firstPage);
+  Arduboy2::sendLCDCommand(lastPage);
+  // sendLCDCommand() leaves the screen expecting data
+  for (uint8 page = firstPage; page <= lastPage; page++)
+  {
+    const uint8* const pageBytes = &Arduboy2::sBuffer[page * WIDTH];
+    for (uint8 x = left; x < right; x++)
+    {
+      Arduboy2::SPItransfer(pageBytes[x]);
+    }
+  }
+}
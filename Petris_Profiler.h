@@ -0,0 +1,273 @@
+// Define PROFILING_ENABLED to time sections of every frame and show the results in an overlay
+#ifdef PROFILING_ENABLED
+  // Parts of a frame that get timed
+  // Time spent in a nested section isn't counted in the section that contains it
+  enum class ProfileSectionId : uint8
+  {
+    Input,
+    Logic,      // Everything in Global::Loop that isn't one of the other sections
+    GridDraw,
+    DrawShadow,
+    DrawStats,
+    Display,
+    Count
+  };
+
+  // Rows of stats after the sections
+  constexpr uint8 k_profileTotalRow = uint8(ProfileSectionId::Count);          // Total time for the frame
+  constexpr uint8 k_profileDisplayBytesRow = k_profileTotalRow + 1;            // Bytes sent to the screen
+  constexpr uint8 k_profileIdleRow = k_profileDisplayBytesRow + 1;             // Percentage of frames that were idle
+  constexpr uint8 k_profileCpuRow = k_profileIdleRow + 1;                      // Milliseconds per second the CPU is awake
+  constexpr uint8 k_profileBatteryRow = k_profileCpuRow + 1;                   // Estimated minutes a full battery would last
+  constexpr uint8 k_numProfileRows = k_profileBatteryRow + 1;
+
+  // Names need to fit in 3 characters so a row of the overlay fits across the screen
+  const char k_profileRowNames[k_numProfileRows][4] PROGMEM =
+  {
+    "Inp", "Lgc", "Grd", "Shd", "Sta", "Dsp", "Tot", "Snt", "Idl", "Cpu", "Bat"
+  };
+
+  // Rough current draws for estimating battery life. These are assumed figures, not currents measured on an Arduboy,
+  // so the overlay labels battery life as an estimate.
+  // The CPU sleeps in arduboy.idle() while it waits for the next frame, so only the time it's awake costs the difference.
+  constexpr uint32 k_batteryCapacityMah = 180;
+  constexpr uint32 k_cpuAwakeMicroAmps = 12000;   // ATmega32U4 running at 16MHz
+  constexpr uint32 k_cpuAsleepMicroAmps = 5000;   // ATmega32U4 in idle sleep
+  constexpr uint32 k_boardMicroAmps = 10000;      // Screen and everything else
+
+  // Number of frames the min/avg/max are measured over
+  constexpr uint8 k_profileHistorySize = 16;
+
+  class Profiler
+  {
+  public:
+    // Adds time to a section for the current frame
+    void AddTime(ProfileSectionId section, uint16 elapsedMicros) { m_frameMicros[uint8(section)] += elapsedMicros; }
+    // Sets how many bytes the current frame sends to the screen
+    void SetDisplayBytes(uint16 numBytes) { m_frameDisplayBytes = numBytes; }
+    // Sets whether the current frame was idle, ie. skipped everything but counting down timers
+    void SetFrameIdle(bool idle) { m_frameIdle = idle; }
+    // Adds time the CPU spent asleep in arduboy.idle() since the last frame
+    void AddSleepTime(uint32 elapsedMicros) { m_sleepMicros += elapsedMicros; }
+    // Must be called once at the end of every frame to move the frame's times into the history
+    void EndFrame();
+
+    // Shows the next page of the overlay, or hides it after the last page
+    void NextOverlayPage() { m_overlayPage = OverlayPage((uint8(m_overlayPage) + 1) % uint8(OverlayPage::Count)); }
+    // Draws the overlay on top of everything if it's being shown
+    void DrawOverlay(Arduboy2& screen) const;
+    // Gets stats for one of the rows over the history
+    void GetStats(uint8 row, uint16& outMin, uint16& outAvg, uint16& outMax) const;
+
+  private:
+    // There isn't room on screen for every row at once
+    enum class OverlayPage : uint8
+    {
+      Hidden,
+      Times,    // Sections and total
+      Display,  // Bytes sent to the screen
+      Power,    // Idle frames, CPU time, and battery life
+      Count
+    };
+
+    uint16 GetHistory(uint8 row, uint8 historyIndex) const;
+    // Draws a row of stats on a line of the screen
+    void DrawRow(Arduboy2& screen, uint8 row, uint8 line) const;
+    static void PrintRightAligned(Arduboy2& screen, uint16 value, uint8 width);
+
+    uint16 m_frameMicros[uint8(ProfileSectionId::Count)] = {};
+    uint16 m_frameDisplayBytes = 0;
+    bool m_frameIdle = false;
+    uint16 m_history[uint8(ProfileSectionId::Count)][k_profileHistorySize] = {};
+    uint16 m_displayBytesHistory[k_profileHistorySize] = {};
+    bool m_idleHistory[k_profileHistorySize] = {};
+    uint16 m_awakeHistory[k_profileHistorySize] = {};   // Milliseconds per second spent outside of arduboy.idle()
+    uint32 m_sleepMicros = 0;
+    uint32 m_lastEndFrameMicros = 0;
+    uint8 m_historyIndex = 0;
+    uint8 m_historyCount = 0;
+    OverlayPage m_overlayPage = OverlayPage::Hidden;
+  };
+  Profiler g_profiler;
+
+  // Times from construction to destruction and adds the time to a section
+  class ProfileScope
+  {
+  public:
+    ProfileScope(ProfileSectionId section) :
+      m_startMicros(micros()),
+      m_outerNestedMicros(s_nestedMicros),
+      m_section(section)
+    {
+      s_nestedMicros = 0;
+    }
+    ~ProfileScope()
+    {
+      const uint16 elapsedMicros = uint16(micros() - m_startMicros);
+      g_profiler.AddTime(m_section, elapsedMicros - s_nestedMicros);
+      // Let the enclosing section know this much of its time was spent elsewhere
+      s_nestedMicros = m_outerNestedMicros + elapsedMicros;
+    }
+
+  private:
+    // Time spent in sections nested inside the innermost active scope
+    static uint16 s_nestedMicros;
+
+    uint32 m_startMicros;
+    uint16 m_outerNestedMicros;
+    ProfileSectionId m_section;
+  };
+  uint16 ProfileScope::s_nestedMicros = 0;
+
+  // Usage: Put at the top of a block to add the time spent in the rest of the block to the section
+  #define ProfileSection(section) ProfileScope __profileScope(ProfileSectionId::section)
+
+
+  void Profiler::EndFrame()
+  {
+    for (uint8 i = 0; i < uint8(ProfileSectionId::Count); i++)
+    {
+      m_history[i][m_historyIndex] = m_frameMicros[i];
+      m_frameMicros[i] = 0;
+    }
+    m_displayBytesHistory[m_historyIndex] = m_frameDisplayBytes;
+    m_frameDisplayBytes = 0;
+    m_idleHistory[m_historyIndex] = m_frameIdle;
+    m_frameIdle = false;
+    // Everything since the last frame that wasn't spent asleep, including interrupts and the loop checking the pacer,
+    // measured against how long the frame really took, since frames that run long make the next one late
+    const uint32 endFrameMicros = micros();
+    const uint32 frameMicros = Max<uint32>(endFrameMicros - m_lastEndFrameMicros, 1);
+    m_lastEndFrameMicros = endFrameMicros;
+    uint32 awakeMicros = frameMicros - Min(m_sleepMicros, frameMicros);
+    m_sleepMicros = 0;
+    uint32 scaledFrameMicros = frameMicros;
+    // Scaled down together after a long stall, so multiplying by 1000 doesn't overflow
+    while (scaledFrameMicros > 0xFFFF)
+    {
+      scaledFrameMicros >>= 1;
+      awakeMicros >>= 1;
+    }
+    m_awakeHistory[m_historyIndex] = uint16((awakeMicros * 1000) / scaledFrameMicros);
+    m_historyIndex = (m_historyIndex + 1) % k_profileHistorySize;
+    m_historyCount = Min<uint8>(m_historyCount + 1, k_profileHistorySize);
+  }
+
+  uint16 Profiler::GetHistory(uint8 row, uint8 historyIndex) const
+  {
+    if (row < uint8(ProfileSectionId::Count))
+    {
+      return m_history[row][historyIndex];
+    }
+    if (row == k_profileDisplayBytesRow)
+    {
+      return m_displayBytesHistory[historyIndex];
+    }
+    if (row == k_profileIdleRow)
+    {
+      // The average over the history comes out as a percentage
+      return m_idleHistory[historyIndex] ? 100 : 0;
+    }
+    if (row == k_profileCpuRow)
+    {
+      return m_awakeHistory[historyIndex];
+    }
+    if (row == k_profileBatteryRow)
+    {
+      // As if every frame kept the CPU awake as long as this one
+      const uint32 microAmps = k_boardMicroAmps + k_cpuAsleepMicroAmps + (((k_cpuAwakeMicroAmps - k_cpuAsleepMicroAmps) * m_awakeHistory[historyIndex]) / 1000);
+      return (k_batteryCapacityMah * 1000 * 60) / microAmps;
+    }
+    uint16 total = 0;
+    for (uint8 i = 0; i < uint8(ProfileSectionId::Count); i++)
+    {
+      total += m_history[i][historyIndex];
+    }
+    return total;
+  }
+
+  void Profiler::GetStats(uint8 row, uint16& outMin, uint16& outAvg, uint16& outMax) const
+  {
+    outMin = 0xFFFF;
+    outMax = 0;
+    uint32 sum = 0;
+    for (uint8 i = 0; i < m_historyCount; i++)
+    {
+      const uint16 sample = GetHistory(row, i);
+      outMin = Min(outMin, sample);
+      outMax = Max(outMax, sample);
+      sum += sample;
+    }
+    outAvg = (m_historyCount > 0) ? uint16(sum / m_historyCount) : 0;
+    outMin = Min(outMin, outMax);
+  }
+
+  // static
+  void Profiler::PrintRightAligned(Arduboy2& screen, uint16 value, uint8 width)
+  {
+    uint8 digits = 1;
+    for (uint16 v = value; v >= 10; v /= 10)
+    {
+      digits++;
+    }
+    for (; digits < width; digits++)
+    {
+      screen.print(' ');
+    }
+    screen.print(value);
+  }
+
+  void Profiler::DrawRow(Arduboy2& screen, uint8 row, uint8 line) const
+  {
+    uint16 minValue, avgValue, maxValue;
+    GetStats(row, minValue, avgValue, maxValue);
+    screen.setCursor(0, line * 8);
+    screen.print((const __FlashStringHelper*)k_profileRowNames[row]);
+    PrintRightAligned(screen, avgValue, 6);
+    PrintRightAligned(screen, minValue, 6);
+    PrintRightAligned(screen, maxValue, 6);
+  }
+
+  void Profiler::DrawOverlay(Arduboy2& screen) const
+  {
+    if (m_overlayPage == OverlayPage::Hidden)
+    {
+      return;
+    }
+    // Each row is a 3 character name followed by three 6 character columns, which is the 21 characters that fit across the screen
+    screen.setTextBackground(BLACK);
+    screen.setTextColor(WHITE);
+    screen.setCursor(0, 0);
+    uint8 numLines = 1;
+    if (m_overlayPage == OverlayPage::Times)
+    {
+      screen.print(F("us    avg   min   max"));
+      for (uint8 row = 0; row <= k_profileTotalRow; row++)
+      {
+        DrawRow(screen, row, numLines++);
+      }
+    }
+    else if (m_overlayPage == OverlayPage::Display)
+    {
+      // Doesn't include the overlay, which is sent every frame it's shown
+      screen.print(F("B     avg   min   max"));
+      DrawRow(screen, k_profileDisplayBytesRow, numLines++);
+    }
+    else
+    {
+      // Idle is a percentage of frames, CPU is milliseconds awake per second, and battery is minutes
+      screen.print(F("      avg   min   max"));
+      for (uint8 row = k_profileIdleRow; row <= k_profileBatteryRow; row++)
+      {
+        DrawRow(screen, row, numLines++);
+      }
+      // Idle and CPU are measured, but battery life only comes from the assumed currents above
+      screen.setCursor(0, numLines++ * 8);
+      screen.print(F("Bat is an estimate"));
+    }
+    g_display.MarkDirty(0, WIDTH, 0, numLines - 1);
+  }
+
+#else // #ifdef PROFILING_ENABLED
+  #define ProfileSection(section) {}
+#endif // #else // #ifdef PROFILING_ENABLED
@@ -0,0 +1,109 @@
+// Text that stays in the frame buffer from one frame to the next, and is only drawn again when what it shows
+// changes or when something else has drawn over it.
+// Everything here is drawn white on black, so drawing it again always covers what was there.
+
+// Size of a character printed with the default font, including the space after it
+constexpr uint8 k_fontCharWidth = 6;
+constexpr uint8 k_fontLineHeight = 8;
+
+// The digits of the default font, so numbers drawn here look the same as printed ones.
+// Each column is a byte with the top pixel in bit 0, the same as the frame buffer.
+constexpr uint8 k_digitGlyphWidth = 5;
+const uint8 k_digitGlyphs[10][k_digitGlyphWidth] PROGMEM =
+{
+  { 0x3E, 0x51, 0x49, 0x45, 0x3E },
+  { 0x00, 0x42, 0x7F, 0x40, 0x00 },
+  { 0x72, 0x49, 0x49, 0x49, 0x46 },
+  { 0x21, 0x41, 0x49, 0x4D, 0x33 },
+  { 0x18, 0x14, 0x12, 0x7F, 0x10 },
+  { 0x27, 0x45, 0x45, 0x45, 0x39 },
+  { 0x3C, 0x4A, 0x49, 0x49, 0x31 },
+  { 0x41, 0x21, 0x11, 0x09, 0x07 },
+  { 0x36, 0x49, 0x49, 0x49, 0x36 },
+  { 0x46, 0x49, 0x49, 0x29, 0x1E }
+};
+
+// Copies the digits of 'value' straight into a page of the frame buffer, starting at column 'x'.
+// Doesn't mark anything dirty. Returns how many columns were drawn.
+uint8 DrawNumber(uint8 x, uint8 page, uint32 value);
+
+// A number that's only drawn when it changes. It always starts at the top of a page.
+class RetainedNumber
+{
+public:
+  // Makes the next Draw() draw even if the number hasn't changed, ie. after the screen was cleared
+  void MarkDirty() { m_drawnWidth = 0; }
+  void Draw(uint8 x, uint8 page, uint32 value);
+
+private:
+  uint32 m_drawnValue;
+  uint8 m_drawnWidth;   // 0 if it needs to be drawn
+};
+
+// Text from PROGMEM that's only drawn when it changes
+class RetainedText
+{
+public:
+  // Makes the next Draw() draw even if the text hasn't changed, ie. after the screen was cleared
+  void MarkDirty() { m_drawnText = nullptr; }
+  // Returns 'true' if the text was drawn, so anything that goes with it can be drawn too
+  bool Draw(Arduboy2& screen, uint8 x, uint8 y, const __FlashStringHelper* text);
+
+private:
+  const __FlashStringHelper* m_drawnText;   // nullptr if it needs to be drawn
+  uint8 m_drawnWidth;
+};
+
+
+uint8 DrawNumber(uint8 x, uint8 page, uint32 value)
+{
+  uint8 digits[10];
+  uint8 numDigits = 0;
+  do
+  {
+    digits[numDigits++] = value % 10;
+    value /= 10;
+  } while (value > 0);
+
+  uint8* column = &Arduboy2::sBuffer[(page * WIDTH) + x];
+  while (numDigits > 0)
+  {
+    memcpy_P(column, k_digitGlyphs[digits[--numDigits]], k_digitGlyphWidth);
+    column[k_digitGlyphWidth] = 0;
+    column += k_fontCharWidth;
+  }
+  return column - &Arduboy2::sBuffer[(page * WIDTH) + x];
+}
+
+void RetainedNumber::Draw(uint8 x, uint8 page, uint32 value)
+{
+  if ((m_drawnWidth != 0) && (value == m_drawnValue) && !g_display.IsDirty(x, m_drawnWidth, page, page))
+  {
+    return;
+  }
+  const uint8 width = DrawNumber(x, page, value);
+  if (width < m_drawnWidth)
+  {
+    // Erase the end of a longer number that was there before
+    memset(&Arduboy2::sBuffer[(page * WIDTH) + x + width], 0, m_drawnWidth - width);
+  }
+  g_display.MarkDirty(x, Max(width, m_drawnWidth), page, page);
+  m_drawnValue = value;
+  m_drawnWidth = width;
+}
+
+bool RetainedText::Draw(Arduboy2& screen, uint8 x, uint8 y, const __FlashStringHelper* text)
+{
+  if ((text == m_drawnText) && !g_display.IsRectDirty(x, y, m_drawnWidth, k_fontLineHeight))
+  {
+    return false;
+  }
+  screen.setTextBackground(BLACK);
+  screen.setTextColor(WHITE);
+  screen.setCursor(x, y);
+  screen.print(text);
+  m_drawnWidth = screen.getCursorX() - x;
+  g_display.MarkRectDirty(x, y, m_drawnWidth, k_fontLineHeight);
+  m_drawnText = text;
+  return true;
+}
@@ -7,16 +7,16 @@
 
 // TEST - runs unit tests instead of the game
 #if defined CONFIGURATION_TEST
-  #if defined(CONFIGURATION_DEBUG) || defined (CONFIGURATION_RELEASE)
+  #if defined(CONFIGURATION_DEBUG) || defined (CONFIGURATION_RELEASE) || defined (CONFIGURATION_BENCHMARK) || defined (CONFIGURATION_PROFILE) || defined (CONFIGURATION_SOAK)
     #error Multiple configurations were defined! Only one is allowed.
   #endif
   #define TEST_BUILD
   //#define GAME_BUILD
   #define DEBUGGING_ENABLED
 
-// DEBUG - runs the game with debug features enabled
+// DEBUG - runs the game with debug features enabled. Logging is off during versus games, which use the same Serial port.
 #elif defined CONFIGURATION_DEBUG
-  #if defined(CONFIGURATION_TEST) || defined (CONFIGURATION_RELEASE)
+  #if defined(CONFIGURATION_TEST) || defined (CONFIGURATION_RELEASE) || defined (CONFIGURATION_BENCHMARK) || defined (CONFIGURATION_PROFILE) || defined (CONFIGURATION_SOAK)
     #error Multiple configurations were defined! Only one is allowed.
   #endif
   //#define TEST_BUILD
@@ -25,17 +25,55 @@
 
 // RELEASE - runs the game without any debugging
 #elif defined CONFIGURATION_RELEASE
-  #if defined(CONFIGURATION_TEST) || defined (CONFIGURATION_DEBUG)
+  #if defined(CONFIGURATION_TEST) || defined (CONFIGURATION_DEBUG) || defined (CONFIGURATION_BENCHMARK) || defined (CONFIGURATION_PROFILE) || defined (CONFIGURATION_SOAK)
     #error Multiple configurations were defined! Only one is allowed.
   #endif
   //#define TEST_BUILD
   #define GAME_BUILD
   //#define DEBUGGING_ENABLED   // Debugging is not enabled for release builds
 
+// BENCHMARK - times core game functions and a scripted game, and reports the results over Serial and on screen
+#elif defined CONFIGURATION_BENCHMARK
+  #if defined(CONFIGURATION_TEST) || defined (CONFIGURATION_DEBUG) || defined (CONFIGURATION_RELEASE) || defined (CONFIGURATION_PROFILE) || defined (CONFIGURATION_SOAK)
+    #error Multiple configurations were defined! Only one is allowed.
+  #endif
+  //#define TEST_BUILD
+  //#define GAME_BUILD
+  #define BENCHMARK_BUILD
+  //#define DEBUGGING_ENABLED   // Asserts and logging would skew the timings
+
+// PROFILE - runs the game with an overlay showing how long each part of a frame takes
+#elif defined CONFIGURATION_PROFILE
+  #if defined(CONFIGURATION_TEST) || defined (CONFIGURATION_DEBUG) || defined (CONFIGURATION_RELEASE) || defined (CONFIGURATION_BENCHMARK) || defined (CONFIGURATION_SOAK)
+    #error Multiple configurations were defined! Only one is allowed.
+  #endif
+  //#define TEST_BUILD
+  #define GAME_BUILD
+  #define PROFILING_ENABLED
+  //#define DEBUGGING_ENABLED   // Asserts and logging would skew the timings
+
+// SOAK - the bot plays games back to back with nothing drawn, and reports lines/score/level distributions over Serial
+#elif defined CONFIGURATION_SOAK
+  #if defined(CONFIGURATION_TEST) || defined (CONFIGURATION_DEBUG) || defined (CONFIGURATION_RELEASE) || defined (CONFIGURATION_BENCHMARK) || defined (CONFIGURATION_PROFILE)
+    #error Multiple configurations were defined! Only one is allowed.
+  #endif
+  //#define TEST_BUILD
+  //#define GAME_BUILD
+  #define SOAK_BUILD
+  //#define DEBUGGING_ENABLED   // Can be enabled to soak test with Asserts, but the extra logging slows games down a lot
+
 #else
   #error No valid build configuration defined!
 #endif
 
+// Host builds can run several games at once, one per thread (see "docs/Host Builds.md"), so anything a game
+// changes has one copy per thread there. The Arduboy only has the one.
+#ifdef HOST_BUILD
+  #define PER_THREAD thread_local
+#else
+  #define PER_THREAD
+#endif
+
 //--------------------------------------------------------------------------
 // Build configuration
 //==========================================================================
@@ -52,6 +90,7 @@ using uint16 = uint16_t;
 using int16 = int16_t;
 using uint32 = uint32_t;
 using int32 = int32_t;
+using uint64 = uint64_t;
 
 // Aliased types for giving the illusion of type-safety
 // Some day, maybe these will be replaced with a templated type-safe solution?
@@ -69,9 +108,28 @@ using GameTicks = uint8;
 template<typename T>
 constexpr T Min(T a, T b) { return (a <= b) ? a : b; }
 
+template<typename T>
+constexpr T Max(T a, T b) { return (a >= b) ? a : b; }
+
 template<typename T>
 constexpr uint8 countof(const T& a) { return sizeof(a) / sizeof(a[0]); }
 
+// Number of bits needed to store any value in [0, count)
+constexpr uint8 BitsFor(uint32 count) { return (count <= 1) ? 0 : 1 + BitsFor((count + 1) / 2); }
+static_assert((BitsFor(1) == 0) && (BitsFor(2) == 1) && (BitsFor(7) == 3) && (BitsFor(8) == 3) && (BitsFor(9) == 4), "BitsFor is broken");
+
+// SelectType<condition, A, B>::Type is 'A' if 'condition' is true, otherwise 'B'
+template<bool condition, typename A, typename B>
+struct SelectType { using Type = A; };
+template<typename A, typename B>
+struct SelectType<false, A, B> { using Type = B; };
+
+// Smallest unsigned type with at least 'numBits' bits
+template<uint8 numBits>
+using UintForBits = typename SelectType<(numBits <= 8), uint8,
+                    typename SelectType<(numBits <= 16), uint16,
+                    typename SelectType<(numBits <= 32), uint32, uint64>::Type>::Type>::Type;
+
 //--------------------------------------------------------------------------
 // Utility functions
 //==========================================================================
@@ -445,3 +445,41 @@ constexpr uint8 PROGMEM BlockSprites[] =
 
 static_assert(sizeof(BlockSprites) == int(BlockIndex::Count) * BlockSprites[0] * (BlockSprites[1] / 8) + 2,
   "Sanity check to make sure BlockIndex enum and BlockSprites array are the same size");
+
+// 4x4 versions of the block sprites, for when the grid is drawn with large blocks.
+// They're made from the 3x3 sprites by doubling the middle row and column, so lines through the middle
+// of a block still meet the lines of the blocks next to it.
+constexpr uint8 k_largeBlockSize = 4;
+
+// Bit 0 is the top pixel of a column, so the middle pixel (bit 1) is copied into bit 2 and the bottom pixel moves to bit 3
+constexpr uint8 ScaleBlockSpriteColumn(uint8 column)
+{
+  return (column & 0x03) | ((column & 0x06) << 1);
+}
+
+constexpr uint8 GetLargeBlockSpriteColumn(uint8 block, uint8 largeColumn)
+{
+  return ScaleBlockSpriteColumn(BlockSprites[2 + (block * BlockSprites[0]) + ((largeColumn + 1) / 2)]);
+}
+
+#define MakeLargeBlockSprite(block) \
+  GetLargeBlockSpriteColumn(block, 0), GetLargeBlockSpriteColumn(block, 1), GetLargeBlockSpriteColumn(block, 2), GetLargeBlockSpriteColumn(block, 3)
+#define MakeLargeBlockSprites4(block) \
+  MakeLargeBlockSprite(block), MakeLargeBlockSprite(block + 1), MakeLargeBlockSprite(block + 2), MakeLargeBlockSprite(block + 3)
+#define MakeLargeBlockSprites16(block) \
+  MakeLargeBlockSprites4(block), MakeLargeBlockSprites4(block + 4), MakeLargeBlockSprites4(block + 8), MakeLargeBlockSprites4(block + 12)
+
+constexpr uint8 PROGMEM LargeBlockSprites[] =
+{
+  // width, height,
+  k_largeBlockSize, 8,
+  MakeLargeBlockSprites16(0x00),
+  MakeLargeBlockSprites16(0x10),
+  MakeLargeBlockSprites16(0x20),
+  MakeLargeBlockSprites16(0x30),
+};
+
+static_assert(sizeof(LargeBlockSprites) == int(BlockIndex::Count) * LargeBlockSprites[0] * (LargeBlockSprites[1] / 8) + 2,
+  "Every BlockIndex needs a large sprite");
+static_assert((GetLargeBlockSpriteColumn(uint8(BlockIndex::Donut), 0) == 0x0F) && (GetLargeBlockSpriteColumn(uint8(BlockIndex::Donut), 1) == 0x09),
+  "Large sprites should be the small sprites with the middle doubled");
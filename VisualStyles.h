@@ -257,21 +257,101 @@ constexpr const uint8* k_visualStyles[] PROGMEM =
 };
 static_assert(countof(k_visualStyles) == uint8(VisualStyle::Count), "Make sure data matches the enum");
 
+// A visual style resolved into the block for every piece, orientation, and block in the piece,
+// so looking up a block is a single array read instead of decoding the style data from PROGMEM
+class ResolvedVisualStyle
+{
+  public:
+    static constexpr uint8 k_numBlocksPerPiece = 4;
+    static constexpr uint8 k_numBlocks = uint8(PieceOrientation::Count) * k_numBlocksPerPiece;
+
+    // Does nothing if this style is already resolved for this piece
+    void Resolve(VisualStyle visualStyle, PieceIndex pieceIndex);
+    bool IsResolved(VisualStyle visualStyle, PieceIndex pieceIndex) const { return (m_visualStyle == visualStyle) && (m_pieceIndex == pieceIndex); }
+    const BlockIndex* GetBlocks() const { return m_blocks; }
+
+    static constexpr uint8 GetBlockOffset(PieceOrientation orientation, uint8 index)
+    {
+      return (uint8(orientation) * k_numBlocksPerPiece) + index;
+    }
+
+  private:
+    // Starts out not matching any style so nothing uses it until it's resolved
+    VisualStyle m_visualStyle = VisualStyle::Count;
+    PieceIndex m_pieceIndex = PieceIndex::Invalid;
+    BlockIndex m_blocks[k_numBlocks];
+};
+
+// Only the current piece and its shadow are drawn every frame, so only those are kept resolved, at 18 bytes each.
+// Resolving every piece of both styles took 226 bytes. Anything else still works, it just decodes the PROGMEM data.
+constexpr uint8 k_resolvedPieceSlot = 0;
+constexpr uint8 k_resolvedShadowSlot = 1;
+constexpr uint8 k_numResolvedVisualStyles = 2;
+PER_THREAD ResolvedVisualStyle g_resolvedVisualStyles[k_numResolvedVisualStyles];
+
 class VisualStyleHelper
 {
   public:
-    VisualStyleHelper(VisualStyle visualStyle) : m_visualStyle(visualStyle) {}
+    VisualStyleHelper(VisualStyle visualStyle, PieceIndex pieceIndex);
+
+    BlockIndex GetBlock(PieceOrientation orientation, uint8 index) const
+    {
+      Assert(index < ResolvedVisualStyle::k_numBlocksPerPiece);
+      if (m_resolvedBlocks != nullptr)
+      {
+        return m_resolvedBlocks[ResolvedVisualStyle::GetBlockOffset(orientation, index)];
+      }
+      return GetUnresolvedBlockForPiece(m_visualStyle, m_pieceIndex, orientation, index);
+    }
 
-    BlockIndex GetBlockForPiece(PieceIndex pieceIndex, PieceOrientation orientation, uint8 index) const;
+    // Decodes the block from the style data in PROGMEM
+    static BlockIndex GetUnresolvedBlockForPiece(VisualStyle visualStyle, PieceIndex pieceIndex, PieceOrientation orientation, uint8 index);
 
   private:
     VisualStyle m_visualStyle;
+    PieceIndex m_pieceIndex;
+    // Points into one of the g_resolvedVisualStyles if m_visualStyle is resolved for m_pieceIndex
+    const BlockIndex* m_resolvedBlocks;
 };
 
-BlockIndex VisualStyleHelper::GetBlockForPiece(PieceIndex pieceIndex, PieceOrientation orientation, uint8 index) const
+void ResolvedVisualStyle::Resolve(VisualStyle visualStyle, PieceIndex pieceIndex)
+{
+  if (IsResolved(visualStyle, pieceIndex))
+  {
+    return;
+  }
+  uint8 offset = 0;
+  for (uint8 orientation = 0; orientation < uint8(PieceOrientation::Count); orientation++)
+  {
+    for (uint8 index = 0; index < k_numBlocksPerPiece; index++)
+    {
+      m_blocks[offset++] = VisualStyleHelper::GetUnresolvedBlockForPiece(visualStyle, pieceIndex, PieceOrientation(orientation), index);
+    }
+  }
+  m_visualStyle = visualStyle;
+  m_pieceIndex = pieceIndex;
+}
+
+VisualStyleHelper::VisualStyleHelper(VisualStyle visualStyle, PieceIndex pieceIndex) :
+  m_visualStyle(visualStyle),
+  m_pieceIndex(pieceIndex),
+  m_resolvedBlocks(nullptr)
+{
+  for (uint8 i = 0; i < k_numResolvedVisualStyles; i++)
+  {
+    if (g_resolvedVisualStyles[i].IsResolved(visualStyle, pieceIndex))
+    {
+      m_resolvedBlocks = g_resolvedVisualStyles[i].GetBlocks();
+      break;
+    }
+  }
+}
+
+// static
+BlockIndex VisualStyleHelper::GetUnresolvedBlockForPiece(VisualStyle visualStyle, PieceIndex pieceIndex, PieceOrientation orientation, uint8 index)
 {
   Assert(index < 4);
-  uint8* pgm_styleData = pgm_read_word(&k_visualStyles[uint8(m_visualStyle)]);
+  const uint8* pgm_styleData = reinterpret_cast<const uint8*>(pgm_read_ptr(&k_visualStyles[uint8(visualStyle)]));
   uint8 firstByte = pgm_read_byte(&pgm_styleData[0]);
 
   BlockIndex blockIndex;
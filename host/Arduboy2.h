@@ -0,0 +1,212 @@
+// Stands in for the Arduboy2 library so the sketch can be built and run on a computer (see "docs/Host Builds.md").
+// Only what the sketch uses is here. Drawing goes to the same sBuffer layout as the real library, and the screen
+// is simulated closely enough that partial updates from Petris_Display.h end up in the right place. Everything is
+// per thread, the same as the sketch's PER_THREAD globals, so each thread is its own Arduboy.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+//==========================================================================
+// avr-libc and Arduino core
+//--------------------------------------------------------------------------
+// Flash and RAM are the same thing here
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_byte_near(address) pgm_read_byte(address)
+#define pgm_read_ptr(address) (*(address))
+#define pgm_read_dword(address) (*(address))
+#define memcpy_P memcpy
+// pgm_read_word() is used on tables of pointers as well as on 16-bit values
+template <typename T> inline T HostReadWord(const T* address) { return *address; }
+inline uint16_t HostReadWord(const uint8_t* address) { return uint16_t(address[0] | (address[1] << 8)); }
+#define pgm_read_word(address) HostReadWord(address)
+#define pgm_read_word_near(address) pgm_read_word(address)
+
+typedef char __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper*)(s))
+
+#define _BV(bit) (1 << (bit))
+#define F_CPU 16000000UL
+#define cli()
+#define sei()
+#define noInterrupts()
+#define interrupts()
+
+// Timer 0's compare B interrupt samples the buttons (see Petris_Buttons.h). nextFrame() calls it once a millisecond,
+// and idle() once for each time it wakes up.
+extern thread_local uint8_t OCR0B;
+extern thread_local uint8_t TIMSK0;
+#define OCIE0B 2
+#define ISR(vector) void vector()
+void TIMER0_COMPB_vect();
+
+// Time is simulated by default, so the same inputs always play out the same way. See HostSetRealTime().
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+inline long random(long max) { return (max != 0) ? (rand() % max) : 0; }
+inline long random(long min, long max) { return (min < max) ? (min + (rand() % (max - min))) : min; }
+inline void randomSeed(unsigned long seed) { srand(seed); }
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t value) = 0;
+
+  size_t print(const char* text);
+  size_t print(char value) { return write(value); }
+  size_t print(unsigned long value);
+  size_t print(long value);
+  size_t print(unsigned int value) { return print((unsigned long)value); }
+  size_t print(int value) { return print((long)value); }
+  size_t print(unsigned short value) { return print((unsigned long)value); }
+  size_t print(short value) { return print((long)value); }
+  size_t print(unsigned char value) { return print((unsigned long)value); }
+  size_t println() { return write('\n'); }
+  template <typename T> size_t println(T value) { const size_t count = print(value); return count + println(); }
+};
+
+// Writes go to stdout unless HostSerial::Open() gave it a file descriptor, and reads come from that file descriptor
+class HostSerial : public Print
+{
+public:
+  void begin(long) {}
+  operator bool() const { return true; }
+  int available();
+  int read();
+  int availableForWrite();
+  size_t write(uint8_t value) override;
+
+  // Sends and receives over 'fd' (ie. a pty), the way a versus game talks to the relay
+  void Open(int fd);
+  // Keeps a copy of everything written, so a host driver can check what the sketch printed
+  void StartCapture() { m_capture = true; m_captured.clear(); }
+  const char* GetCaptured() const { return m_captured.c_str(); }
+
+private:
+  int m_fd = -1;
+  bool m_capture = false;
+  std::string m_captured;
+  uint8_t m_readBuffer[64];
+  uint8_t m_readStart = 0;
+  uint8_t m_readCount = 0;
+};
+extern thread_local HostSerial Serial;
+
+//==========================================================================
+// Arduboy2
+//--------------------------------------------------------------------------
+#define UP_BUTTON _BV(7)
+#define RIGHT_BUTTON _BV(6)
+#define LEFT_BUTTON _BV(5)
+#define DOWN_BUTTON _BV(4)
+#define A_BUTTON _BV(3)
+#define B_BUTTON _BV(2)
+#define WHITE 1
+#define BLACK 0
+#define WIDTH 128
+#define HEIGHT 64
+
+// Buttons the host driver is holding down
+extern thread_local uint8_t g_hostButtons;
+
+class Arduboy2 : public Print
+{
+public:
+  static thread_local uint8_t sBuffer[WIDTH * HEIGHT / 8];
+
+  void begin() {}
+  void setFrameRate(uint8_t) {}
+  void setFrameDuration(uint8_t) {}
+  // Runs the millisecond interrupts and moves the simulated clock on to the next frame. The host drivers call
+  // loop() once per 1/60s, so that's how far the clock goes whatever the frame duration is set to.
+  bool nextFrame();
+  // Sleeps until timer 0's next interrupt, every 1.024ms like the real one, and runs the interrupt
+  static void idle();
+  bool everyXFrames(uint8_t) { return true; }
+  int cpuLoad() { return 0; }
+  uint16_t generateRandomSeed() { return uint16_t(micros()); }
+
+  bool pressed(uint8_t buttons) { return (g_hostButtons & buttons) == buttons; }
+  static uint8_t buttonsState() { return g_hostButtons; }
+
+  // Sends the whole buffer to the screen
+  void display();
+  void clear() { memset(sBuffer, 0, sizeof(sBuffer)); }
+
+  static void drawPixel(int16_t x, int16_t y, uint8_t color = WHITE);
+  static uint8_t getPixel(uint8_t x, uint8_t y) { return (sBuffer[((y / 8) * WIDTH) + x] >> (y & 7)) & 1; }
+  void fillRect(int16_t x, int16_t y, uint8_t w, uint8_t h, uint8_t color = WHITE);
+  void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint8_t color = WHITE);
+
+  void setCursor(int16_t x, int16_t y) { m_cursorX = x; m_cursorY = y; }
+  void setCursorX(int16_t x) { m_cursorX = x; }
+  void setCursorY(int16_t y) { m_cursorY = y; }
+  int16_t getCursorX() const { return m_cursorX; }
+  int16_t getCursorY() const { return m_cursorY; }
+  void setTextColor(uint8_t color) { m_textColor = color; }
+  void setTextBackground(uint8_t color) { m_textBackground = color; }
+  // Draws a made up 6x8 glyph for each character. Digits look like digits, everything else only needs to be
+  // different from other characters so screen checksums change when text does.
+  size_t write(uint8_t value) override;
+  using Print::print;
+
+  // The screen is driven the same way as the SSD1306, in horizontal addressing mode, so it ends up with whatever
+  // partial updates were sent to it
+  static void sendLCDCommand(uint8_t command);
+  static void SPItransfer(uint8_t data);
+  // What's on the screen, in the same layout as sBuffer
+  static const uint8_t* GetScreen() { return s_screen; }
+  // Bytes sent to the screen so far, for measuring partial updates
+  static uint32_t GetNumScreenBytes() { return s_numScreenBytes; }
+  // Simulated time spent asleep in idle() so far
+  static uint32_t GetIdleMicros() { return s_idleMicros; }
+
+private:
+  static thread_local uint8_t s_screen[WIDTH * HEIGHT / 8];
+  static thread_local uint8_t s_firstColumn;
+  static thread_local uint8_t s_lastColumn;
+  static thread_local uint8_t s_firstPage;
+  static thread_local uint8_t s_lastPage;
+  static thread_local uint8_t s_column;
+  static thread_local uint8_t s_page;
+  static thread_local uint8_t s_command[3];
+  static thread_local uint8_t s_commandLength;
+  static thread_local bool s_isDataMode;
+  static thread_local uint32_t s_numScreenBytes;
+  static thread_local uint32_t s_idleMicros;
+
+  uint32_t m_nextFrameMicros = 0;
+  bool m_hasStarted = false;
+  int16_t m_cursorX = 0;
+  int16_t m_cursorY = 0;
+  uint8_t m_textColor = WHITE;
+  uint8_t m_textBackground = BLACK;
+};
+typedef Arduboy2 Arduboy2Core;
+
+class Sprites
+{
+public:
+  static void drawExternalMask(int16_t x, int16_t y, const uint8_t* bitmap, const uint8_t* mask, uint8_t frame, uint8_t maskFrame);
+  static void drawOverwrite(int16_t x, int16_t y, const uint8_t* bitmap, uint8_t frame);
+};
+
+//==========================================================================
+// Host only
+//--------------------------------------------------------------------------
+// Makes micros() and millis() read the computer's clock instead of the simulated one, for timing things.
+// nextFrame() stops moving the clock along and always says a frame is due.
+void HostSetRealTime(bool realTime);
+// How long each call to loop() is simulated as taking, for sketches that wait with nextFrame(). Defaults to 1/60s.
+void HostSetLoopMicros(uint32_t loopMicros);
+// Calls loop() until this much simulated time has passed, for sketches that wait by sleeping in idle()
+void HostLoopFor(uint32_t loopMicros);
@@ -0,0 +1,82 @@
+// Times the sketch's hot paths (the BENCHMARK configuration) on the computer, with the computer's clock.
+// The numbers aren't the Arduboy's, but they move the same way when the code changes, and are quicker to get.
+//
+// Usage: petris_benchmark [--quick]
+//   --quick  Runs each benchmark for a few milliseconds instead of a few hundred, to check they still work
+
+#include "Petris.cpp"
+
+#include <chrono>
+
+struct HostBenchmark
+{
+  const char* name;
+  void (*function)(uint16 iterations);
+  uint16 iterations;
+};
+
+// The same benchmarks, and iterations per call, as the on-device ones that use RunBenchmark()
+const HostBenchmark k_hostBenchmarks[] =
+{
+  {"DoesPieceFitInGrid", BenchmarkDoesPieceFitInGrid, 1000},
+  {"TryRotate", BenchmarkTryRotate, 1000},
+  {"ProcessFullLines", BenchmarkProcessFullLines, 200},
+  {"GridCopy", BenchmarkGridCopy, 200},
+  {"GridDrawFull", BenchmarkGridDrawFull, 50},
+  {"GridDrawUnchanged", BenchmarkGridDrawUnchanged, 1000},
+  {"GetBlockForPiece", BenchmarkGetBlockForPiece, 1000},
+  {"DrawStatsFull", BenchmarkDrawStatsFull, 100},
+  {"DrawStatsUnchanged", BenchmarkDrawStatsUnchanged, 1000},
+};
+
+constexpr uint16 k_scriptedGameFrames = 3000;
+
+static int64_t GetNanoseconds()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char** argv)
+{
+  const bool quick = (argc > 1) && (strcmp(argv[1], "--quick") == 0);
+  const int64_t minNanoseconds = quick ? 5000000 : 300000000;
+  HostSetRealTime(true);
+  setup();
+
+  for (const HostBenchmark& benchmark : k_hostBenchmarks)
+  {
+    // Every benchmark starts from the same state, the same as RunBenchmark()
+    SetupBenchmarkGrid();
+    uint64_t iterations = 0;
+    const int64_t start = GetNanoseconds();
+    int64_t elapsed = 0;
+    while (elapsed < minNanoseconds)
+    {
+      benchmark.function(benchmark.iterations);
+      iterations += benchmark.iterations;
+      elapsed = GetNanoseconds() - start;
+    }
+    printf("%-20s %10.1f ns/op\n", benchmark.name, double(elapsed) / iterations);
+  }
+
+  // Plays BenchmarkScriptedGame's game, to see how many frames a second the computer can simulate
+  uint64_t frames = 0;
+  const int64_t start = GetNanoseconds();
+  int64_t elapsed = 0;
+  while (elapsed < minNanoseconds)
+  {
+    ResetGame();
+    uint8 step = 0;
+    uint8 framesLeftInStep = 0;
+    uint8 buttons = 0;
+    for (uint16 frame = 0; frame < k_scriptedGameFrames; frame++)
+    {
+      g.Loop(GetBenchmarkScriptButtons(step, framesLeftInStep, buttons));
+    }
+    frames += k_scriptedGameFrames;
+    elapsed = GetNanoseconds() - start;
+  }
+  const double framesPerSecond = (frames * 1e9) / elapsed;
+  printf("%-20s %10.0f frames/s (%.0fx real time)\n", "ScriptedGame", framesPerSecond, framesPerSecond / k_frameRate);
+  return 0;
+}
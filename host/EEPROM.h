@@ -0,0 +1,31 @@
+// Stands in for the Arduino EEPROM library in host builds (see "docs/Host Builds.md"). The EEPROM starts out
+// erased, the same as a new Arduboy, and lasts until the program exits.
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEPROM_STORAGE_SPACE_START 16
+#define E2END 1023
+
+inline bool eeprom_is_ready() { return true; }
+
+class EEPROMClass
+{
+public:
+  EEPROMClass() { memset(m_bytes, 0xFF, sizeof(m_bytes)); }
+
+  uint8_t read(int address) const { return m_bytes[address]; }
+  void write(int address, uint8_t value) { m_bytes[address] = value; m_numWrites++; }
+  // Only writes bytes that change, the same as the real one, so writes can be counted like wear would be
+  void update(int address, uint8_t value) { if (m_bytes[address] != value) { write(address, value); } }
+  template <typename T> T& get(int address, T& value) const { memcpy(&value, &m_bytes[address], sizeof(T)); return value; }
+
+  // Host only
+  uint32_t GetNumWrites() const { return m_numWrites; }
+
+private:
+  uint8_t m_bytes[E2END + 1];
+  uint32_t m_numWrites = 0;
+};
+extern thread_local EEPROMClass EEPROM;
@@ -0,0 +1,79 @@
+# Turns Petris.ino into a .cpp file that a regular C++ compiler can build, for the host builds.
+#
+# The Arduino IDE adds a prototype for every function in a sketch before compiling it, so functions can be called
+# before they're defined. This does the same thing for the functions in Petris.ino. It's simpler than what the
+# Arduino IDE does, and relies on the sketch's layout: a function's return type and name are on one line starting
+# in the first column, and its opening brace is on the next line by itself.
+#
+# Usage: python3 GeneratePrototypes.py Petris.ino Petris.cpp
+
+import re
+import sys
+
+# The prototypes go before this line. Every type has been declared by then, and no functions have been defined yet
+# that are called before they're defined.
+INSERT_BEFORE = "// Entry points for GAME_BUILD"
+FUNCTION_PATTERN = re.compile(r"^(static\s+)?[A-Za-z_][\w<>:,\s\*&]*\s[\*&]?([A-Za-z_]\w*)\s*\(.*\)\s*$")
+# constexpr functions are implicitly inline, so they have to be defined before they're used anyway
+NOT_FUNCTIONS = ("class", "struct", "enum", "template", "if", "else", "return", "switch", "constexpr")
+
+# A default argument can only be given once, and the definition already gives it
+def RemoveDefaultArguments(prototype):
+  start = prototype.index("(") + 1
+  end = prototype.rindex(")")
+  parameters = []
+  depth = 0
+  parameter = ""
+  for character in prototype[start:end]:
+    if (character == ",") and (depth == 0):
+      parameters.append(parameter)
+      parameter = ""
+      continue
+    if character in "(<[{":
+      depth += 1
+    elif character in ")>]}":
+      depth -= 1
+    parameter += character
+  parameters.append(parameter)
+  parameters = [parameter.split("=")[0].rstrip() for parameter in parameters]
+  return prototype[:start] + ",".join(parameters) + prototype[end:]
+
+def FindPrototypes(lines):
+  prototypes = []
+  for i in range(len(lines) - 1):
+    line = lines[i]
+    if not FUNCTION_PATTERN.match(line) or (lines[i + 1].strip() != "{"):
+      continue
+    # Member functions already have declarations in their classes
+    if "::" in line.split("(")[0]:
+      continue
+    if line.startswith(NOT_FUNCTIONS):
+      continue
+    prototypes.append(RemoveDefaultArguments(line.strip()) + ";")
+  return prototypes
+
+def Main():
+  if len(sys.argv) != 3:
+    print("Usage: python3 GeneratePrototypes.py <sketch.ino> <output.cpp>")
+    return 1
+  sketchPath = sys.argv[1]
+  with open(sketchPath) as sketchFile:
+    lines = sketchFile.read().split("\n")
+
+  insertIndex = next((i for i, line in enumerate(lines) if line.startswith(INSERT_BEFORE)), None)
+  if insertIndex is None:
+    print("{0}: couldn't find \"{1}\"".format(sketchPath, INSERT_BEFORE))
+    return 1
+  # The line before the marker is the top of its banner comment
+  insertIndex -= 1
+  # Line numbers in errors and asserts still match the sketch
+  output = ["#line 1 \"{0}\"".format(sketchPath)] + lines[:insertIndex]
+  output += FindPrototypes(lines)
+  output += ["#line {0} \"{1}\"".format(insertIndex + 1, sketchPath)] + lines[insertIndex:]
+
+  with open(sys.argv[2], "w") as outputFile:
+    outputFile.write("\n".join(output))
+  return 0
+
+if __name__ == "__main__":
+  sys.exit(Main())
@@ -0,0 +1,408 @@
+// Definitions for the Arduboy2 and EEPROM stand-ins in Arduboy2.h and EEPROM.h
+
+#include "Arduboy2.h"
+#include "EEPROM.h"
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+thread_local uint8_t OCR0B;
+thread_local uint8_t TIMSK0;
+thread_local uint8_t g_hostButtons;
+thread_local HostSerial Serial;
+thread_local EEPROMClass EEPROM;
+
+thread_local uint8_t Arduboy2::sBuffer[WIDTH * HEIGHT / 8];
+thread_local uint8_t Arduboy2::s_screen[WIDTH * HEIGHT / 8];
+thread_local uint8_t Arduboy2::s_firstColumn = 0;
+thread_local uint8_t Arduboy2::s_lastColumn = WIDTH - 1;
+thread_local uint8_t Arduboy2::s_firstPage = 0;
+thread_local uint8_t Arduboy2::s_lastPage = (HEIGHT / 8) - 1;
+thread_local uint8_t Arduboy2::s_column = 0;
+thread_local uint8_t Arduboy2::s_page = 0;
+thread_local uint8_t Arduboy2::s_command[3];
+thread_local uint8_t Arduboy2::s_commandLength = 0;
+thread_local bool Arduboy2::s_isDataMode = true;
+thread_local uint32_t Arduboy2::s_numScreenBytes = 0;
+thread_local uint32_t Arduboy2::s_idleMicros = 0;
+
+//==========================================================================
+// Time
+//--------------------------------------------------------------------------
+static thread_local bool s_isRealTime = false;
+static thread_local uint32_t s_loopMicros = 16667;
+static thread_local uint32_t s_simulatedMicros = 0;
+static const std::chrono::steady_clock::time_point s_startTime = std::chrono::steady_clock::now();
+
+// Every read of the simulated clock moves it on a little, so code that waits for time to pass doesn't wait forever
+static constexpr uint32_t k_microsPerRead = 3;
+// How long the simulated Arduboy spends between the end of a frame and starting the next one
+static constexpr uint32_t k_microsPerFrameStart = 50;
+static constexpr uint8_t k_interruptsPerFrame = 16;
+// Timer 0 overflows every 1.024ms at 16MHz, which is what wakes idle() up
+static constexpr uint32_t k_microsPerInterrupt = 1024;
+
+void HostSetRealTime(bool realTime)
+{
+  s_isRealTime = realTime;
+}
+
+void HostSetLoopMicros(uint32_t loopMicros)
+{
+  s_loopMicros = loopMicros;
+}
+
+// Every host driver is built with a sketch configuration, and each one has a loop()
+void loop();
+
+void HostLoopFor(uint32_t loopMicros)
+{
+  const uint32_t endMicros = s_simulatedMicros + loopMicros;
+  while (int32_t(s_simulatedMicros - endMicros) < 0)
+  {
+    loop();
+  }
+}
+
+unsigned long micros()
+{
+  if (s_isRealTime)
+  {
+    return (unsigned long)uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_startTime).count());
+  }
+  s_simulatedMicros += k_microsPerRead;
+  return s_simulatedMicros;
+}
+
+unsigned long millis()
+{
+  return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+  if (s_isRealTime)
+  {
+    usleep(ms * 1000);
+    return;
+  }
+  s_simulatedMicros += ms * 1000;
+}
+
+// static
+void Arduboy2::idle()
+{
+  if (s_isRealTime)
+  {
+    return;
+  }
+  const uint32_t wakeMicros = ((s_simulatedMicros / k_microsPerInterrupt) + 1) * k_microsPerInterrupt;
+  s_idleMicros += wakeMicros - s_simulatedMicros;
+  s_simulatedMicros = wakeMicros;
+  if (TIMSK0 & _BV(OCIE0B))
+  {
+    TIMER0_COMPB_vect();
+  }
+}
+
+bool Arduboy2::nextFrame()
+{
+  if (s_isRealTime)
+  {
+    return true;
+  }
+  if (TIMSK0 & _BV(OCIE0B))
+  {
+    for (uint8_t i = 0; i < k_interruptsPerFrame; i++)
+    {
+      TIMER0_COMPB_vect();
+    }
+  }
+  if (!m_hasStarted)
+  {
+    m_hasStarted = true;
+    m_nextFrameMicros = s_simulatedMicros;
+  }
+  else
+  {
+    m_nextFrameMicros += s_loopMicros;
+  }
+  // The last frame might have taken longer than a frame, in which case this one starts late
+  if (int32_t(s_simulatedMicros - m_nextFrameMicros) < 0)
+  {
+    s_simulatedMicros = m_nextFrameMicros;
+  }
+  s_simulatedMicros += k_microsPerFrameStart;
+  return true;
+}
+
+//==========================================================================
+// Print and Serial
+//--------------------------------------------------------------------------
+size_t Print::print(const char* text)
+{
+  size_t count = 0;
+  while (*text != '\0')
+  {
+    count += write(uint8_t(*text++));
+  }
+  return count;
+}
+
+size_t Print::print(unsigned long value)
+{
+  char text[24];
+  snprintf(text, sizeof(text), "%lu", value);
+  return print((const char*)text);
+}
+
+size_t Print::print(long value)
+{
+  char text[24];
+  snprintf(text, sizeof(text), "%ld", value);
+  return print((const char*)text);
+}
+
+void HostSerial::Open(int fd)
+{
+  m_fd = fd;
+  fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+}
+
+int HostSerial::available()
+{
+  if ((m_fd >= 0) && (m_readCount == 0))
+  {
+    const ssize_t numRead = ::read(m_fd, m_readBuffer, sizeof(m_readBuffer));
+    if (numRead > 0)
+    {
+      m_readStart = 0;
+      m_readCount = uint8_t(numRead);
+    }
+  }
+  return m_readCount;
+}
+
+int HostSerial::read()
+{
+  if (available() == 0)
+  {
+    return -1;
+  }
+  m_readCount--;
+  return m_readBuffer[m_readStart++];
+}
+
+int HostSerial::availableForWrite()
+{
+  // Same as the size of the Arduboy's USB serial buffer
+  return (m_fd >= 0) ? 64 : 0;
+}
+
+size_t HostSerial::write(uint8_t value)
+{
+  if (m_capture)
+  {
+    m_captured.push_back(char(value));
+  }
+  if (m_fd < 0)
+  {
+    fputc(value, stdout);
+    return 1;
+  }
+  while (::write(m_fd, &value, 1) < 0)
+  {
+    if ((errno != EAGAIN) && (errno != EINTR))
+    {
+      return 0;
+    }
+    usleep(100);
+  }
+  return 1;
+}
+
+//==========================================================================
+// Drawing
+//--------------------------------------------------------------------------
+void Arduboy2::display()
+{
+  sendLCDCommand(0x21);
+  sendLCDCommand(0);
+  sendLCDCommand(WIDTH - 1);
+  sendLCDCommand(0x22);
+  sendLCDCommand(0);
+  sendLCDCommand((HEIGHT / 8) - 1);
+  for (uint16_t i = 0; i < sizeof(sBuffer); i++)
+  {
+    SPItransfer(sBuffer[i]);
+  }
+}
+
+void Arduboy2::sendLCDCommand(uint8_t command)
+{
+  s_isDataMode = false;
+  SPItransfer(command);
+  s_isDataMode = true;
+}
+
+void Arduboy2::SPItransfer(uint8_t data)
+{
+  s_numScreenBytes++;
+  if (s_isDataMode)
+  {
+    s_screen[(s_page * WIDTH) + s_column] = data;
+    if (s_column == s_lastColumn)
+    {
+      s_column = s_firstColumn;
+      s_page = (s_page == s_lastPage) ? s_firstPage : (s_page + 1);
+    }
+    else
+    {
+      s_column++;
+    }
+    return;
+  }
+
+  // Only the column and page address commands matter; everything else is one byte that's ignored
+  s_command[s_commandLength++] = data;
+  if ((s_command[0] != 0x21) && (s_command[0] != 0x22))
+  {
+    s_commandLength = 0;
+    return;
+  }
+  if (s_commandLength < 3)
+  {
+    return;
+  }
+  if (s_command[0] == 0x21)
+  {
+    s_firstColumn = s_column = s_command[1];
+    s_lastColumn = s_command[2];
+  }
+  else
+  {
+    s_firstPage = s_page = s_command[1];
+    s_lastPage = s_command[2];
+  }
+  s_commandLength = 0;
+}
+
+void Arduboy2::drawPixel(int16_t x, int16_t y, uint8_t color)
+{
+  if ((x < 0) || (x >= WIDTH) || (y < 0) || (y >= HEIGHT))
+  {
+    return;
+  }
+  uint8_t& column = sBuffer[((y / 8) * WIDTH) + x];
+  if (color != BLACK)
+  {
+    column |= 1 << (y & 7);
+  }
+  else
+  {
+    column &= ~(1 << (y & 7));
+  }
+}
+
+void Arduboy2::fillRect(int16_t x, int16_t y, uint8_t w, uint8_t h, uint8_t color)
+{
+  for (int16_t dx = 0; dx < w; dx++)
+  {
+    for (int16_t dy = 0; dy < h; dy++)
+    {
+      drawPixel(x + dx, y + dy, color);
+    }
+  }
+}
+
+void Arduboy2::drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint8_t color)
+{
+  // Bresenham's, the same as the real library
+  const int16_t dx = abs(x1 - x0);
+  const int16_t dy = -abs(y1 - y0);
+  const int16_t stepX = (x0 < x1) ? 1 : -1;
+  const int16_t stepY = (y0 < y1) ? 1 : -1;
+  int16_t error = dx + dy;
+  while (true)
+  {
+    drawPixel(x0, y0, color);
+    if ((x0 == x1) && (y0 == y1))
+    {
+      break;
+    }
+    const int16_t error2 = 2 * error;
+    if (error2 >= dy)
+    {
+      error += dy;
+      x0 += stepX;
+    }
+    if (error2 <= dx)
+    {
+      error += dx;
+      y0 += stepY;
+    }
+  }
+}
+
+size_t Arduboy2::write(uint8_t value)
+{
+  static const uint8_t k_digits[10][5] =
+  {
+    {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00}, {0x72, 0x49, 0x49, 0x49, 0x46}, {0x21, 0x41, 0x49, 0x4D, 0x33},
+    {0x18, 0x14, 0x12, 0x7F, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39}, {0x3C, 0x4A, 0x49, 0x49, 0x31}, {0x41, 0x21, 0x11, 0x09, 0x07},
+    {0x36, 0x49, 0x49, 0x49, 0x36}, {0x46, 0x49, 0x49, 0x29, 0x1E}
+  };
+  if (value == '\n')
+  {
+    m_cursorX = 0;
+    m_cursorY += 8;
+    return 1;
+  }
+  for (uint8_t dx = 0; dx < 6; dx++)
+  {
+    uint8_t glyphColumn = 0;
+    if (dx < 5)
+    {
+      glyphColumn = ((value >= '0') && (value <= '9')) ? k_digits[value - '0'][dx] : uint8_t(((value * 31) + (dx * 7)) & 0x7F);
+    }
+    for (uint8_t dy = 0; dy < 8; dy++)
+    {
+      drawPixel(m_cursorX + dx, m_cursorY + dy, ((glyphColumn >> dy) & 1) ? m_textColor : m_textBackground);
+    }
+  }
+  m_cursorX += 6;
+  return 1;
+}
+
+// Sprites are a width and height byte, then frames of 8-pixel tall columns
+static void DrawSprite(int16_t x, int16_t y, const uint8_t* bitmap, uint8_t frame, const uint8_t* mask, uint8_t maskFrame)
+{
+  const uint8_t width = bitmap[0];
+  const uint8_t height = bitmap[1];
+  const uint16_t frameSize = width * ((height + 7) / 8);
+  const uint8_t* frameBytes = bitmap + 2 + (frame * frameSize);
+  const uint8_t* maskBytes = (mask != nullptr) ? (mask + 2 + (maskFrame * frameSize)) : nullptr;
+  for (uint8_t dx = 0; dx < width; dx++)
+  {
+    for (uint8_t dy = 0; dy < height; dy++)
+    {
+      const uint16_t offset = ((dy / 8) * width) + dx;
+      if ((maskBytes == nullptr) || ((maskBytes[offset] >> (dy & 7)) & 1))
+      {
+        Arduboy2::drawPixel(x + dx, y + dy, (frameBytes[offset] >> (dy & 7)) & 1);
+      }
+    }
+  }
+}
+
+void Sprites::drawExternalMask(int16_t x, int16_t y, const uint8_t* bitmap, const uint8_t* mask, uint8_t frame, uint8_t maskFrame)
+{
+  DrawSprite(x, y, bitmap, frame, mask, maskFrame);
+}
+
+void Sprites::drawOverwrite(int16_t x, int16_t y, const uint8_t* bitmap, uint8_t frame)
+{
+  DrawSprite(x, y, bitmap, frame, nullptr, 0);
+}
@@ -0,0 +1,96 @@
+// Checks that the game (the RELEASE configuration) sleeps between frames instead of spinning until the next one is
+// due, and that it still runs every frame on time. Exits with 0 if it does.
+// Built with the PROFILE configuration, it also checks the overlay's Cpu row agrees with how long it was awake.
+//
+// The host's simulated Arduboy only takes time to run code when it reads the clock, so nearly all of the time
+// should be spent asleep in arduboy.idle(). A loop that never calls it doesn't sleep at all.
+
+#include "Petris.cpp"
+
+// Simulated time each check runs for
+constexpr uint32 k_checkMicros = 10000000;
+constexpr uint32 k_microsPerFrame = 1000000 / k_frameRate;
+// The pacer is checked every time the sketch wakes up, so a frame can be up to a wake late
+constexpr uint32 k_maxFrameGapMicros = k_microsPerFrame + FramePacer::k_wakeMicros;
+// At least this much of every second has to be spent asleep
+constexpr uint32 k_minIdlePerMille = 900;
+#ifdef PROFILING_ENABLED
+// How far the profiler's Cpu row can be from the whole check's awake time. It only covers the last few frames, and
+// the clock reads around each sleep each move the clock on.
+constexpr uint16 k_maxCpuError = 5;
+#endif // #ifdef PROFILING_ENABLED
+
+// Runs the sketch like an Arduboy would, and checks it slept and ran the right number of frames
+static bool CheckSleeping(const char* name)
+{
+  uint32 numFrames = 0;
+  uint32 maxGapMicros = 0;
+  const uint32 startMicros = micros();
+  const uint32 startIdleMicros = Arduboy2::GetIdleMicros();
+  uint32 lastFrameMicros = startMicros;
+  // Reading the clock moves it on, so it's only read once a loop, to keep this from adding to the awake time
+  for (uint32 loopStartMicros = startMicros; loopStartMicros - startMicros < k_checkMicros; loopStartMicros = micros())
+  {
+    const uint32 idleMicros = Arduboy2::GetIdleMicros();
+    loop();
+    // Each call to loop() either runs the frames that are due or sleeps. Frames are timed from when they start,
+    // since the bot takes longer on some than others.
+    if (Arduboy2::GetIdleMicros() == idleMicros)
+    {
+      maxGapMicros = Max(maxGapMicros, loopStartMicros - lastFrameMicros);
+      lastFrameMicros = loopStartMicros;
+      numFrames++;
+    }
+  }
+  const uint32 elapsedMicros = micros() - startMicros;
+  const uint32 idlePerMille = uint32((uint64(Arduboy2::GetIdleMicros() - startIdleMicros) * 1000) / elapsedMicros);
+  const uint32 expectedFrames = elapsedMicros / k_microsPerFrame;
+
+  printf("%s: %u frames, %u.%u%% asleep, longest gap %uus\n", name, unsigned(numFrames), unsigned(idlePerMille / 10),
+    unsigned(idlePerMille % 10), unsigned(maxGapMicros));
+  bool passed = true;
+  if (idlePerMille < k_minIdlePerMille)
+  {
+    printf("FAILED: %s only slept %u.%u%% of the time\n", name, unsigned(idlePerMille / 10), unsigned(idlePerMille % 10));
+    passed = false;
+  }
+  if ((numFrames + 1 < expectedFrames) || (numFrames > expectedFrames + 1))
+  {
+    printf("FAILED: %s ran %u frames instead of %u\n", name, unsigned(numFrames), unsigned(expectedFrames));
+    passed = false;
+  }
+  if (maxGapMicros > k_maxFrameGapMicros)
+  {
+    printf("FAILED: %s went %uus without a frame\n", name, unsigned(maxGapMicros));
+    passed = false;
+  }
+#ifdef PROFILING_ENABLED
+  // Milliseconds per second awake, over the last few frames
+  uint16 minAwake, avgAwake, maxAwake;
+  g_profiler.GetStats(k_profileCpuRow, minAwake, avgAwake, maxAwake);
+  const uint32 awakePerMille = 1000 - idlePerMille;
+  if ((avgAwake + k_maxCpuError < awakePerMille) || (avgAwake > awakePerMille + k_maxCpuError))
+  {
+    printf("FAILED: %s profiler says the CPU was awake %u/1000 of the time instead of %u\n", name, unsigned(avgAwake), unsigned(awakePerMille));
+    passed = false;
+  }
+#endif // #ifdef PROFILING_ENABLED
+  return passed;
+}
+
+int main()
+{
+  setup();
+  bool passed = CheckSleeping("Menu");
+
+  GameSettings settings;
+  settings.randomSeed = 1;
+  settings.startingLevel = k_minStartingLevel;
+  settings.pieceStyle = VisualStyle::Donut;
+  settings.shadowStyle = VisualStyle::CenterDot;
+  settings.initialButtonDownFlags = 0;
+  g.StartGame(settings, false);
+  g.StartBot();
+  passed &= CheckSleeping("Bot game");
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,268 @@
+// Plays soak games (the SOAK configuration) on every core of the computer, to get through thousands of games in
+// the time an Arduboy plays a few. Each thread has its own Global, and everything else a game changes, so it's an
+// Arduboy of its own (see PER_THREAD).
+//
+// Usage: petris_soak [--threads <count>] [--games <count>] [--seed <seed>]
+//   --threads  Threads to play on. Defaults to one per core.
+//   --games    Games to play. Defaults to 1000.
+//   --seed     Seeds the random generator that picks each game's seed. Defaults to the Arduboy's k_soakRandomSeed,
+//              so the games are the same ones an Arduboy soak run plays, in the same order.
+// Prints the same report as the Arduboy, plus the games that failed, and exits with 1 if any did.
+//
+// Every game's seed is picked before any are played, so the results are the same however many threads there are.
+
+#include "Petris.cpp"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A game that places no pieces for this long has stalled, ie. the bot is stuck
+constexpr uint32 k_maxFramesPerPiece = 60 * k_frameRate;
+// A game that's still going after this long is stopped, so one that never ends can't hang the run
+constexpr uint32 k_maxFramesPerGame = 60 * 60 * k_frameRate;
+
+enum class SoakFailure : uint8
+{
+  None,
+  Stalled,
+  TooLong,
+};
+
+struct SoakGameResult
+{
+  SoakFailure failure;
+  uint32 frames;
+  uint16 pieces;
+};
+
+// Games waiting to be played by one thread. The thread takes them from the front, and threads that run out of
+// their own take from the back, so the threads finish at about the same time even though some games are much
+// longer than others.
+class SoakQueue
+{
+public:
+  void Push(uint32 gameIndex)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_games.push_back(gameIndex);
+  }
+  bool PopFront(uint32& outGameIndex)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_games.empty())
+    {
+      return false;
+    }
+    outGameIndex = m_games.front();
+    m_games.pop_front();
+    return true;
+  }
+  bool PopBack(uint32& outGameIndex)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_games.empty())
+    {
+      return false;
+    }
+    outGameIndex = m_games.back();
+    m_games.pop_back();
+    return true;
+  }
+
+private:
+  std::mutex m_mutex;
+  std::deque<uint32> m_games;
+};
+
+struct SoakWorker
+{
+  SoakQueue queue;
+  std::thread thread;
+  // Written by the worker's thread, and only read once it's finished
+  SoakStats stats;
+  uint32 gamesStolen = 0;
+};
+
+static std::vector<uint32> s_gameSeeds;
+static std::vector<SoakGameResult> s_gameResults;
+static std::vector<SoakWorker> s_workers;
+
+static bool TakeGame(uint8 workerIndex, uint32& outGameIndex)
+{
+  SoakWorker& worker = s_workers[workerIndex];
+  if (worker.queue.PopFront(outGameIndex))
+  {
+    return true;
+  }
+  // Starts with the next worker along, so the ones that run out first don't all go after the same queue
+  for (uint8 i = 1; i < s_workers.size(); i++)
+  {
+    if (s_workers[(workerIndex + i) % s_workers.size()].queue.PopBack(outGameIndex))
+    {
+      worker.gamesStolen++;
+      return true;
+    }
+  }
+  return false;
+}
+
+static SoakGameResult PlaySoakGame(uint32 randomSeed)
+{
+  StartSoakGame(randomSeed);
+  SoakGameResult result = {SoakFailure::None, 0, 0};
+  uint32 lastPieceFrame = 0;
+  while (g.m_gameState != GameState::GameOver)
+  {
+    g.Loop(0x00);
+    result.frames++;
+    const uint16 pieces = g.GetBot().GetPiecesPlaced();
+    if (pieces != result.pieces)
+    {
+      result.pieces = pieces;
+      lastPieceFrame = result.frames;
+    }
+    if (result.frames - lastPieceFrame > k_maxFramesPerPiece)
+    {
+      result.failure = SoakFailure::Stalled;
+      break;
+    }
+    if (result.frames >= k_maxFramesPerGame)
+    {
+      result.failure = SoakFailure::TooLong;
+      break;
+    }
+  }
+  return result;
+}
+
+static void RunWorker(uint8 workerIndex)
+{
+  ResetGame();
+  ResetSoakStats();
+  uint32 gameIndex;
+  while (TakeGame(workerIndex, gameIndex))
+  {
+    const SoakGameResult result = PlaySoakGame(s_gameSeeds[gameIndex]);
+    s_gameResults[gameIndex] = result;
+    // Failed games didn't finish, so they'd throw off the lines and score
+    if (result.failure == SoakFailure::None)
+    {
+      g_soakStats.frames += result.frames;
+      TrackSoakGame();
+    }
+  }
+  s_workers[workerIndex].stats = g_soakStats;
+}
+
+static void AddSoakStats(SoakStats& total, const SoakStats& stats)
+{
+  total.games += stats.games;
+  total.frames += stats.frames;
+  total.pieces += stats.pieces;
+  total.totalLines += stats.totalLines;
+  total.minLines = Min(total.minLines, stats.minLines);
+  total.maxLines = Max(total.maxLines, stats.maxLines);
+  total.minScore = Min(total.minScore, stats.minScore);
+  total.maxScore = Max(total.maxScore, stats.maxScore);
+  for (uint8 level = 0; level <= k_maxLevel; level++)
+  {
+    total.levelCounts[level] += stats.levelCounts[level];
+  }
+  for (uint8 i = 0; i < k_soakNumLinesBuckets; i++)
+  {
+    total.linesCounts[i] += stats.linesCounts[i];
+  }
+}
+
+int main(int argc, char** argv)
+{
+  uint32 numThreads = Max(std::thread::hardware_concurrency(), 1u);
+  uint32 numGames = 1000;
+  uint32 seed = k_soakRandomSeed;
+  for (int i = 1; i < argc; i++)
+  {
+    const bool hasValue = (i + 1 < argc);
+    if (hasValue && (strcmp(argv[i], "--threads") == 0))
+    {
+      numThreads = uint32(strtoul(argv[++i], nullptr, 0));
+    }
+    else if (hasValue && (strcmp(argv[i], "--games") == 0))
+    {
+      numGames = uint32(strtoul(argv[++i], nullptr, 0));
+    }
+    else if (hasValue && (strcmp(argv[i], "--seed") == 0))
+    {
+      seed = uint32(strtoul(argv[++i], nullptr, 0));
+    }
+    else
+    {
+      printf("Usage: petris_soak [--threads <count>] [--games <count>] [--seed <seed>]\n");
+      return 2;
+    }
+  }
+  numThreads = Min<uint32>(Max<uint32>(numThreads, 1), 255);
+  if (numGames == 0)
+  {
+    printf("Nothing to do with --games 0\n");
+    return 2;
+  }
+
+  // The same seeds setup() and loop() would use, one after another
+  Random seedRandom;
+  seedRandom.SetSeed(seed);
+  s_gameSeeds.resize(numGames);
+  for (uint32& gameSeed : s_gameSeeds)
+  {
+    gameSeed = seedRandom.Next32();
+  }
+  s_gameResults.resize(numGames);
+
+  // Each thread starts with an equal share, in order, and steals from the others when it runs out
+  s_workers = std::vector<SoakWorker>(numThreads);
+  for (uint32 gameIndex = 0; gameIndex < numGames; gameIndex++)
+  {
+    s_workers[(gameIndex * numThreads) / numGames].queue.Push(gameIndex);
+  }
+  // PrintSoakStats() times the run with millis(), which is the simulated clock unless this thread switches it
+  HostSetRealTime(true);
+  g_soakStartMillis = millis();
+  for (uint8 workerIndex = 0; workerIndex < numThreads; workerIndex++)
+  {
+    s_workers[workerIndex].thread = std::thread(RunWorker, workerIndex);
+  }
+  ResetSoakStats();
+  uint32 gamesStolen = 0;
+  for (SoakWorker& worker : s_workers)
+  {
+    worker.thread.join();
+    AddSoakStats(g_soakStats, worker.stats);
+    gamesStolen += worker.gamesStolen;
+  }
+
+  uint32 numStalled = 0;
+  uint32 numTooLong = 0;
+  for (uint32 gameIndex = 0; gameIndex < numGames; gameIndex++)
+  {
+    const SoakGameResult& result = s_gameResults[gameIndex];
+    if (result.failure == SoakFailure::None)
+    {
+      continue;
+    }
+    const bool stalled = (result.failure == SoakFailure::Stalled);
+    numStalled += stalled ? 1 : 0;
+    numTooLong += stalled ? 0 : 1;
+    printf("FAILED: game %u (seed 0x%08x) %s after %u frames and %u pieces\n", unsigned(gameIndex), unsigned(s_gameSeeds[gameIndex]),
+      stalled ? "stalled" : "was still going", unsigned(result.frames), unsigned(result.pieces));
+  }
+
+  printf("Threads: %u (%u games stolen)\n", unsigned(numThreads), unsigned(gamesStolen));
+  if (g_soakStats.games > 0)
+  {
+    PrintSoakStats();
+  }
+  printf("Failures: %u stalled, %u too long\n", unsigned(numStalled), unsigned(numTooLong));
+  return ((numStalled + numTooLong) == 0) ? 0 : 1;
+}
@@ -0,0 +1,61 @@
+// Runs the sketch's unit tests (the TEST configuration) on the computer. Exits with 0 if they all passed.
+// TestFailure fails one check on purpose, to show what a failure looks like, so it has to fail exactly that one.
+
+#include "Petris.cpp"
+
+// The tests run one per frame, starting on the second frame
+constexpr int k_numFrames = 64;
+
+int main()
+{
+  Serial.StartCapture();
+  setup();
+  for (int frame = 0; frame < k_numFrames; frame++)
+  {
+    loop();
+  }
+
+  // Each test prints "<name>: <passed>/<total>" when it's done
+  int numTests = 0;
+  int numFailedTests = 0;
+  bool sawTestFailure = false;
+  std::string output = Serial.GetCaptured();
+  size_t lineStart = 0;
+  while (lineStart < output.size())
+  {
+    size_t lineEnd = output.find('\n', lineStart);
+    if (lineEnd == std::string::npos)
+    {
+      lineEnd = output.size();
+    }
+    const std::string line = output.substr(lineStart, lineEnd - lineStart);
+    lineStart = lineEnd + 1;
+
+    // Names can have colons in them (ie. "Next::UnitTest"), so the counts are after the last ": "
+    const size_t separator = line.rfind(": ");
+    int passed;
+    int total;
+    char end;
+    if ((separator == std::string::npos) || (sscanf(line.c_str() + separator + 2, "%d/%d%c", &passed, &total, &end) != 2))
+    {
+      continue;
+    }
+    const std::string name = line.substr(0, separator);
+    numTests++;
+    const bool isTestFailure = (name == "TestFailure");
+    sawTestFailure |= isTestFailure;
+    if (isTestFailure ? (passed + 1 != total) : (passed != total))
+    {
+      printf("FAILED: %s\n", name.c_str());
+      numFailedTests++;
+    }
+  }
+
+  if (!sawTestFailure)
+  {
+    printf("FAILED: TestFailure didn't run\n");
+    numFailedTests++;
+  }
+  printf("%d tests, %d failed\n", numTests, numFailedTests);
+  return (numFailedTests == 0) ? 0 : 1;
+}
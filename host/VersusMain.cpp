@@ -0,0 +1,85 @@
+// Plays one versus game (the RELEASE configuration) over a file descriptor, for host/VersusPtyTest.py.
+// The sketch's own loop() does the talking, the same as on an Arduboy, so this only picks the buttons.
+//
+// Usage: petris_versus <fd> <bot|idle> <seed>
+//   bot   The sketch's bot plays, so it clears lines and sends garbage
+//   idle  Doesn't press anything, so pieces pile up in the middle until it tops out
+// When the game's over, prints the outcome, both grids, and the garbage totals, one "name=value" per line.
+
+#include "Petris.cpp"
+
+#include <unistd.h>
+
+// Slow enough that the bot clears some lines, and sends some garbage, before the idle player tops out
+constexpr uint8 k_versusTestLevel = 1;
+// Gives up if nobody has topped out after this long
+constexpr uint32 k_maxFrames = 60000;
+// Frames to keep running after the game ends, so the last messages get where they're going
+constexpr uint16 k_framesAfterGameOver = 120;
+// Each frame waits this long, so both games move along at about the same speed
+constexpr uint32 k_microsPerFrame = 250;
+
+static void PrintRows(const char* name, Grid::RowMask (*getRowMask)(uint8 y))
+{
+  printf("%s=", name);
+  for (uint8 y = 0; y < k_visibleGridHeight; y++)
+  {
+    printf("%s%03x", (y == 0) ? "" : ",", unsigned(getRowMask(y)));
+  }
+  printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 4)
+  {
+    printf("Usage: petris_versus <fd> <bot|idle> <seed>\n");
+    return 2;
+  }
+  const int fd = atoi(argv[1]);
+  const bool isBot = (strcmp(argv[2], "bot") == 0);
+  if (!isBot && (strcmp(argv[2], "idle") != 0))
+  {
+    printf("Unknown player '%s'\n", argv[2]);
+    return 2;
+  }
+  const uint32 seed = uint32(strtoul(argv[3], nullptr, 0));
+
+  setup();
+  Serial.Open(fd);
+  GameSettings settings;
+  settings.randomSeed = seed;
+  settings.startingLevel = k_versusTestLevel;
+  settings.pieceStyle = VisualStyle::Donut;
+  settings.shadowStyle = VisualStyle::CenterDot;
+  settings.initialButtonDownFlags = 0;
+  g.StartVersusGame(settings);
+  if (isBot)
+  {
+    g.StartBot();
+  }
+
+  uint32 frame = 0;
+  uint16 framesAfterGameOver = 0;
+  while ((framesAfterGameOver < k_framesAfterGameOver) && (frame < k_maxFrames))
+  {
+    // The bot's buttons replace these
+    g_hostButtons = 0;
+    // The sketch sleeps between frames, so this runs one frame and however many wake ups it takes to get to the next
+    HostLoopFor(1000000 / k_frameRate);
+    usleep(k_microsPerFrame);
+    frame++;
+    if (g.m_gameState == GameState::GameOver)
+    {
+      framesAfterGameOver++;
+    }
+  }
+
+  printf("result=%s\n", (g.m_gameState != GameState::GameOver) ? "timeout" : (g.m_versus.HasWon() ? "won" : "lost"));
+  printf("frames=%u\n", unsigned(frame));
+  PrintRows("grid", [](uint8 y) { return g.m_grid.GetRowMask(y); });
+  PrintRows("opponent", [](uint8 y) { return g.m_versus.GetOpponentRowMask(y); });
+  printf("sent=%u\n", unsigned(g.m_versus.GetSentGarbageTotal()));
+  printf("received=%u\n", unsigned(g.m_versus.GetReceivedGarbageTotal()));
+  return 0;
+}
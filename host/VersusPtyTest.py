@@ -0,0 +1,79 @@
+# Plays a versus game between two host builds of the sketch, connected through VersusRelay.py with Linux ptys.
+#
+# Each game gets the master end of a pty, the same as an Arduboy's end of its USB cable, and the relay opens the
+# slave ends by path, the same as it opens /dev/ttyACM0 and /dev/ttyACM1. So everything between the two games is
+# what would happen with real Arduboys plugged into this computer.
+#
+# One game is played by the sketch's bot, and the other one doesn't press anything until it tops out.
+# The test passes if:
+# - The game that topped out lost, and the other one won
+# - The winner's preview of the loser's grid matches the loser's grid
+# - The winner received all the garbage the loser sent, and the loser didn't receive more than the winner sent
+#
+# Usage: python3 VersusPtyTest.py <path to petris_versus>
+
+import os
+import subprocess
+import sys
+
+RELAY_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "VersusRelay.py")
+TIMEOUT_SECONDS = 120
+
+def ParseResults(output):
+  results = {}
+  for line in output.splitlines():
+    name, separator, value = line.partition("=")
+    if separator:
+      results[name] = value
+  return results
+
+def Main():
+  if len(sys.argv) != 2:
+    print("Usage: python3 VersusPtyTest.py <path to petris_versus>")
+    return 2
+  gamePath = sys.argv[1]
+
+  master1, slave1 = os.openpty()
+  master2, slave2 = os.openpty()
+  # The slave ends stay open here until the end, so a game never sees its pty hang up while the relay starts
+  relay = subprocess.Popen([sys.executable, RELAY_PATH, os.ttyname(slave1), os.ttyname(slave2)], stdout=subprocess.PIPE, universal_newlines=True)
+  # The relay says so once both ports are open and in raw mode
+  print(relay.stdout.readline().rstrip())
+
+  games = {
+    "bot": subprocess.Popen([gamePath, str(master1), "bot", "1"], pass_fds=(master1,), stdout=subprocess.PIPE, universal_newlines=True),
+    "idle": subprocess.Popen([gamePath, str(master2), "idle", "2"], pass_fds=(master2,), stdout=subprocess.PIPE, universal_newlines=True),
+  }
+  results = {}
+  try:
+    for name, game in games.items():
+      output, _ = game.communicate(timeout=TIMEOUT_SECONDS)
+      results[name] = ParseResults(output)
+      print("{0}: {1}".format(name, results[name]))
+  finally:
+    for game in games.values():
+      game.kill()
+    relay.kill()
+    relay.wait()
+    for fd in (master1, slave1, master2, slave2):
+      os.close(fd)
+
+  winner = results["bot"]
+  loser = results["idle"]
+  failures = []
+  if (winner.get("result") != "won") or (loser.get("result") != "lost"):
+    failures.append("expected bot to win and idle to lose, got {0} and {1}".format(winner.get("result"), loser.get("result")))
+  if winner.get("opponent") != loser.get("grid"):
+    failures.append("bot's preview of idle's grid doesn't match it")
+  if winner.get("received") != loser.get("sent"):
+    failures.append("bot received {0} garbage but idle sent {1}".format(winner.get("received"), loser.get("sent")))
+  # The winner can clear lines after its last message goes out, so the loser might not have heard about all of them
+  if int(loser.get("received", 0)) > int(winner.get("sent", 0)):
+    failures.append("idle received {0} garbage but bot only sent {1}".format(loser.get("received"), winner.get("sent")))
+
+  for failure in failures:
+    print("FAILED: " + failure)
+  return 1 if failures else 0
+
+if __name__ == "__main__":
+  sys.exit(Main())
@@ -0,0 +1,78 @@
+# Passes versus mode messages between two Arduboys plugged into this computer.
+#
+# An Arduboy's USB port is a device, so two of them can't be plugged into each other. Each one shows up here as a
+# serial port instead (ie. /dev/ttyACM0 and /dev/ttyACM1 on Linux, /dev/cu.usbmodem* on macOS), and this copies
+# every byte that comes in on one port out the other one. The game doesn't need anything else from it; messages
+# are checksummed and resent by the game, so it doesn't matter how the bytes are split up on the way.
+#
+# Usage: python3 VersusRelay.py /dev/ttyACM0 /dev/ttyACM1
+#
+# Only uses the standard library, but needs termios, so it runs on Linux and macOS and not on Windows.
+
+import argparse
+import os
+import select
+import sys
+import termios
+import time
+import tty
+
+# The Arduboy's USB serial port ignores the baud rate, but this matches Serial.begin() in the sketch anyway.
+# Don't use 1200, since opening the port at 1200 baud resets an Arduboy into its bootloader.
+BAUD_RATE = termios.B9600
+READ_SIZE = 256
+
+def OpenPort(path):
+  fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+  # Raw mode, so no bytes are swallowed or changed (ie. 0x03 isn't a Ctrl-C, and 0x0D isn't turned into 0x0A)
+  tty.setraw(fd)
+  attributes = termios.tcgetattr(fd)
+  attributes[4] = BAUD_RATE
+  attributes[5] = BAUD_RATE
+  termios.tcsetattr(fd, termios.TCSANOW, attributes)
+  return fd
+
+def WriteAll(fd, data):
+  while data:
+    written = os.write(fd, data)
+    data = data[written:]
+
+def Relay(paths, verbose):
+  fds = [OpenPort(path) for path in paths]
+  other = {fds[0]: fds[1], fds[1]: fds[0]}
+  byteCounts = {fds[0]: 0, fds[1]: 0}
+  lastReportTime = time.monotonic()
+  print("Relaying between {0} and {1}. Press Ctrl-C to stop.".format(paths[0], paths[1]))
+  try:
+    while True:
+      readable, _, _ = select.select(fds, [], [], 1.0)
+      for fd in readable:
+        try:
+          data = os.read(fd, READ_SIZE)
+        except OSError:
+          data = b""
+        if not data:
+          # An Arduboy was unplugged or reset
+          print("{0} was disconnected".format(paths[fds.index(fd)]))
+          return 1
+        WriteAll(other[fd], data)
+        byteCounts[fd] += len(data)
+      if verbose and (time.monotonic() - lastReportTime >= 5.0):
+        lastReportTime = time.monotonic()
+        print("{0}: {1} bytes sent, {2}: {3} bytes sent".format(paths[0], byteCounts[fds[0]], paths[1], byteCounts[fds[1]]))
+  except KeyboardInterrupt:
+    return 0
+  finally:
+    for fd in fds:
+      os.close(fd)
+
+def Main():
+  parser = argparse.ArgumentParser(description="Passes versus mode messages between two Arduboys.")
+  parser.add_argument("port1", help="Serial port of the first Arduboy (ie. /dev/ttyACM0)")
+  parser.add_argument("port2", help="Serial port of the second Arduboy (ie. /dev/ttyACM1)")
+  parser.add_argument("-v", "--verbose", action="store_true", help="Print how many bytes each one has sent every few seconds")
+  args = parser.parse_args()
+  return Relay([args.port1, args.port2], args.verbose)
+
+if __name__ == "__main__":
+  sys.exit(Main())